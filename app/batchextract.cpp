@@ -31,28 +31,47 @@
 #include "kerfuffle/archive.h"
 #include "kerfuffle/extractiondialog.h"
 #include "kerfuffle/jobs.h"
+#include "kerfuffle/jobscheduler.h"
 #include "kerfuffle/queries.h"
+#include "kerfuffle/settings.h"
 
 #include <KDebug>
 #include <KGlobal>
 #include <KLocale>
 #include <KMessageBox>
 #include <KRun>
-#include <KIO/RenameDialog>
+#include <KTempDir>
 #include <kwidgetjobtracker.h>
 
 #include <QDir>
 #include <QFileInfo>
+#include <QThread>
 #include <QTimer>
 #include <QWeakPointer>
 
+// More concurrent extractions than this rarely help unless the archives
+// are on different disks, and they make seeking hurt on rotating ones.
+static const int MaximumAutomaticConcurrentJobs = 4;
+
+static bool archiveSizeGreaterThan(const QPair<qulonglong, KJob*>& first, const QPair<qulonglong, KJob*>& second)
+{
+    return first.first > second.first;
+}
+
 BatchExtract::BatchExtract(QObject* parent)
     : KCompositeJob(parent),
+      m_totalSize(0),
+      m_finishedSize(0),
+      m_concurrentJobs(0),
       m_autoSubfolder(false),
+      m_suspended(false),
+      m_overwriteAll(false),
+      m_skipAll(false),
+      m_emitResultWhenStopped(false),
       m_preservePaths(true),
       m_openDestinationAfterExtraction(false)
 {
-    setCapabilities(KJob::Killable);
+    setCapabilities(KJob::Killable | KJob::Suspendable);
 
     connect(this, SIGNAL(result(KJob*)), SLOT(showFailedFiles()));
 }
@@ -62,35 +81,55 @@ BatchExtract::~BatchExtract()
     if (!m_inputs.isEmpty()) {
         KIO::getJobTracker()->unregisterJob(this);
     }
+
+    // The extractions stopped by doKill() may not have reported back yet.
+    // Nothing is left to answer their queries by now, so this waits for
+    // their threads instead.
+    foreach(KJob *subjob, subjobs()) {
+        removeSubjob(subjob);
+        delete subjob;
+    }
+
+    removeTemporaryDirectories();
 }
 
 void BatchExtract::addExtraction(Kerfuffle::Archive* archive)
 {
-    QString destination = destinationFolder();
-
-    if ((autoSubfolder()) && (!archive->isSingleFolderArchive())) {
-        const QDir d(destination);
-        QString subfolderName = archive->subfolderName();
-
-        if (d.exists(subfolderName)) {
-            subfolderName = KIO::RenameDialog::suggestName(destination, subfolderName);
+    const QString destination = destinationFolder();
+    QString extractionDirectory = destination;
+
+    // Whether the archive needs a subfolder is only known once its
+    // contents have been seen. Instead of listing it beforehand, it is
+    // extracted next to its final location and moved there afterwards.
+    if (autoSubfolder()) {
+        KTempDir tempDir(destination + QLatin1String("/.ark-extract-"), 0777);
+        tempDir.setAutoRemove(false);
+
+        if (tempDir.status() == 0) {
+            extractionDirectory = QDir::cleanPath(tempDir.name());
+        } else {
+            kDebug() << "Could not create a temporary directory in" << destination;
         }
-
-        d.mkdir(subfolderName);
-
-        destination += QLatin1Char( '/' ) + subfolderName;
     }
 
     Kerfuffle::ExtractionOptions options;
     options[QLatin1String( "PreservePaths" )] = preservePaths();
 
-    Kerfuffle::ExtractJob *job = archive->copyFiles(QVariantList(), destination, options);
+    Kerfuffle::ExtractJob *job = archive->copyFiles(QVariantList(), extractionDirectory, options);
 
-    kDebug() << QString(QLatin1String( "Registering job from archive %1, to %2, preservePaths %3" )).arg(archive->fileName()).arg(destination).arg(preservePaths());
+    kDebug() << QString(QLatin1String( "Registering job from archive %1, to %2, preservePaths %3" )).arg(archive->fileName()).arg(extractionDirectory).arg(preservePaths());
 
+    // Deleting a running job blocks until its thread is done, so the jobs
+    // are deleted once they have reported their result, see stopSubjobs().
+    job->setAutoDelete(false);
     addSubjob(job);
 
     m_fileNames[job] = qMakePair(archive->fileName(), destination);
+    m_jobSizes[job] = QFileInfo(archive->fileName()).size();
+
+    if (extractionDirectory != destination) {
+        m_temporaryDirectories[job] = qMakePair(extractionDirectory, archive->defaultSubfolderName());
+    }
 
     connect(job, SIGNAL(percent(KJob*,ulong)),
             this, SLOT(forwardProgress(KJob*,ulong)));
@@ -98,6 +137,144 @@ void BatchExtract::addExtraction(Kerfuffle::Archive* archive)
             this, SLOT(slotUserQuery(Kerfuffle::Query*)));
 }
 
+BatchExtract::MoveResult BatchExtract::moveFromTemporaryDirectory(KJob *job)
+{
+    if (!m_temporaryDirectories.contains(job)) {
+        return MoveSucceeded;
+    }
+
+    // Whatever happens next, the directory is not removed with the others.
+    const QPair<QString, QString> directories = m_temporaryDirectories.take(job);
+    const QString temporaryDirectory = directories.first;
+    const QDir destination(m_fileNames.value(job).second);
+
+    const QStringList entries =
+        QDir(temporaryDirectory).entryList(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+
+    if (entries.isEmpty()) {
+        destination.rmdir(temporaryDirectory);
+        return MoveSucceeded;
+    }
+
+    // A single folder at the top level is moved out on its own, anything
+    // else gets the temporary directory renamed after the archive.
+    const bool isSingleFolderArchive =
+        (entries.count() == 1) && QFileInfo(QDir(temporaryDirectory).filePath(entries.first())).isDir();
+
+    const QString source = isSingleFolderArchive ?
+                           QDir(temporaryDirectory).filePath(entries.first()) :
+                           temporaryDirectory;
+    QString target = destination.filePath(isSingleFolderArchive ?
+                                          entries.first() :
+                                          directories.second);
+
+    while (QFileInfo(target).exists() || QFileInfo(target).isSymLink()) {
+        if (!m_overwriteAll) {
+            if (m_skipAll) {
+                KTempDir::removeDir(temporaryDirectory);
+                return MoveSucceeded;
+            }
+
+            Kerfuffle::OverwriteQuery query(target);
+            query.setMultiMode(m_inputs.size() > 1);
+            slotUserQuery(&query);
+            query.waitForResponse();
+
+            if (query.responseCancelled()) {
+                KTempDir::removeDir(temporaryDirectory);
+                return MoveCancelled;
+            } else if (query.responseSkip() || query.responseAutoSkip()) {
+                m_skipAll = query.responseAutoSkip();
+                KTempDir::removeDir(temporaryDirectory);
+                return MoveSucceeded;
+            } else if (query.responseRename()) {
+                target = query.newFilename();
+                continue;
+            } else if (query.responseOverwriteAll()) {
+                m_overwriteAll = true;
+            }
+        }
+
+        const QFileInfo existing(target);
+        const bool removed = (existing.isDir() && !existing.isSymLink()) ?
+                             KTempDir::removeDir(target) :
+                             QFile::remove(target);
+        if (!removed) {
+            kDebug() << "Could not overwrite" << target;
+            return MoveFailed;
+        }
+    }
+
+    kDebug() << "Moving" << source << "to" << target;
+
+    // Unless the user chose a name elsewhere, both are in the same
+    // directory, so this is an atomic rename.
+    if (!destination.rename(source, target)) {
+        return MoveFailed;
+    }
+
+    if (isSingleFolderArchive) {
+        destination.rmdir(temporaryDirectory);
+    }
+
+    return MoveSucceeded;
+}
+
+void BatchExtract::removeTemporaryDirectory(KJob *job)
+{
+    if (m_temporaryDirectories.contains(job)) {
+        KTempDir::removeDir(m_temporaryDirectories.take(job).first);
+    }
+}
+
+void BatchExtract::removeTemporaryDirectories()
+{
+    foreach(const QPair<QString, QString>& directories, m_temporaryDirectories) {
+        KTempDir::removeDir(directories.first);
+    }
+
+    m_temporaryDirectories.clear();
+}
+
+void BatchExtract::stopSubjobs()
+{
+    // The queued jobs have not been started, they can just be dropped.
+    foreach(KJob *subjob, m_queuedJobs) {
+        removeSubjob(subjob);
+        removeTemporaryDirectory(subjob);
+        delete subjob;
+    }
+    m_queuedJobs.clear();
+
+    // The running ones are only asked to stop: their thread may be waiting
+    // for this one to answer a query, so waiting for it here could block
+    // both forever. Their temporary directory is removed once their
+    // result arrives, when nothing is written to it anymore.
+    foreach(KJob *subjob, m_jobPercents.keys()) {
+        subjob->kill(KJob::Quietly);
+
+        // A job the scheduler had not started yet is done already.
+        Kerfuffle::Job *archiveJob = qobject_cast<Kerfuffle::Job*>(subjob);
+        if (archiveJob && !archiveJob->isRunning()) {
+            removeSubjob(subjob);
+            removeTemporaryDirectory(subjob);
+            subjob->deleteLater();
+        } else {
+            m_stoppingJobs.insert(subjob);
+        }
+    }
+    m_jobPercents.clear();
+}
+
+void BatchExtract::emitResultOnceStopped()
+{
+    if (m_stoppingJobs.isEmpty()) {
+        emitResult();
+    } else {
+        m_emitResultWhenStopped = true;
+    }
+}
+
 void BatchExtract::slotUserQuery(Kerfuffle::Query *query)
 {
     query->execute();
@@ -130,19 +307,83 @@ void BatchExtract::slotStartJob()
         addExtraction(archive);
     }
 
+    QList<QPair<qulonglong, KJob*> > jobsBySize;
+    foreach(KJob *job, subjobs()) {
+        jobsBySize.append(qMakePair(m_jobSizes.value(job), job));
+        m_totalSize += m_jobSizes.value(job);
+    }
+
+    // qStableSort keeps archives of the same size in the order they
+    // were given.
+    qStableSort(jobsBySize.begin(), jobsBySize.end(), archiveSizeGreaterThan);
+
+    for (int i = 0; i < jobsBySize.size(); ++i) {
+        m_queuedJobs.append(jobsBySize.at(i).second);
+    }
+
+    // Do not let the scheduler hold back the extractions we start.
+    Kerfuffle::JobScheduler *scheduler = Kerfuffle::JobScheduler::self();
+    if (scheduler->maximumConcurrentJobs() < concurrentJobs()) {
+        scheduler->setMaximumConcurrentJobs(concurrentJobs());
+    }
+
     KIO::getJobTracker()->registerJob(this);
 
-    emit description(this,
-                     i18n("Extracting file..."),
-                     qMakePair(i18n("Source archive"), m_fileNames.value(subjobs().at(0)).first),
-                     qMakePair(i18n("Destination"), m_fileNames.value(subjobs().at(0)).second)
-                    );
+    setTotalAmount(KJob::Bytes, m_totalSize);
+
+    kDebug() << "Extracting" << m_queuedJobs.size() << "archives," << concurrentJobs() << "at a time";
+
+    startQueuedJobs();
+}
+
+bool BatchExtract::doKill()
+{
+    // KJob::kill() emits the result right away, the stopped extractions
+    // clean up after themselves when they report back.
+    stopSubjobs();
+    return true;
+}
+
+bool BatchExtract::doSuspend()
+{
+    foreach(KJob *job, m_jobPercents.keys()) {
+        job->suspend();
+    }
 
-    m_initialJobCount = subjobs().size();
+    m_suspended = true;
+    return true;
+}
+
+bool BatchExtract::doResume()
+{
+    m_suspended = false;
 
-    kDebug() << "Starting first job";
+    foreach(KJob *job, m_jobPercents.keys()) {
+        job->resume();
+    }
 
-    subjobs().at(0)->start();
+    startQueuedJobs();
+    return true;
+}
+
+void BatchExtract::startQueuedJobs()
+{
+    if (m_suspended) {
+        return;
+    }
+
+    while (!m_queuedJobs.isEmpty() && (m_jobPercents.size() < concurrentJobs())) {
+        KJob *job = m_queuedJobs.takeFirst();
+
+        emit description(this,
+                         i18n("Extracting file..."),
+                         qMakePair(i18n("Source archive"), m_fileNames.value(job).first),
+                         qMakePair(i18n("Destination"), m_fileNames.value(job).second)
+                        );
+
+        m_jobPercents[job] = 0;
+        job->start();
+    }
 }
 
 void BatchExtract::showFailedFiles()
@@ -156,25 +397,65 @@ void BatchExtract::slotResult(KJob *job)
 {
     kDebug();
 
+    // The jobs dropped by stopSubjobs() may have had their result queued
+    // already.
+    if (!subjobs().contains(job)) {
+        return;
+    }
+
+    removeSubjob(job);
+    m_jobPercents.remove(job);
+    job->deleteLater();
+
+    if (m_stoppingJobs.remove(job)) {
+        removeTemporaryDirectory(job);
+
+        if (m_stoppingJobs.isEmpty() && m_emitResultWhenStopped) {
+            emitResult();
+        }
+        return;
+    }
+
     // TODO: The user must be informed about which file caused the error, and that the other files
     //       in the queue will not be extracted.
     if (job->error()) {
-        kDebug() << "There was en error, " << job->errorText();
-
         setErrorText(job->errorText());
         setError(job->error());
+    } else {
+        const QString temporaryDirectory = m_temporaryDirectories.value(job).first;
+        const MoveResult moved = moveFromTemporaryDirectory(job);
+
+        if (moved == MoveFailed) {
+            // Keep the extracted files where they are, they may be the only
+            // copy the user gets.
+            setErrorText(i18n("The files extracted from %1 could not be moved out of %2.",
+                              m_fileNames.value(job).first, temporaryDirectory));
+            setError(KJob::UserDefinedError);
+        } else if (moved == MoveCancelled) {
+            setError(KJob::KilledJobError);
+            stopSubjobs();
+            emitResultOnceStopped();
+            return;
+        }
+    }
 
-        removeSubjob(job);
+    if (error()) {
+        kDebug() << "There was en error, " << errorText();
 
-        KMessageBox::error(NULL, job->errorText().isEmpty() ?
-                           i18n("There was an error during extraction.") : job->errorText()
+        // The other archives are not extracted either, stop the ones
+        // already running and remove what they extracted.
+        stopSubjobs();
+
+        KMessageBox::error(NULL, errorText().isEmpty() ?
+                           i18n("There was an error during extraction.") : errorText()
                           );
 
-        emitResult();
+        emitResultOnceStopped();
 
         return;
     } else {
-        removeSubjob(job);
+        m_finishedSize += m_jobSizes.value(job);
+        updateProgress();
     }
 
     if (!hasSubjobs()) {
@@ -188,20 +469,35 @@ void BatchExtract::slotResult(KJob *job)
         emitResult();
     } else {
         kDebug() << "Starting the next job";
-        emit description(this,
-                         i18n("Extracting file..."),
-                         qMakePair(i18n("Source archive"), m_fileNames.value(subjobs().at(0)).first),
-                         qMakePair(i18n("Destination"), m_fileNames.value(subjobs().at(0)).second)
-                        );
-        subjobs().at(0)->start();
+        startQueuedJobs();
     }
 }
 
 void BatchExtract::forwardProgress(KJob *job, unsigned long percent)
 {
-    Q_UNUSED(job)
-    int jobPart = 100 / m_initialJobCount;
-    setPercent(jobPart *(m_initialJobCount - subjobs().size()) + percent / m_initialJobCount);
+    if (m_jobPercents.contains(job)) {
+        m_jobPercents[job] = percent;
+        updateProgress();
+    }
+}
+
+void BatchExtract::updateProgress()
+{
+    // Each archive counts for its size, so that a small archive which
+    // is done quickly does not make the whole batch look further along
+    // than it is.
+    qulonglong processedSize = m_finishedSize;
+
+    QHash<KJob*, unsigned long>::const_iterator it = m_jobPercents.constBegin();
+    for (; it != m_jobPercents.constEnd(); ++it) {
+        processedSize += m_jobSizes.value(it.key()) * it.value() / 100;
+    }
+
+    setProcessedAmount(KJob::Bytes, processedSize);
+
+    if (m_totalSize > 0) {
+        setPercent(processedSize * 100 / m_totalSize);
+    }
 }
 
 bool BatchExtract::addInput(const KUrl& url)
@@ -218,6 +514,25 @@ bool BatchExtract::addInput(const KUrl& url)
     return true;
 }
 
+int BatchExtract::concurrentJobs() const
+{
+    if (m_concurrentJobs > 0) {
+        return m_concurrentJobs;
+    }
+
+    const int configuredJobs = ArkSettings::concurrentExtractions();
+    if (configuredJobs > 0) {
+        return configuredJobs;
+    }
+
+    return qBound(1, QThread::idealThreadCount(), MaximumAutomaticConcurrentJobs);
+}
+
+void BatchExtract::setConcurrentJobs(int count)
+{
+    m_concurrentJobs = qMax(0, count);
+}
+
 bool BatchExtract::openDestinationAfterExtraction() const
 {
     return m_openDestinationAfterExtraction;
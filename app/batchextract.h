@@ -32,8 +32,10 @@
 #include <kcompositejob.h>
 #include <KUrl>
 
+#include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QPair>
+#include <QtCore/QSet>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 
@@ -187,6 +189,37 @@ public:
      */
     void setPreservePaths(bool value);
 
+    /**
+     * Returns how many archives are extracted at the same time.
+     *
+     * @see setConcurrentJobs
+     */
+    int concurrentJobs() const;
+
+    /**
+     * Sets how many archives are extracted at the same time.
+     *
+     * Extracting is mostly bound by the disk, so the automatic value is
+     * kept low even on machines with many processors.
+     *
+     * @param count The number of archives, or 0 to choose automatically.
+     */
+    void setConcurrentJobs(int count);
+
+protected:
+    /**
+     * Stops the running extractions and removes what they extracted to
+     * their temporary directories.
+     */
+    virtual bool doKill();
+
+    /**
+     * Suspends the running extractions and holds back the queued ones
+     * until the batch is resumed.
+     */
+    virtual bool doSuspend();
+    virtual bool doResume();
+
 private slots:
     /**
      * Updates the percentage of the job that has been completed.
@@ -200,9 +233,8 @@ private slots:
     void showFailedFiles();
 
     /**
-     * Shows an error message if the current job hasn't finished
-     * successfully, and advances to the next extraction job if
-     * there are more.
+     * Shows an error message if the job hasn't finished successfully,
+     * and starts the next queued extraction job if there are more.
      */
     void slotResult(KJob *job);
 
@@ -214,15 +246,81 @@ private slots:
     /**
      * Does the real work for start() and extracts all scheduled files.
      *
-     * Each extraction job is started after the last one finishes.
-     * The jobs are executed in the order they were added via addInput().
+     * Up to concurrentJobs() extraction jobs run at the same time. The
+     * biggest archives are extracted first, so that the small ones fill
+     * the gaps at the end instead of leaving a single big extraction
+     * running on its own.
      */
     void slotStartJob();
 
 private:
-    int m_initialJobCount;
+    /**
+     * Starts queued jobs until concurrentJobs() of them are running.
+     */
+    void startQueuedJobs();
+
+    void updateProgress();
+
+    enum MoveResult {
+        MoveSucceeded,
+        MoveFailed,
+        MoveCancelled
+    };
+
+    /**
+     * Moves what @p job extracted from its temporary directory to the
+     * destination folder, in a subfolder if the archive did not have a
+     * single folder at its top level.
+     *
+     * If the destination already exists, the user is asked whether to
+     * overwrite it, skip the archive or choose another name.
+     */
+    MoveResult moveFromTemporaryDirectory(KJob *job);
+
+    /**
+     * Removes the temporary directory of @p job, if its files have not
+     * been moved out of it.
+     */
+    void removeTemporaryDirectory(KJob *job);
+
+    /**
+     * Removes the temporary directories of the jobs whose files have not
+     * been moved out of them.
+     */
+    void removeTemporaryDirectories();
+
+    /**
+     * Drops the queued subjobs and asks the running ones to stop. The
+     * running ones are only removed, along with their temporary
+     * directory, once their result arrives.
+     */
+    void stopSubjobs();
+
+    /**
+     * Emits the result now, or once the jobs stopped by stopSubjobs() have
+     * all reported back.
+     */
+    void emitResultOnceStopped();
+
     QMap<KJob*, QPair<QString, QString> > m_fileNames;
+
+    /**
+     * The temporary directory each job extracts to when autoSubfolder()
+     * is set, and the subfolder name to use if needed.
+     */
+    QHash<KJob*, QPair<QString, QString> > m_temporaryDirectories;
+    QList<KJob*> m_queuedJobs;
+    QSet<KJob*> m_stoppingJobs; // asked to stop by stopSubjobs()
+    QHash<KJob*, qulonglong> m_jobSizes;
+    QHash<KJob*, unsigned long> m_jobPercents;
+    qulonglong m_totalSize;
+    qulonglong m_finishedSize;
+    int m_concurrentJobs;
     bool m_autoSubfolder;
+    bool m_suspended;
+    bool m_overwriteAll;
+    bool m_skipAll;
+    bool m_emitResultWhenStopped;
 
     QList<Kerfuffle::Archive*> m_inputs;
     QString m_destinationFolder;
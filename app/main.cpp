@@ -98,8 +98,13 @@ int main(int argc, char **argv)
     option.add("t").add("add-to <filename>", ki18n("Add the specified files to 'filename'. Create archive if it does not exist. Quit when finished."));
     option.add("p").add("changetofirstpath", ki18n("Change the current dir to the first entry and add all other entries relative to this one."));
     option.add("f").add("autofilename <suffix>", ki18n("Automatically choose a filename, with the selected suffix (for example rar, tar.gz, zip or any other supported types)"));
+    option.add("compression-level <level>", ki18n("Compression level, from 0 (no compression) to 9 (best compression)"));
+    option.add("threads <number>", ki18n("Number of threads used for compressing, if supported by the archive type"));
+    option.add("solid <yes|no>", ki18n("Whether to create a solid archive, if supported by the archive type"));
+    option.add("dictionary-size <KiB>", ki18n("Size of the compression dictionary in KiB, if supported by the archive type"));
     option.add(":", ki18n("Options for batch extraction:"));
     option.add("b").add("batch", ki18n("Use the batch interface instead of the usual dialog. This option is implied if more than one url is specified."));
+    option.add("jobs <number>", ki18n("The number of archives to extract at the same time in batch mode"));
     option.add("e").add("autodestination", ki18n("The destination argument will be set to the path of the first file supplied."));
     option.add("a").add("autosubfolder", ki18n("Archive contents will be read, and if detected to not be a single folder archive, a subfolder with the name of the archive will be created."));
     KCmdLineArgs::addCmdLineOptions(option);
@@ -140,6 +145,21 @@ int main(int argc, char **argv)
                 addToArchiveJob->setAutoFilenameSuffix(args->getOption("autofilename"));
             }
 
+            Kerfuffle::CompressionOptions compressionOptions;
+            if (args->isSet("compression-level")) {
+                compressionOptions[QLatin1String("GlobalCompressionLevel")] = args->getOption("compression-level").toInt();
+            }
+            if (args->isSet("threads")) {
+                compressionOptions[QLatin1String("GlobalCompressionThreads")] = args->getOption("threads").toInt();
+            }
+            if (args->isSet("solid")) {
+                compressionOptions[QLatin1String("GlobalSolidArchive")] = (args->getOption("solid") != QLatin1String("no"));
+            }
+            if (args->isSet("dictionary-size")) {
+                compressionOptions[QLatin1String("GlobalDictionarySize")] = args->getOption("dictionary-size").toInt();
+            }
+            addToArchiveJob->setCompressionOptions(compressionOptions);
+
             for (int i = 0; i < args->count(); ++i) {
                 //TODO: use the returned value here?
                 addToArchiveJob->addInput(args->url(i));
@@ -176,6 +196,11 @@ int main(int argc, char **argv)
                 batchJob->setDestinationFolder(args->getOption("destination"));
             }
 
+            if (args->isSet("jobs")) {
+                kDebug() << "Extracting" << args->getOption("jobs") << "archives at a time";
+                batchJob->setConcurrentJobs(args->getOption("jobs").toInt());
+            }
+
             if (args->isSet("dialog")) {
                 if (!batchJob->showExtractDialog()) {
                     return 0;
@@ -33,6 +33,7 @@
 #include <KConfigGroup>
 #include <KFilePlacesModel>
 #include <KGlobal>
+#include <KLocale>
 
 #include <QFileInfo>
 #include <QStandardItemModel>
@@ -64,6 +65,7 @@ AddDialog::AddDialog(const QStringList& itemsToAdd,
     loadConfiguration();
 
     connect(this, SIGNAL(okClicked()), SLOT(updateDefaultMimeType()));
+    connect(this, SIGNAL(okClicked()), SLOT(updateDefaultCompressionOptions()));
 
     m_ui = new AddDialogUI(this);
     mainWidget()->layout()->addWidget(m_ui);
@@ -82,9 +84,47 @@ AddDialog::AddDialog(const QStringList& itemsToAdd,
         setSelection(fileName + currentFilterMimeType()->mainExtension());
     }
 
-    //These extra options will be implemented in a 4.2+ version of
-    //ark
-    m_ui->groupExtraOptions->hide();
+    setupCompressionOptions();
+}
+
+void AddDialog::setupCompressionOptions()
+{
+    m_ui->dictionarySize->addItem(i18nc("@item:inlistbox dictionary size", "Default"), 0);
+    foreach(int size, QList<int>() << 64 << 1024 << 4 * 1024 << 16 * 1024 << 64 * 1024) {
+        m_ui->dictionarySize->addItem(KGlobal::locale()->formatByteSize(size * 1024.0), size);
+    }
+
+    m_ui->compressionLevel->setValue(m_config.readEntry("CompressionLevel", -1));
+    m_ui->compressionThreads->setValue(m_config.readEntry("CompressionThreads", 0));
+    m_ui->solidArchive->setCurrentIndex(m_config.readEntry("SolidArchive", 0));
+
+    const int dictionarySizeIndex = m_ui->dictionarySize->findData(m_config.readEntry("DictionarySize", 0));
+    m_ui->dictionarySize->setCurrentIndex(qMax(0, dictionarySizeIndex));
+}
+
+CompressionOptions AddDialog::compressionOptions() const
+{
+    CompressionOptions options;
+
+    if (m_ui->compressionLevel->value() >= 0) {
+        options[QLatin1String("GlobalCompressionLevel")] = m_ui->compressionLevel->value();
+    }
+
+    if (m_ui->compressionThreads->value() > 0) {
+        options[QLatin1String("GlobalCompressionThreads")] = m_ui->compressionThreads->value();
+    }
+
+    // The items are "Default", "Yes" and "No".
+    if (m_ui->solidArchive->currentIndex() > 0) {
+        options[QLatin1String("GlobalSolidArchive")] = (m_ui->solidArchive->currentIndex() == 1);
+    }
+
+    const int dictionarySize = m_ui->dictionarySize->itemData(m_ui->dictionarySize->currentIndex()).toInt();
+    if (dictionarySize > 0) {
+        options[QLatin1String("GlobalDictionarySize")] = dictionarySize;
+    }
+
+    return options;
 }
 
 void AddDialog::loadConfiguration()
@@ -130,6 +170,14 @@ void AddDialog::updateDefaultMimeType()
 {
     m_config.writeEntry("LastMimeType", currentMimeFilter());
 }
+
+void AddDialog::updateDefaultCompressionOptions()
+{
+    m_config.writeEntry("CompressionLevel", m_ui->compressionLevel->value());
+    m_config.writeEntry("CompressionThreads", m_ui->compressionThreads->value());
+    m_config.writeEntry("SolidArchive", m_ui->solidArchive->currentIndex());
+    m_config.writeEntry("DictionarySize", m_ui->dictionarySize->itemData(m_ui->dictionarySize->currentIndex()).toInt());
+}
 }
 
 #include "adddialog.moc"
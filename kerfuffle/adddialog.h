@@ -30,6 +30,7 @@
 #define ADDDIALOG_H
 
 #include "kerfuffle_export.h"
+#include "archive.h"
 
 #include <KConfigGroup>
 #include <KFileDialog>
@@ -48,15 +49,23 @@ public:
               QWidget * widget = 0
              );
 
+    /**
+     * Returns the compression options chosen by the user. Options left
+     * to their default values are not included.
+     */
+    CompressionOptions compressionOptions() const;
+
 private:
     class AddDialogUI *m_ui;
     KConfigGroup m_config;
 
     void loadConfiguration();
     void setupIconList(const QStringList& itemsToAdd);
+    void setupCompressionOptions();
 
 private slots:
     void updateDefaultMimeType();
+    void updateDefaultCompressionOptions();
 };
 }
 
@@ -64,6 +64,11 @@ void AddToArchive::setChangeToFirstPath(bool value)
     m_changeToFirstPath = value;
 }
 
+void AddToArchive::setCompressionOptions(const CompressionOptions& options)
+{
+    m_compressionOptions = options;
+}
+
 void AddToArchive::setFilename(const KUrl& path)
 {
     m_filename = path.pathOrUrl();
@@ -90,6 +95,12 @@ bool AddToArchive::showAddDialog(void)
         kDebug() << "Returned mime:" << dialog.data()->currentMimeFilter();
         setFilename(dialog.data()->selectedUrl());
         setMimeType(dialog.data()->currentMimeFilter());
+
+        const CompressionOptions dialogOptions = dialog.data()->compressionOptions();
+        CompressionOptions::const_iterator it = dialogOptions.constBegin();
+        for (; it != dialogOptions.constEnd(); ++it) {
+            m_compressionOptions[it.key()] = it.value();
+        }
     }
 
     delete dialog.data();
@@ -124,7 +135,7 @@ void AddToArchive::slotStartJob(void)
 {
     kDebug();
 
-    Kerfuffle::CompressionOptions options;
+    Kerfuffle::CompressionOptions options(m_compressionOptions);
 
     if (!m_inputs.size()) {
         KMessageBox::error(NULL, i18n("No input files were given."));
@@ -30,6 +30,7 @@
 #define ADDTOARCHIVE_H
 
 #include "kerfuffle_export.h"
+#include "archive.h"
 
 #include <KJob>
 #include <KUrl>
@@ -59,6 +60,13 @@ public:
     void setPreservePaths(bool value);
     void setChangeToFirstPath(bool value);
 
+    /**
+     * Sets the compression options (such as GlobalCompressionLevel) given
+     * to the archive interface. The ones chosen in the add dialog take
+     * precedence.
+     */
+    void setCompressionOptions(const CompressionOptions& options);
+
 public slots:
     bool addInput(const KUrl& url);
     void setAutoFilenameSuffix(const QString& suffix);
@@ -77,6 +85,7 @@ private:
     QString m_firstPath;
     QString m_mimeType;
     QStringList m_inputs;
+    CompressionOptions m_compressionOptions;
     bool m_changeToFirstPath;
 };
 }
@@ -65,6 +65,53 @@ static QString determineMimeType(const QString& filename)
     return KMimeType::findByNameAndContent(filename, buffer)->name();
 }
 
+namespace
+{
+
+/**
+ * Stops as soon as two entries with different top-level names are seen.
+ */
+class SingleFolderVisitor : public Kerfuffle::EntryVisitor
+{
+public:
+    SingleFolderVisitor()
+        : m_isSingleFolderArchive(true)
+    {
+    }
+
+    virtual bool visit(const Kerfuffle::ArchiveEntry& entry)
+    {
+        const QString fileName(entry[Kerfuffle::FileName].toString());
+        const QString basePath(fileName.split(QLatin1Char( '/' )).at(0));
+
+        if (m_subfolderName.isEmpty()) {
+            m_subfolderName = basePath;
+        } else if (m_subfolderName != basePath) {
+            m_isSingleFolderArchive = false;
+            m_subfolderName.clear();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool isSingleFolderArchive() const
+    {
+        return m_isSingleFolderArchive;
+    }
+
+    QString subfolderName() const
+    {
+        return m_subfolderName;
+    }
+
+private:
+    bool m_isSingleFolderArchive;
+    QString m_subfolderName;
+};
+
+}
+
 static KService::List findPluginOffers(const QString& filename, const QString& fixedMimeType)
 {
     KService::List offers;
@@ -123,6 +170,7 @@ Archive::Archive(ReadOnlyArchiveInterface *archiveInterface, QObject *parent)
         : QObject(parent),
         m_iface(archiveInterface),
         m_hasBeenListed(false),
+        m_hasCheckedSingleFolder(false),
         m_isPasswordProtected(false),
         m_isSingleFolderArchive(false)
 {
@@ -185,7 +233,10 @@ AddJob* Archive::addFiles(const QStringList & files, const CompressionOptions& o
 ExtractJob* Archive::copyFiles(const QList<QVariant> & files, const QString & destinationDir, ExtractionOptions options)
 {
     ExtractionOptions newOptions = options;
-    if (isPasswordProtected()) {
+
+    // Do not list the archive just for the hint, the interfaces ask for
+    // the password when they need it anyway.
+    if (m_hasBeenListed && m_isPasswordProtected) {
         newOptions[QLatin1String( "PasswordProtectedHint" )] = true;
     }
 
@@ -193,6 +244,16 @@ ExtractJob* Archive::copyFiles(const QList<QVariant> & files, const QString & de
     return newJob;
 }
 
+PathTrie *Archive::pathTrie() const
+{
+    return m_iface->pathTrie();
+}
+
+VisitJob* Archive::visitEntries(EntryVisitor *visitor)
+{
+    return new VisitJob(visitor, m_iface, this);
+}
+
 QString Archive::fileName() const
 {
     return m_iface->filename();
@@ -219,18 +280,11 @@ void Archive::onListFinished(KJob* job)
     m_isPasswordProtected = ljob->isPasswordProtected();
     m_subfolderName = ljob->subfolderName();
     if (m_subfolderName.isEmpty()) {
-        QFileInfo fi(fileName());
-        QString base = fi.completeBaseName();
-
-        //special case for tar.gz/bzip2 files
-        if (base.right(4).toUpper() == QLatin1String(".TAR")) {
-            base.chop(4);
-        }
-
-        m_subfolderName = base;
+        m_subfolderName = defaultSubfolderName();
     }
 
     m_hasBeenListed = true;
+    m_hasCheckedSingleFolder = true;
 }
 
 void Archive::listIfNotListed()
@@ -255,9 +309,37 @@ void Archive::onUserQuery(Query* query)
     query->execute();
 }
 
+void Archive::checkSingleFolderIfNotChecked()
+{
+    if (m_hasCheckedSingleFolder) {
+        return;
+    }
+
+    SingleFolderVisitor visitor;
+    KJob *job = visitEntries(&visitor);
+
+    connect(job, SIGNAL(userQuery(Kerfuffle::Query*)),
+            SLOT(onUserQuery(Kerfuffle::Query*)));
+
+    QEventLoop loop(this);
+
+    connect(job, SIGNAL(result(KJob*)),
+            &loop, SLOT(quit()));
+    job->start();
+    loop.exec(); // krazy:exclude=crashy
+
+    m_isSingleFolderArchive = visitor.isSingleFolderArchive();
+    m_subfolderName = visitor.subfolderName();
+    if (m_subfolderName.isEmpty()) {
+        m_subfolderName = defaultSubfolderName();
+    }
+
+    m_hasCheckedSingleFolder = true;
+}
+
 bool Archive::isSingleFolderArchive()
 {
-    listIfNotListed();
+    checkSingleFolderIfNotChecked();
     return m_isSingleFolderArchive;
 }
 
@@ -269,10 +351,23 @@ bool Archive::isPasswordProtected()
 
 QString Archive::subfolderName()
 {
-    listIfNotListed();
+    checkSingleFolderIfNotChecked();
     return m_subfolderName;
 }
 
+QString Archive::defaultSubfolderName() const
+{
+    QFileInfo fi(fileName());
+    QString base = fi.completeBaseName();
+
+    //special case for tar.gz/bzip2 files
+    if (base.right(4).toUpper() == QLatin1String(".TAR")) {
+        base.chop(4);
+    }
+
+    return base;
+}
+
 void Archive::setPassword(const QString &password)
 {
     m_iface->setPassword(password);
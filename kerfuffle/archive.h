@@ -42,8 +42,11 @@ class ListJob;
 class ExtractJob;
 class DeleteJob;
 class AddJob;
+class VisitJob;
+class EntryVisitor;
 class Query;
 class ReadOnlyArchiveInterface;
+class PathTrie;
 
 /**
  * Meta data related to one entry in a compressed archive.
@@ -72,6 +75,7 @@ enum EntryMetaDataType {
     IsDirectory,         /**< The entry is a directory */
     Comment,
     IsPasswordProtected, /**< The entry is password-protected */
+    PathNode,            /**< The entry's node in the archive's PathTrie, set by Kerfuffle */
     Custom = 1048576
 };
 
@@ -108,6 +112,29 @@ public:
      * GlobalWorkDir - Change to this dir before adding the new files.
      * The path names should then be added relative to this directory.
      *
+     * Compression options that are handled by the interfaces supporting
+     * them, and ignored by the others:
+     *
+     * GlobalCompressionLevel - from 0 (store) to 9 (best compression).
+     *
+     * GlobalCompressionThreads - how many threads the compressor may use.
+     *
+     * GlobalSolidArchive - whether to compress all files as a single
+     * stream (a solid archive).
+     *
+     * GlobalDictionarySize - the size of the compression dictionary, in
+     * KiB.
+     *
+     * Options limiting the resources used, which are also extraction
+     * options:
+     *
+     * BandwidthLimit - the most bytes per second the job may copy, or 0
+     * for no limit. The programs run by the command line interfaces are
+     * stopped and continued to stay within it.
+     *
+     * IOPriorityClass - "idle" or "best-effort", the I/O scheduling class
+     * the job and the programs it runs get on Linux.
+     *
      * TODO: find a way to actually add files to specific locations in
      * the archive
      * (not supported yet) GlobalPathInArchive - a path relative to the
@@ -118,12 +145,33 @@ public:
 
     ExtractJob* copyFiles(const QList<QVariant> & files, const QString & destinationDir, ExtractionOptions options = ExtractionOptions());
 
+    /**
+     * Creates a job handing the entries of the archive to @p visitor
+     * until it returns false, for questions which can be answered
+     * without reading the whole archive.
+     */
+    VisitJob* visitEntries(EntryVisitor *visitor);
+
     bool isSingleFolderArchive();
     QString subfolderName();
     bool isPasswordProtected();
 
+    /**
+     * The name of the folder the archive is extracted to when it does not
+     * consist of a single folder: its file name without the extension.
+     *
+     * Unlike subfolderName(), this does not need the archive to be listed.
+     */
+    QString defaultSubfolderName() const;
+
     void setPassword(const QString &password);
 
+    /**
+     * The paths of the entries listed so far, which the PathNode of the
+     * entries refers to.
+     */
+    PathTrie *pathTrie() const;
+
 private slots:
     void onListFinished(KJob*);
     void onAddFinished(KJob*);
@@ -133,8 +181,16 @@ private:
     Archive(ReadOnlyArchiveInterface *archiveInterface, QObject *parent = 0);
 
     void listIfNotListed();
+
+    /**
+     * Finds out whether the archive has a single folder at its top level,
+     * reading only until two different top-level entries have been seen.
+     */
+    void checkSingleFolderIfNotChecked();
+
     ReadOnlyArchiveInterface *m_iface;
     bool m_hasBeenListed;
+    bool m_hasCheckedSingleFolder;
     bool m_isPasswordProtected;
     bool m_isSingleFolderArchive;
     QString m_subfolderName;
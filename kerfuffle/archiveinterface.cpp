@@ -31,14 +31,133 @@
 
 #include <QFileInfo>
 #include <QDir>
+#include <QMutexLocker>
 
 namespace Kerfuffle
 {
+// A batch of entries is sent when it reaches EntryBatchSize entries or
+// when its first entry has been waiting for EntryBatchInterval msecs.
+static const int EntryBatchSize = 1000;
+static const int EntryBatchInterval = 100;
+
+// The longest pace() sleeps before checking for a cancellation again, in
+// case nobody wakes it up.
+static const int MaximumPaceInterval = 100;
+
+EntryVisitor::~EntryVisitor()
+{
+}
+
+CancellationToken::CancellationToken()
+{
+}
+
+void CancellationToken::cancel()
+{
+    m_cancelled.fetchAndStoreOrdered(1);
+}
+
+void CancellationToken::reset()
+{
+    m_cancelled.fetchAndStoreOrdered(0);
+}
+
+bool CancellationToken::isCancelled() const
+{
+    return m_cancelled != 0;
+}
+
+OperationThrottle::OperationThrottle()
+    : m_suspended(false)
+    , m_bandwidthLimit(0)
+    , m_pacedBytes(0)
+{
+}
+
+void OperationThrottle::suspend()
+{
+    QMutexLocker locker(&m_mutex);
+    m_suspended = true;
+}
+
+void OperationThrottle::resume()
+{
+    QMutexLocker locker(&m_mutex);
+    m_suspended = false;
+    m_condition.wakeAll();
+}
+
+bool OperationThrottle::isSuspended() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_suspended;
+}
+
+void OperationThrottle::setBandwidthLimit(qint64 bytesPerSecond)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_bandwidthLimit = qMax<qint64>(0, bytesPerSecond);
+    m_pacedBytes = 0;
+    m_pacedTime.start();
+}
+
+qint64 OperationThrottle::bandwidthLimit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bandwidthLimit;
+}
+
+void OperationThrottle::pace(qint64 bytes, const CancellationToken *token)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_suspended) {
+        while (m_suspended && !token->isCancelled()) {
+            m_condition.wait(&m_mutex);
+        }
+
+        // The time spent suspended must not be made up for with a burst.
+        m_pacedBytes = 0;
+        m_pacedTime.start();
+    }
+
+    if ((m_bandwidthLimit <= 0) || (bytes <= 0)) {
+        return;
+    }
+
+    m_pacedBytes += bytes;
+
+    while (!m_suspended && !token->isCancelled()) {
+        const qint64 due = m_pacedBytes * 1000 / m_bandwidthLimit;
+        const qint64 elapsed = m_pacedTime.elapsed();
+
+        if (elapsed >= due) {
+            break;
+        }
+
+        m_condition.wait(&m_mutex, qMin<qint64>(due - elapsed, MaximumPaceInterval));
+    }
+}
+
+void OperationThrottle::wakeUp()
+{
+    QMutexLocker locker(&m_mutex);
+    m_condition.wakeAll();
+}
+
 ReadOnlyArchiveInterface::ReadOnlyArchiveInterface(QObject *parent, const QVariantList & args)
-        : QObject(parent), m_waitForFinishedSignal(false)
+        : QObject(parent), m_waitForFinishedSignal(false), m_visitor(0),
+        m_concurrentReader(0), m_hasCreatedConcurrentReader(false)
 {
     kDebug();
     m_filename = args.first().toString();
+
+    connect(this, SIGNAL(entry(ArchiveEntry)), SLOT(batchEntry(ArchiveEntry)), Qt::DirectConnection);
+
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(EntryBatchInterval);
+    connect(&m_flushTimer, SIGNAL(timeout()), SLOT(flushPendingEntries()));
 }
 
 ReadOnlyArchiveInterface::~ReadOnlyArchiveInterface()
@@ -70,22 +189,146 @@ QString ReadOnlyArchiveInterface::password() const
     return m_password;
 }
 
+bool ReadOnlyArchiveInterface::visitEntries(EntryVisitor *visitor)
+{
+    m_visitor = visitor;
+    connect(this, SIGNAL(entry(ArchiveEntry)), SLOT(visitEntry(ArchiveEntry)), Qt::DirectConnection);
+
+    const bool ret = list();
+
+    disconnect(this, SIGNAL(entry(ArchiveEntry)), this, SLOT(visitEntry(ArchiveEntry)));
+
+    // visitEntry() clears m_visitor when the visitor asks to stop.
+    const bool stoppedByVisitor = !m_visitor;
+    m_visitor = 0;
+
+    if (stoppedByVisitor) {
+        m_cancellationToken.reset();
+        return true;
+    }
+
+    return ret;
+}
+
+void ReadOnlyArchiveInterface::visitEntry(const ArchiveEntry &archiveEntry)
+{
+    // Entries may keep coming for a while until list() notices it
+    // has been stopped.
+    if (!m_visitor) {
+        return;
+    }
+
+    if (!m_visitor->visit(archiveEntry)) {
+        kDebug() << "Stopped by the visitor";
+        m_visitor = 0;
+        doKill();
+    }
+}
+
+void ReadOnlyArchiveInterface::batchEntry(const ArchiveEntry &archiveEntry)
+{
+    QMutexLocker locker(&m_pendingEntriesMutex);
+
+    if (m_pendingEntries.isEmpty()) {
+        m_pendingEntries.reserve(EntryBatchSize);
+
+        // The timer belongs to the GUI thread, the entries are usually
+        // emitted by a worker thread without an event loop.
+        QMetaObject::invokeMethod(&m_flushTimer, "start", Qt::QueuedConnection);
+    }
+
+    m_pendingEntries.append(archiveEntry);
+
+    // The path is split here once, instead of by everyone using the entry.
+    ArchiveEntry &pendingEntry = m_pendingEntries.last();
+    pendingEntry[PathNode] = m_pathTrie.insert(pendingEntry.value(FileName).toString());
+
+    if (m_pendingEntries.size() >= EntryBatchSize) {
+        emitPendingEntries();
+    }
+}
+
+void ReadOnlyArchiveInterface::flushEntries()
+{
+    QMutexLocker locker(&m_pendingEntriesMutex);
+    emitPendingEntries();
+}
+
+void ReadOnlyArchiveInterface::flushPendingEntries()
+{
+    flushEntries();
+}
+
+void ReadOnlyArchiveInterface::emitPendingEntries()
+{
+    if (m_pendingEntries.isEmpty()) {
+        return;
+    }
+
+    emit entries(m_pendingEntries);
+    m_pendingEntries.clear();
+}
+
+PathTrie *ReadOnlyArchiveInterface::pathTrie()
+{
+    return &m_pathTrie;
+}
+
+ReadOnlyArchiveInterface *ReadOnlyArchiveInterface::concurrentReader()
+{
+    if (!m_hasCreatedConcurrentReader) {
+        m_hasCreatedConcurrentReader = true;
+
+        m_concurrentReader = createConcurrentReader();
+        if (m_concurrentReader) {
+            m_concurrentReader->setParent(this);
+        }
+    }
+
+    return m_concurrentReader;
+}
+
+ReadOnlyArchiveInterface *ReadOnlyArchiveInterface::createConcurrentReader()
+{
+    return 0;
+}
+
+CancellationToken *ReadOnlyArchiveInterface::cancellationToken()
+{
+    return &m_cancellationToken;
+}
+
+OperationThrottle *ReadOnlyArchiveInterface::throttle()
+{
+    return &m_throttle;
+}
+
+bool ReadOnlyArchiveInterface::checkpoint(qint64 bytes)
+{
+    m_throttle.pace(bytes, &m_cancellationToken);
+    return !m_cancellationToken.isCancelled();
+}
+
 bool ReadOnlyArchiveInterface::doKill()
 {
     //default implementation
-    return false;
+    m_cancellationToken.cancel();
+    m_throttle.wakeUp();
+    return true;
 }
 
 bool ReadOnlyArchiveInterface::doSuspend()
 {
     //default implementation
-    return false;
+    m_throttle.suspend();
+    return true;
 }
 
 bool ReadOnlyArchiveInterface::doResume()
 {
     //default implementation
-    return false;
+    m_throttle.resume();
+    return true;
 }
 
 ReadWriteArchiveInterface::ReadWriteArchiveInterface(QObject *parent, const QVariantList & args)
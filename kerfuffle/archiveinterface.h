@@ -30,16 +30,109 @@
 
 #include "archive.h"
 #include "kerfuffle_export.h"
+#include "pathtrie.h"
 
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
 #include <QObject>
 #include <QStringList>
 #include <QString>
+#include <QTimer>
 #include <QVariantList>
+#include <QVector>
+#include <QWaitCondition>
 
 namespace Kerfuffle
 {
 class Query;
 
+/**
+ * Receives the entries of an archive one at a time.
+ *
+ * @see ReadOnlyArchiveInterface::visitEntries
+ */
+class KERFUFFLE_EXPORT EntryVisitor
+{
+public:
+    virtual ~EntryVisitor();
+
+    /**
+     * Called for each entry, in the order they are stored in the archive,
+     * from the thread the archive is being read in.
+     *
+     * @return @c true to go on with the next entry, @c false to stop
+     *         reading the archive.
+     */
+    virtual bool visit(const ArchiveEntry& entry) = 0;
+};
+
+/**
+ * Tells an operation running in another thread that it should stop.
+ *
+ * The interfaces check isCancelled() in every loop which may run for long,
+ * at least once per block of data they read or write, so that killing a
+ * job takes effect within a fraction of a second. An operation which stops
+ * this way removes the output it has only partially written.
+ */
+class KERFUFFLE_EXPORT CancellationToken
+{
+public:
+    CancellationToken();
+
+    void cancel();
+    void reset();
+    bool isCancelled() const;
+
+private:
+    QAtomicInt m_cancelled;
+};
+
+/**
+ * Paces an operation running in another thread: holds it while it is
+ * suspended, and slows it down so that it does not copy more than a given
+ * number of bytes per second.
+ *
+ * The interfaces call pace() between the blocks of data they copy, through
+ * ReadOnlyArchiveInterface::checkpoint().
+ */
+class KERFUFFLE_EXPORT OperationThrottle
+{
+public:
+    OperationThrottle();
+
+    void suspend();
+    void resume();
+    bool isSuspended() const;
+
+    /**
+     * Limits the operation to @p bytesPerSecond, or removes the limit if
+     * it is 0.
+     */
+    void setBandwidthLimit(qint64 bytesPerSecond);
+    qint64 bandwidthLimit() const;
+
+    /**
+     * Accounts for @p bytes more being copied, then blocks while the
+     * operation is suspended and for as long as it is ahead of the
+     * bandwidth limit. Returns as soon as @p token is cancelled.
+     */
+    void pace(qint64 bytes, const CancellationToken *token);
+
+    /**
+     * Wakes up pace(), so that it notices a cancellation.
+     */
+    void wakeUp();
+
+private:
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    bool m_suspended;
+    qint64 m_bandwidthLimit;
+    qint64 m_pacedBytes;
+    QElapsedTimer m_pacedTime;
+};
+
 class KERFUFFLE_EXPORT ReadOnlyArchiveInterface: public QObject
 {
     Q_OBJECT
@@ -72,13 +165,32 @@ public:
      * the user of the error condition.
      */
     virtual bool list() = 0;
+
+    /**
+     * Read the archive contents like list(), but hand each entry to
+     * @p visitor and stop as soon as it returns false. This way questions
+     * such as "is there a single folder at the top level?" do not need to
+     * go through the whole archive.
+     *
+     * The default implementation runs list() and stops it with doKill(),
+     * interfaces which can stop reading more cheaply should reimplement it.
+     * The finished() signal is emitted as it would be for list().
+     * @returns whether reading succeeded; stopping early is not a failure.
+     */
+    virtual bool visitEntries(EntryVisitor *visitor);
+
     void setPassword(const QString &password);
 
     /**
      * Extract files from archive.
+     * A folder in @p files stands for everything in it, so its contents do
+     * not need to be passed as well; an empty list means the whole archive.
      * Globally recognized extraction options:
      * @li PreservePaths - preserve file paths (extract flat if false)
      * @li RootNode - node in the archive which will correspond to the @arg destinationDirectory
+     * @li ParallelProcesses - maximum number of processes extracting at once,
+     * for the backends able to split an extraction
+     * @li BandwidthLimit and IOPriorityClass - see Archive::addFiles()
      * When subclassing, you can block as long as you need, the function runs
      * in its own thread.
      * @returns whether the listing succeeded.
@@ -89,13 +201,71 @@ public:
 
     bool waitForFinishedSignal();
 
+    /**
+     * Emits the entries which are still waiting to be delivered with
+     * entries(). Called by the jobs once the operation is over, and
+     * by a timer shortly after the first entry of a batch came.
+     *
+     * The receivers of entries() must use a queued connection: the
+     * batches are emitted from both the thread listing the archive and
+     * the GUI thread, and are only delivered in order through the
+     * event queue.
+     */
+    void flushEntries();
+
+    /**
+     * The paths of the entries emitted so far. The entries sent with
+     * entries() have their PathNode set to their node in it.
+     */
+    PathTrie *pathTrie();
+
+    /**
+     * Cancelled by doKill(), and reset before each operation is started.
+     */
+    CancellationToken *cancellationToken();
+
+    /**
+     * Suspended by doSuspend() and given the bandwidth limit of the job
+     * being run.
+     */
+    OperationThrottle *throttle();
+
+    /**
+     * Returns a second interface for the same archive, on which the
+     * JobScheduler runs interactive extractions while this one is busy
+     * reading the archive, or 0 if the backend cannot read an archive
+     * twice at the same time.
+     *
+     * It is created the first time, as a child of this interface, so
+     * this must be called from the thread this interface belongs to.
+     */
+    ReadOnlyArchiveInterface *concurrentReader();
+
+    /**
+     * Stops the operation being run. The default implementation cancels
+     * cancellationToken(), which the operation is expected to check.
+     */
     virtual bool doKill();
+
+    /**
+     * Pauses the operation being run until doResume() is called. The
+     * default implementations suspend and resume throttle(), which holds
+     * the operation in checkpoint().
+     */
     virtual bool doSuspend();
     virtual bool doResume();
 
 signals:
     void error(const QString &message, const QString &details = QString());
     void entry(const ArchiveEntry &archiveEntry);
+
+    /**
+     * The entries emitted with entry(), collected into batches so that
+     * large archives do not cost one queued signal per entry. A batch is
+     * sent once it is big enough or has been waiting for a while, and
+     * when the operation is over.
+     */
+    void entries(const QVector<ArchiveEntry> &archiveEntries);
     void entryRemoved(const QString &path);
     void progress(double progress);
     void info(const QString &info);
@@ -104,6 +274,23 @@ signals:
 
 protected:
     QString password() const;
+
+    /**
+     * Creates the interface returned by concurrentReader(). It only has to
+     * extract files, and does not know the password of this one. The
+     * default implementation returns 0.
+     */
+    virtual ReadOnlyArchiveInterface *createConcurrentReader();
+
+    /**
+     * To be called by long running operations between two blocks of
+     * @p bytes of data, or between two entries: waits while the operation
+     * is suspended or ahead of its bandwidth limit.
+     *
+     * @return @c false if the operation has been cancelled and must stop.
+     */
+    bool checkpoint(qint64 bytes = 0);
+
     /**
      * Setting this option to true will not exit the thread with the
      * exit of the various functions, but rather when finished(bool) is
@@ -112,10 +299,27 @@ protected:
      */
     void setWaitForFinishedSignal(bool value);
 
+private slots:
+    void visitEntry(const ArchiveEntry &archiveEntry);
+    void batchEntry(const ArchiveEntry &archiveEntry);
+    void flushPendingEntries();
+
 private:
+    // Must be called with m_pendingEntriesMutex locked.
+    void emitPendingEntries();
+
     QString m_filename;
     QString m_password;
     bool m_waitForFinishedSignal;
+    EntryVisitor *m_visitor;
+    ReadOnlyArchiveInterface *m_concurrentReader;
+    bool m_hasCreatedConcurrentReader;
+    PathTrie m_pathTrie;
+    CancellationToken m_cancellationToken;
+    OperationThrottle m_throttle;
+    QMutex m_pendingEntriesMutex;
+    QVector<ArchiveEntry> m_pendingEntries;
+    QTimer m_flushTimer;
 };
 
 class KERFUFFLE_EXPORT ReadWriteArchiveInterface: public ReadOnlyArchiveInterface
@@ -38,24 +38,276 @@
 
 #include <KStandardDirs>
 #include <KDebug>
+#include <KGlobal>
 #include <KLocale>
 
 #include <QApplication>
 #include <QDateTime>
 #include <QDir>
+#include <QDirIterator>
 #include <QEventLoop>
 #include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QProcess>
 #include <QThread>
 #include <QTimer>
+#include <QtAlgorithms>
+
+#ifndef Q_OS_WIN
+#include <signal.h>
+#endif
 
 namespace Kerfuffle
 {
+
+// Below this amount of compressed data, starting several extract processes
+// costs more than it saves.
+static const qulonglong MinimumParallelExtractionSize = 8 * 1024 * 1024;
+static const int MaximumParallelProcesses = 4;
+
+// When extracting all the files in parallel, they must all be passed on the
+// command line; stay well below the usual limits for its length.
+static const int MaximumParallelArgumentsLength = 128 * 1024;
+
+// How often the progress of the running programs is read from /proc, and
+// the smallest change worth reporting.
+static const int ProgressSamplingInterval = 250;
+static const double ProgressSamplingStep = 0.005;
+
+// How long the programs are given to clean up after being asked to stop
+// before they are killed, which bounds how long killing a job takes.
+static const int KillGracePeriod = 1000;
+
+// How often the amount of data copied by the programs is compared to the
+// bandwidth limit, to stop or continue them.
+static const int PacingInterval = 100;
+
+/**
+ * Remembers where the programs used by the plugins are and what they are
+ * capable of, so that it is not looked up again for every operation.
+ *
+ * Everything is forgotten when PATH changes, and what is known about a
+ * program is forgotten when its binary is modified.
+ */
+class ProgramCache
+{
+public:
+    QString findExe(const QString& programName);
+    QVariant capability(const QString& programPath, const QString& name);
+    void setCapability(const QString& programPath, const QString& name, const QVariant& value);
+
+private:
+    struct Program {
+        QDateTime lastModified;
+        QVariantHash capabilities;
+    };
+
+    // Both must be called with m_mutex locked.
+    void checkPath();
+    Program& program(const QString& programPath);
+
+    QMutex m_mutex;
+    QByteArray m_path;
+    QHash<QString, QString> m_programPaths;
+    QHash<QString, Program> m_programs;
+};
+
+K_GLOBAL_STATIC(ProgramCache, s_programCache)
+
+void ProgramCache::checkPath()
+{
+    const QByteArray path = qgetenv("PATH");
+
+    if (path != m_path) {
+        m_path = path;
+        m_programPaths.clear();
+        m_programs.clear();
+    }
+}
+
+ProgramCache::Program& ProgramCache::program(const QString& programPath)
+{
+    const QDateTime lastModified = QFileInfo(programPath).lastModified();
+
+    QHash<QString, Program>::iterator it = m_programs.find(programPath);
+    if ((it == m_programs.end()) || (it.value().lastModified != lastModified)) {
+        Program program;
+        program.lastModified = lastModified;
+        it = m_programs.insert(programPath, program);
+    }
+
+    return it.value();
+}
+
+QString ProgramCache::findExe(const QString& programName)
+{
+    QMutexLocker locker(&m_mutex);
+    checkPath();
+
+    QString programPath = m_programPaths.value(programName);
+    if (!programPath.isEmpty() && QFileInfo(programPath).isExecutable()) {
+        return programPath;
+    }
+
+    // Programs which were not found are looked for again next time, they
+    // may have been installed in the meantime.
+    programPath = KStandardDirs::findExe(programName);
+    if (programPath.isEmpty()) {
+        m_programPaths.remove(programName);
+    } else {
+        m_programPaths.insert(programName, programPath);
+    }
+
+    return programPath;
+}
+
+QVariant ProgramCache::capability(const QString& programPath, const QString& name)
+{
+    QMutexLocker locker(&m_mutex);
+    checkPath();
+
+    return program(programPath).capabilities.value(name);
+}
+
+void ProgramCache::setCapability(const QString& programPath, const QString& name, const QVariant& value)
+{
+    QMutexLocker locker(&m_mutex);
+    checkPath();
+
+    program(programPath).capabilities.insert(name, value);
+}
+
+/**
+ * Returns the offset of the first descriptor of process @p pid open on
+ * @p fileName, or -1 if it cannot be told.
+ */
+static qint64 readFilePosition(Q_PID pid, const QString& fileName)
+{
+#ifdef Q_OS_LINUX
+    const QString processDir = QLatin1String("/proc/") + QString::number(pid);
+
+    QDirIterator it(processDir + QLatin1String("/fd"), QDir::System | QDir::NoDotAndDotDot);
+    while (it.hasNext()) {
+        it.next();
+        if (it.fileInfo().symLinkTarget() != fileName) {
+            continue;
+        }
+
+        QFile fdInfo(processDir + QLatin1String("/fdinfo/") + it.fileName());
+        if (!fdInfo.open(QIODevice::ReadOnly)) {
+            return -1;
+        }
+
+        // The first line is "pos:\t<offset>".
+        const QByteArray line = fdInfo.readLine();
+        if (line.startsWith("pos:")) {
+            return line.mid(4).trimmed().toLongLong();
+        }
+
+        return -1;
+    }
+#else
+    Q_UNUSED(pid)
+    Q_UNUSED(fileName)
+#endif
+
+    return -1;
+}
+
+/**
+ * Returns how many bytes process @p pid has read so far, or written if
+ * @p counter is "wchar:", or -1 if it cannot be told.
+ */
+static qint64 readProcessBytes(Q_PID pid, const QByteArray& counter = "rchar:")
+{
+#ifdef Q_OS_LINUX
+    QFile io(QLatin1String("/proc/") + QString::number(pid) + QLatin1String("/io"));
+    if (!io.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    while (!io.atEnd()) {
+        const QByteArray line = io.readLine();
+        if (line.startsWith(counter)) {
+            return line.mid(counter.size()).trimmed().toLongLong();
+        }
+    }
+#else
+    Q_UNUSED(pid)
+    Q_UNUSED(counter)
+#endif
+
+    return -1;
+}
+
+/**
+ * Returns the size of the file @p path, or of all the files inside it if
+ * it is a directory.
+ */
+static qint64 diskUsage(const QString& path)
+{
+    const QFileInfo info(path);
+    if (!info.isDir()) {
+        return info.size();
+    }
+
+    qint64 size = 0;
+    QDirIterator it(path, QDir::Files | QDir::Hidden | QDir::NoSymLinks, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        size += it.fileInfo().size();
+    }
+
+    return size;
+}
+
+static QString withoutTrailingSlash(const QString& path)
+{
+    return path.endsWith(QLatin1Char('/')) ? path.left(path.length() - 1) : path;
+}
+
+/**
+ * Whether @p path is one of @p folders or inside one of them. The folders
+ * are given without trailing slashes.
+ */
+static bool isInFolders(const QString& path, const QSet<QString>& folders)
+{
+    QString folder = withoutTrailingSlash(path);
+
+    forever {
+        if (folders.contains(folder)) {
+            return true;
+        }
+
+        const int slash = folder.lastIndexOf(QLatin1Char('/'));
+        if (slash == -1) {
+            return false;
+        }
+        folder.truncate(slash);
+    }
+}
+
 CliInterface::CliInterface(QObject *parent, const QVariantList & args)
         : ReadWriteArchiveInterface(parent, args),
         m_process(0),
+        m_outputProcess(0),
+        m_parallelTotalSize(0),
+        m_parallelFinishedSize(0),
+        m_parallelProcessFailed(false),
+        m_solidness(SolidnessUnknown),
+        m_listedEntriesCount(0),
+        m_listingAddedFiles(false),
+        m_entryVisitor(0),
+        m_sampledBytesTotal(0),
+        m_sampleArchivePosition(false),
+        m_lastSampledProgress(0),
+        m_hasSampledProgress(false),
         m_listEmptyLines(false),
-        m_abortingOperation(false)
+        m_abortingOperation(false),
+        m_pacingDebt(0),
+        m_pacingStopped(false)
 {
     //because this interface uses the event loop
     setWaitForFinishedSignal(true);
@@ -63,6 +315,8 @@ CliInterface::CliInterface(QObject *parent, const QVariantList & args)
     if (QMetaType::type("QProcess::ExitStatus") == 0) {
         qRegisterMetaType<QProcess::ExitStatus>("QProcess::ExitStatus");
     }
+
+    connect(this, SIGNAL(entry(ArchiveEntry)), SLOT(rememberEntry(ArchiveEntry)), Qt::DirectConnection);
 }
 
 void CliInterface::cacheParameterList()
@@ -78,6 +332,7 @@ void CliInterface::cacheParameterList()
 CliInterface::~CliInterface()
 {
     Q_ASSERT(!m_process);
+    Q_ASSERT(m_parallelProcesses.isEmpty());
 }
 
 void CliInterface::setListEmptyLines(bool emptyLines)
@@ -85,11 +340,23 @@ void CliInterface::setListEmptyLines(bool emptyLines)
     m_listEmptyLines = emptyLines;
 }
 
+void CliInterface::setSolidArchive(bool solid)
+{
+    m_solidness = solid ? SolidArchive : NonSolidArchive;
+}
+
 bool CliInterface::list()
 {
     cacheParameterList();
     m_operationMode = List;
 
+    m_solidness = SolidnessUnknown;
+    m_entrySizes.clear();
+    m_listedDirectories.clear();
+    m_workingDirectory.clear();
+
+    m_sampledBytesTotal = 0;
+
     QStringList args = m_param.value(ListArgs).toStringList();
     substituteListVariables(args);
 
@@ -101,15 +368,72 @@ bool CliInterface::list()
     return true;
 }
 
+bool CliInterface::visitEntries(EntryVisitor *visitor)
+{
+    m_entryVisitor = visitor;
+    const bool ret = list();
+
+    // The listing was cut short, so what it found cannot be used to plan
+    // extractions.
+    if (m_abortingOperation) {
+        m_abortingOperation = false;
+        m_solidness = SolidnessUnknown;
+        m_entrySizes.clear();
+        m_listedDirectories.clear();
+    }
+
+    m_entryVisitor = 0;
+
+    return ret;
+}
+
 bool CliInterface::copyFiles(const QList<QVariant> & files, const QString & destinationDirectory, ExtractionOptions options)
 {
     kDebug();
     cacheParameterList();
 
     m_operationMode = Copy;
+    m_fileExistsResponse.clear();
+
+    QList<QVariantList> groups;
+    QList<qulonglong> groupSizes;
+    if (planParallelExtraction(files, options, groups, groupSizes)) {
+        return copyFilesInParallel(groups, groupSizes, files, destinationDirectory, options);
+    }
+
+    QStringList args;
+    if (!substituteCopyVariables(args, files, options)) {
+        return false;
+    }
+
+    // When extracting everything, the program goes through the archive
+    // from its start to its end. Otherwise, count what it reads against
+    // the size of the selected files, if they were kept.
+    if (files.isEmpty() || m_entrySizes.isEmpty()) {
+        m_sampledBytesTotal = QFileInfo(filename()).size();
+        m_sampleArchivePosition = true;
+    } else {
+        m_sampledBytesTotal = 0;
+        m_sampleArchivePosition = false;
+        foreach(const QString& file, selectedFiles(files)) {
+            m_sampledBytesTotal += m_entrySizes.value(file);
+        }
+    }
+
+    m_workingDirectory = destinationDirectory;
+
+    if (!runProcess(m_param.value(ExtractProgram).toStringList(), args)) {
+        failOperation();
+        return false;
+    }
 
+    return true;
+}
+
+bool CliInterface::substituteCopyVariables(QStringList& args, const QList<QVariant>& files, const ExtractionOptions& options)
+{
     //start preparing the argument list
-    QStringList args = m_param.value(ExtractArgs).toStringList();
+    args = m_param.value(ExtractArgs).toStringList();
 
     //now replace the various elements in the list
     for (int i = 0; i < args.size(); ++i) {
@@ -221,22 +545,251 @@ bool CliInterface::copyFiles(const QList<QVariant> & files, const QString & dest
 
         if (argument == QLatin1String( "$Files" )) {
             args.removeAt(i);
-            for (int j = 0; j < files.count(); ++j) {
-                args.insert(i + j, escapeFileName(files.at(j).toString()));
+            foreach(const QVariant& file, files) {
+                const QString fileName = file.toString();
+                args.insert(i, escapeFileName(fileName));
                 ++i;
+
+                // The contents of a folder are extracted along with it.
+                if (isFolder(fileName)) {
+                    args.insert(i, escapeFileName(withoutTrailingSlash(fileName)) + QLatin1String("/*"));
+                    ++i;
+                }
             }
             --i;
         }
     }
 
-    kDebug() << "Setting current dir to " << destinationDirectory;
-    QDir::setCurrent(destinationDirectory);
+    return true;
+}
 
-    if (!runProcess(m_param.value(ExtractProgram).toStringList(), args)) {
-        failOperation();
+bool CliInterface::isFolder(const QString& fileName) const
+{
+    return m_listedDirectories.contains(fileName) || fileName.endsWith(QLatin1Char('/'));
+}
+
+QSet<QString> CliInterface::selectedFolders(const QList<QVariant>& files) const
+{
+    QSet<QString> folders;
+
+    foreach(const QVariant& file, files) {
+        if (isFolder(file.toString())) {
+            folders.insert(withoutTrailingSlash(file.toString()));
+        }
+    }
+
+    return folders;
+}
+
+QStringList CliInterface::selectedFiles(const QList<QVariant>& files) const
+{
+    const QSet<QString> folders = selectedFolders(files);
+    QStringList fileNames;
+
+    // Files in the selected folders may have been selected as well.
+    foreach(const QVariant& file, files) {
+        const QString fileName = file.toString();
+        if (!isFolder(fileName) && !isInFolders(fileName, folders)) {
+            fileNames << fileName;
+        }
+    }
+
+    if (!folders.isEmpty()) {
+        QHash<QString, qulonglong>::const_iterator it = m_entrySizes.constBegin();
+        for (; it != m_entrySizes.constEnd(); ++it) {
+            if (isInFolders(it.key(), folders)) {
+                fileNames << it.key();
+            }
+        }
+    }
+
+    return fileNames;
+}
+
+bool CliInterface::keepsEntrySizes() const
+{
+    return m_param.value(ParallelExtraction).toBool() && (m_solidness != SolidArchive);
+}
+
+bool CliInterface::planParallelExtraction(const QList<QVariant>& files, const ExtractionOptions& options,
+                                          QList<QVariantList>& groups, QList<qulonglong>& groupSizes) const
+{
+    if (!m_param.value(ParallelExtraction).toBool() || (m_solidness != NonSolidArchive)) {
+        return false;
+    }
+
+    int processCount = qMin(QThread::idealThreadCount(), MaximumParallelProcesses);
+    if (options.contains(QLatin1String("ParallelProcesses"))) {
+        processCount = options.value(QLatin1String("ParallelProcesses")).toInt();
+    }
+
+    if (processCount < 2) {
+        return false;
+    }
+
+    QList<QPair<qulonglong, QString> > candidates;
+    qulonglong totalSize = 0;
+
+    if (files.isEmpty()) {
+        int argumentsLength = 0;
+
+        QHash<QString, qulonglong>::const_iterator it = m_entrySizes.constBegin();
+        for (; it != m_entrySizes.constEnd(); ++it) {
+            argumentsLength += it.key().length() + 1;
+            if (argumentsLength > MaximumParallelArgumentsLength) {
+                return false;
+            }
+
+            candidates << qMakePair(it.value(), it.key());
+            totalSize += it.value();
+        }
+    } else {
+        int argumentsLength = 0;
+
+        // selectedFiles() leaves out the directories, which are created
+        // beforehand: passing them to the extract program would extract
+        // their contents several times.
+        foreach(const QString& fileName, selectedFiles(files)) {
+            // We did not list this entry ourselves, so we cannot tell
+            // what the extract program would do with it.
+            if (!m_entrySizes.contains(fileName)) {
+                return false;
+            }
+
+            argumentsLength += fileName.length() + 1;
+            if (argumentsLength > MaximumParallelArgumentsLength) {
+                return false;
+            }
+
+            const qulonglong size = m_entrySizes.value(fileName);
+            candidates << qMakePair(size, fileName);
+            totalSize += size;
+        }
+    }
+
+    if ((candidates.count() < 2) || (totalSize < MinimumParallelExtractionSize)) {
         return false;
     }
 
+    processCount = qMin(processCount, candidates.count());
+
+    groups.clear();
+    groupSizes.clear();
+    for (int i = 0; i < processCount; ++i) {
+        groups << QVariantList();
+        groupSizes << 0;
+    }
+
+    // Hand the biggest remaining file to the lightest group each time, so
+    // that all processes end up with about the same amount of work.
+    qSort(candidates.begin(), candidates.end(), qGreater<QPair<qulonglong, QString> >());
+
+    for (int i = 0; i < candidates.count(); ++i) {
+        int lightest = 0;
+        for (int j = 1; j < processCount; ++j) {
+            if (groupSizes.at(j) < groupSizes.at(lightest)) {
+                lightest = j;
+            }
+        }
+
+        groups[lightest] << candidates.at(i).second;
+        groupSizes[lightest] += candidates.at(i).first;
+    }
+
+    return true;
+}
+
+bool CliInterface::copyFilesInParallel(const QList<QVariantList>& groups, const QList<qulonglong>& groupSizes,
+                                       const QList<QVariant>& files, const QString& destinationDirectory,
+                                       const ExtractionOptions& options)
+{
+    kDebug() << "Extracting with" << groups.count() << "processes in parallel";
+
+    const QString programPath = findProgram(m_param.value(ExtractProgram).toStringList());
+    if (programPath.isEmpty()) {
+        return false;
+    }
+
+    QList<QStringList> argumentLists;
+    foreach(const QVariantList& group, groups) {
+        QStringList args;
+        if (!substituteCopyVariables(args, group, options)) {
+            return false;
+        }
+        argumentLists << args;
+    }
+
+    m_workingDirectory = destinationDirectory;
+
+    // The directory entries were left out of the groups, create them here
+    // so that empty directories are extracted as well.
+    if (options.value(QLatin1String("PreservePaths")).toBool()) {
+        const QString rootNode = options.value(QLatin1String("RootNode")).toString();
+        const QDir destination(destinationDirectory);
+
+        const QSet<QString> folders = selectedFolders(files);
+
+        foreach(const QString& directory, m_listedDirectories) {
+            if (!files.isEmpty() && !isInFolders(directory, folders)) {
+                continue;
+            }
+
+            QString path = directory;
+            if (!rootNode.isEmpty() && path.startsWith(rootNode)) {
+                path.remove(0, rootNode.length());
+            }
+
+            if (!path.isEmpty()) {
+                destination.mkpath(path);
+            }
+        }
+    }
+
+    m_parallelTotalSize = 0;
+    m_parallelFinishedSize = 0;
+    m_parallelProcessFailed = false;
+
+    QEventLoop loop;
+    connect(this, SIGNAL(finished(bool)), &loop, SLOT(quit()), Qt::DirectConnection);
+
+    QTimer progressTimer;
+    connect(&progressTimer, SIGNAL(timeout()), SLOT(sampleProgress()), Qt::DirectConnection);
+
+    for (int i = 0; i < argumentLists.count(); ++i) {
+        kDebug() << "Executing" << programPath << argumentLists.at(i);
+
+        Process *process = createProcess(programPath, argumentLists.at(i));
+        connect(process, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(parallelProcessFinished(int,QProcess::ExitStatus)), Qt::DirectConnection);
+
+        ParallelProcess state;
+        state.size = groupSizes.at(i);
+        state.progress = 0;
+        state.passwordSent = false;
+
+        QMutexLocker locker(&m_processesMutex);
+        m_parallelProcesses.insert(process, state);
+        m_parallelTotalSize += state.size;
+    }
+
+    m_abortingOperation = false;
+
+    foreach(Process *process, m_parallelProcesses.keys()) {
+        process->start();
+    }
+
+    QTimer pacingTimer;
+    startPacing(&pacingTimer);
+
+    m_sampledBytesTotal = m_parallelTotalSize;
+    m_sampleArchivePosition = false;
+    m_lastSampledProgress = 0;
+    m_hasSampledProgress = false;
+    progressTimer.start(ProgressSamplingInterval);
+
+    loop.exec(QEventLoop::WaitForMoreEvents | QEventLoop::ExcludeUserInputEvents);
+
+    Q_ASSERT(m_parallelProcesses.isEmpty());
+
     return true;
 }
 
@@ -248,10 +801,11 @@ bool CliInterface::addFiles(const QStringList & files, const CompressionOptions&
 
     const QString globalWorkDir = options.value(QLatin1String( "GlobalWorkDir" )).toString();
     const QDir workDir = globalWorkDir.isEmpty() ? QDir::current() : QDir(globalWorkDir);
-    if (!globalWorkDir.isEmpty()) {
-        kDebug() << "GlobalWorkDir is set, changing dir to " << globalWorkDir;
-        QDir::setCurrent(globalWorkDir);
-    }
+    kDebug() << "Adding files relative to" << workDir.path();
+    m_workingDirectory = workDir.path();
+
+    m_addedFiles.clear();
+    bool canListAddedFiles = true;
 
     //start preparing the argument list
     QStringList args = m_param.value(AddArgs).toStringList();
@@ -265,6 +819,16 @@ bool CliInterface::addFiles(const QStringList & files, const CompressionOptions&
             args[i] = filename();
         }
 
+        if (argument == QLatin1String( "$CompressionSwitches" )) {
+            args.removeAt(i);
+            const QStringList switches = compressionSwitches(options);
+            for (int j = 0; j < switches.count(); ++j) {
+                args.insert(i + j, switches.at(j));
+                ++i;
+            }
+            --i;
+        }
+
         if (argument == QLatin1String( "$Files" )) {
             args.removeAt(i);
             for (int j = 0; j < files.count(); ++j) {
@@ -275,6 +839,18 @@ bool CliInterface::addFiles(const QStringList & files, const CompressionOptions&
                 const QString relativeName =
                     workDir.relativeFilePath(files.at(j));
 
+                // Files outside the work dir may be stored under a name we
+                // cannot guess; the whole archive is listed again then.
+                if (relativeName.startsWith(QLatin1String("../"))) {
+                    canListAddedFiles = false;
+                }
+
+                if (QFileInfo(files.at(j)).isDir()) {
+                    m_addedFiles << relativeName + QLatin1Char('/');
+                } else {
+                    m_addedFiles << relativeName;
+                }
+
                 args.insert(i + j, relativeName);
                 ++i;
             }
@@ -282,6 +858,18 @@ bool CliInterface::addFiles(const QStringList & files, const CompressionOptions&
         }
     }
 
+    if (!canListAddedFiles) {
+        m_addedFiles.clear();
+    }
+
+    // The program reads the files being added, and usually copies the
+    // current contents of the archive as well.
+    m_sampledBytesTotal = QFileInfo(filename()).size();
+    m_sampleArchivePosition = false;
+    foreach(const QString& file, files) {
+        m_sampledBytesTotal += diskUsage(file);
+    }
+
     if (!runProcess(m_param.value(AddProgram).toStringList(), args)) {
         failOperation();
         return false;
@@ -316,6 +904,10 @@ bool CliInterface::deleteFiles(const QList<QVariant> & files)
     }
 
     m_removedFiles = files;
+    m_workingDirectory.clear();
+
+    m_sampledBytesTotal = QFileInfo(filename()).size();
+    m_sampleArchivePosition = false;
 
     if (!runProcess(m_param.value(DeleteProgram).toStringList(), args)) {
         failOperation();
@@ -325,19 +917,59 @@ bool CliInterface::deleteFiles(const QList<QVariant> & files)
     return true;
 }
 
-bool CliInterface::runProcess(const QStringList& programNames, const QStringList& arguments)
+QString CliInterface::locateProgram(const QStringList& programNames) const
 {
-    QString programPath;
-    for (int i = 0; i < programNames.count(); i++) {
-        programPath = KStandardDirs::findExe(programNames.at(i));
-        if (!programPath.isEmpty())
-            break;
+    foreach(const QString& programName, programNames) {
+        const QString programPath = s_programCache->findExe(programName);
+        if (!programPath.isEmpty()) {
+            return programPath;
+        }
     }
+
+    return QString();
+}
+
+QString CliInterface::findProgram(const QStringList& programNames)
+{
+    const QString programPath = locateProgram(programNames);
     if (programPath.isEmpty()) {
         const QString names = programNames.join(QLatin1String(", "));
         emit error(i18ncp("@info", "Failed to locate program <filename>%2</filename> on disk.",
                                    "Failed to locate programs <filename>%2</filename> on disk.", programNames.count(), names));
         emit finished(false);
+    }
+
+    return programPath;
+}
+
+CliInterface::Process *CliInterface::createProcess(const QString& programPath, const QStringList& arguments)
+{
+#ifdef Q_OS_WIN
+    Process *process = new KProcess;
+#else
+    Process *process = new KPtyProcess;
+    process->setPtyChannels(KPtyProcess::StdinChannel);
+#endif
+
+    process->setOutputChannelMode(KProcess::MergedChannels);
+    process->setNextOpenMode(QIODevice::ReadWrite | QIODevice::Unbuffered | QIODevice::Text);
+    process->setProgram(programPath, arguments);
+
+    // Changing the current directory of the whole process would affect
+    // all the other jobs running at the same time.
+    if (!m_workingDirectory.isEmpty()) {
+        process->setWorkingDirectory(m_workingDirectory);
+    }
+
+    connect(process, SIGNAL(readyReadStandardOutput()), SLOT(readStdout()), Qt::DirectConnection);
+
+    return process;
+}
+
+bool CliInterface::runProcess(const QStringList& programNames, const QStringList& arguments)
+{
+    const QString programPath = findProgram(programNames);
+    if (programPath.isEmpty()) {
         return false;
     }
 
@@ -345,29 +977,39 @@ bool CliInterface::runProcess(const QStringList& programNames, const QStringList
 
     if (m_process) {
         m_process->waitForFinished();
+    }
+
+    {
+        QMutexLocker locker(&m_processesMutex);
         delete m_process;
+        m_process = createProcess(programPath, arguments);
     }
 
-#ifdef Q_OS_WIN
-    m_process = new KProcess;
-#else
-    m_process = new KPtyProcess;
-    m_process->setPtyChannels(KPtyProcess::StdinChannel);
+    m_outputProcess = m_process;
+    m_abortingOperation = false;
+
+#ifndef Q_OS_WIN
     QEventLoop loop;
     connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)), &loop, SLOT(quit()), Qt::DirectConnection);
 #endif
 
-    m_process->setOutputChannelMode(KProcess::MergedChannels);
-    m_process->setNextOpenMode(QIODevice::ReadWrite | QIODevice::Unbuffered | QIODevice::Text);
-    m_process->setProgram(programPath, arguments);
-
-    connect(m_process, SIGNAL(readyReadStandardOutput()), SLOT(readStdout()), Qt::DirectConnection);
     connect(m_process, SIGNAL(finished(int,QProcess::ExitStatus)), SLOT(processFinished(int,QProcess::ExitStatus)), Qt::DirectConnection);
 
     m_stdOutData.clear();
 
+    QTimer progressTimer;
+    if (m_sampledBytesTotal > 0) {
+        m_lastSampledProgress = 0;
+        m_hasSampledProgress = false;
+        connect(&progressTimer, SIGNAL(timeout()), SLOT(sampleProgress()), Qt::DirectConnection);
+        progressTimer.start(ProgressSamplingInterval);
+    }
+
     m_process->start();
 
+    QTimer pacingTimer;
+    startPacing(&pacingTimer);
+
 #ifdef Q_OS_WIN
     bool ret = m_process->waitForFinished(-1);
 #else
@@ -398,13 +1040,127 @@ void CliInterface::processFinished(int exitCode, QProcess::ExitStatus exitStatus
     //handle all the remaining data in the process
     readStdout(true);
 
-    delete m_process;
-    m_process = 0;
+    {
+        QMutexLocker locker(&m_processesMutex);
+        delete m_process;
+        m_process = 0;
+    }
+    m_outputProcess = 0;
 
     emit progress(1.0);
 
     if (m_operationMode == Add) {
-        list();
+        if (!listAddedFiles()) {
+            list();
+        }
+        return;
+    }
+
+    // The files just added were not found by the list program, so we do
+    // not know about them; fall back to listing the whole archive.
+    if (m_listingAddedFiles) {
+        m_listingAddedFiles = false;
+        if (m_listedEntriesCount == 0) {
+            kDebug() << "The added files were not listed, listing the whole archive";
+            list();
+            return;
+        }
+    }
+
+    // Plugins may only tell the archive is solid after some entries.
+    if ((m_operationMode == List) && !keepsEntrySizes()) {
+        m_entrySizes.clear();
+    }
+
+    //and we're finished
+    emit finished(true);
+}
+
+bool CliInterface::listAddedFiles()
+{
+    if (!m_param.contains(ListFilesArgs) || m_addedFiles.isEmpty()) {
+        return false;
+    }
+
+    m_operationMode = List;
+    m_listingAddedFiles = true;
+    m_listedEntriesCount = 0;
+    m_sampledBytesTotal = 0;
+
+    QStringList args = m_param.value(ListFilesArgs).toStringList();
+    for (int i = 0; i < args.size(); ++i) {
+        const QString argument = args.at(i);
+
+        if (argument == QLatin1String( "$Archive" )) {
+            args[i] = filename();
+        } else if (argument == QLatin1String( "$Files" )) {
+            args.removeAt(i);
+            foreach(const QString& file, m_addedFiles) {
+                if (file.endsWith(QLatin1Char('/'))) {
+                    // The contents of the directory have been added too.
+                    const QString directory = escapeFileName(file.left(file.length() - 1));
+                    args.insert(i, directory);
+                    args.insert(i + 1, directory + QLatin1String("/*"));
+                    i += 2;
+                } else {
+                    args.insert(i, escapeFileName(file));
+                    ++i;
+                }
+            }
+            --i;
+        }
+    }
+
+    if (!runProcess(m_param.value(ListProgram).toStringList(), args)) {
+        m_listingAddedFiles = false;
+        return false;
+    }
+
+    return true;
+}
+
+void CliInterface::parallelProcessFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    kDebug() << exitCode << exitStatus;
+
+    Process *process = static_cast<Process*>(sender());
+    if (!m_parallelProcesses.contains(process)) {
+        return;
+    }
+
+    //handle all the remaining data in the process
+    readProcessOutput(process, m_parallelProcesses[process].stdOutData, true);
+
+    // The error patterns do not catch every failure, and the other
+    // processes going on would hide this one's: whatever it was to
+    // extract would just be missing.
+    if (!m_abortingOperation && ((exitStatus == QProcess::CrashExit) || (exitCode != 0))) {
+        m_parallelProcessFailed = true;
+    }
+
+    m_parallelFinishedSize += m_parallelProcesses.value(process).size;
+    if (m_outputProcess == process) {
+        m_outputProcess = 0;
+    }
+
+    bool isLastProcess;
+    {
+        QMutexLocker locker(&m_processesMutex);
+        m_parallelProcesses.remove(process);
+        delete process;
+        isLastProcess = m_parallelProcesses.isEmpty();
+    }
+
+    if (!isLastProcess) {
+        reportProgress(0);
+        return;
+    }
+
+    emit progress(1.0);
+
+    if (m_parallelProcessFailed && !m_abortingOperation) {
+        emit error(i18n("Extraction failed because of an unexpected error."));
+        emit finished(false);
         return;
     }
 
@@ -412,6 +1168,47 @@ void CliInterface::processFinished(int exitCode, QProcess::ExitStatus exitStatus
     emit finished(true);
 }
 
+void CliInterface::rememberEntry(const ArchiveEntry& entry)
+{
+    ++m_listedEntriesCount;
+
+    if (m_entryVisitor && !m_entryVisitor->visit(entry)) {
+        kDebug() << "Stopped by the visitor after" << m_listedEntriesCount << "entries";
+        m_entryVisitor = 0;
+
+        // There is nothing left to read, so the program does not get the
+        // grace period doKill() would give it.
+        m_abortingOperation = true;
+        if (m_process) {
+            m_process->kill();
+        }
+        return;
+    }
+
+    if (m_operationMode != List) {
+        return;
+    }
+
+    const QString internalId = entry[InternalID].toString();
+
+    if (entry[IsDirectory].toBool()) {
+        m_listedDirectories.insert(internalId);
+        return;
+    }
+
+    if (!keepsEntrySizes()) {
+        return;
+    }
+
+    // Some formats (7z, for example) only tell the packed size of the
+    // whole archive, fall back to the uncompressed one.
+    if (entry.contains(CompressedSize)) {
+        m_entrySizes.insert(internalId, entry[CompressedSize].toULongLong());
+    } else {
+        m_entrySizes.insert(internalId, entry[Size].toULongLong());
+    }
+}
+
 void CliInterface::failOperation()
 {
     // TODO: Would be good to unit test #304764/#304178.
@@ -420,6 +1217,19 @@ void CliInterface::failOperation()
 }
 
 void CliInterface::readStdout(bool handleAll)
+{
+    if (m_parallelProcesses.isEmpty()) {
+        readProcessOutput(m_process, m_stdOutData, handleAll);
+        return;
+    }
+
+    Process *process = static_cast<Process*>(sender());
+    if (m_parallelProcesses.contains(process)) {
+        readProcessOutput(process, m_parallelProcesses[process].stdOutData, handleAll);
+    }
+}
+
+void CliInterface::readProcessOutput(Process *process, QByteArray& stdOutData, bool handleAll)
 {
     //when hacking this function, please remember the following:
     //- standard output comes in unpredictable chunks, this is why
@@ -432,9 +1242,9 @@ void CliInterface::readStdout(bool handleAll)
     if (m_abortingOperation)
         return;
 
-    Q_ASSERT(m_process);
+    Q_ASSERT(process);
 
-    if (!m_process->bytesAvailable()) {
+    if (!process->bytesAvailable()) {
         //if process has no more data, we can just bail out
         return;
     }
@@ -444,10 +1254,12 @@ void CliInterface::readStdout(bool handleAll)
     //the main thread as this would freeze everything. assert this.
     Q_ASSERT(QThread::currentThread() != QApplication::instance()->thread());
 
-    QByteArray dd = m_process->readAllStandardOutput();
-    m_stdOutData += dd;
+    m_outputProcess = process;
 
-    QList<QByteArray> lines = m_stdOutData.split('\n');
+    QByteArray dd = process->readAllStandardOutput();
+    stdOutData += dd;
+
+    QList<QByteArray> lines = stdOutData.split('\n');
 
     //The reason for this check is that archivers often do not end
     //queries (such as file exists, wrong password) on a new line, but
@@ -478,12 +1290,12 @@ void CliInterface::readStdout(bool handleAll)
     }
 
     if (handleAll) {
-        m_stdOutData.clear();
+        stdOutData.clear();
     } else {
         //because the last line might be incomplete we leave it for now
         //note, this last line may be an empty string if the stdoutdata ends
         //with a newline
-        m_stdOutData = lines.takeLast();
+        stdOutData = lines.takeLast();
     }
 
     foreach(const QByteArray& line, lines) {
@@ -500,9 +1312,15 @@ void CliInterface::handleLine(const QString& line)
     if ((m_operationMode == Copy || m_operationMode == Add) && m_param.contains(CaptureProgress) && m_param.value(CaptureProgress).toBool()) {
         //read the percentage
         int pos = line.indexOf(QLatin1Char( '%' ));
-        if (pos != -1 && pos > 1) {
-            int percentage = line.mid(pos - 2, 2).toInt();
-            emit progress(float(percentage) / 100);
+        int start = pos;
+        while (start > 0 && pos - start < 3 && line.at(start - 1).isDigit()) {
+            --start;
+        }
+        if (start != -1 && start < pos) {
+            int percentage = line.mid(start, pos - start).toInt();
+            if (!m_hasSampledProgress) {
+                reportProgress(float(percentage) / 100);
+            }
             return;
         }
     }
@@ -511,6 +1329,27 @@ void CliInterface::handleLine(const QString& line)
         if (checkForPasswordPromptMessage(line)) {
             kDebug() << "Found a password prompt";
 
+            // When extracting in parallel, only the first process to ask
+            // for the password makes us query the user. A process asking
+            // again was given a wrong password, which is just as wrong for
+            // the others.
+            if (m_parallelProcesses.contains(m_outputProcess)) {
+                ParallelProcess& state = m_parallelProcesses[m_outputProcess];
+                if (state.passwordSent) {
+                    kDebug() << "Wrong password!";
+                    emit error(i18n("Incorrect password."));
+                    failOperation();
+                    return;
+                }
+                state.passwordSent = true;
+
+                if (!password().isEmpty()) {
+                    const QString response(password() + QLatin1Char('\n'));
+                    writeToProcess(response.toLocal8Bit());
+                    return;
+                }
+            }
+
             Kerfuffle::PasswordNeededQuery query(filename());
             emit userQuery(&query);
             query.waitForResponse();
@@ -628,9 +1467,15 @@ bool CliInterface::handleFileExistsMessage(const QString& line)
         return false;
     }
 
+    if (!m_fileExistsResponse.isEmpty()) {
+        writeToProcess(m_fileExistsResponse.toLocal8Bit());
+        return true;
+    }
+
     const QString filename = m_existsPattern.cap(1);
 
-    Kerfuffle::OverwriteQuery query(QDir::current().path() + QLatin1Char( '/' ) + filename);
+    const QString workingDirectory = m_workingDirectory.isEmpty() ? QDir::currentPath() : m_workingDirectory;
+    Kerfuffle::OverwriteQuery query(workingDirectory + QLatin1Char( '/' ) + filename);
     query.setNoRenameMode(true);
     emit userQuery(&query);
     kDebug() << "Waiting response";
@@ -660,6 +1505,13 @@ bool CliInterface::handleFileExistsMessage(const QString& line)
 
     responseToProcess += QLatin1Char( '\n' );
 
+    // Each of the processes extracting in parallel has its own idea of
+    // "all files", remember the answer to give it to the others too.
+    if (!m_parallelProcesses.isEmpty() &&
+        (query.responseOverwriteAll() || query.responseAutoSkip())) {
+        m_fileExistsResponse = responseToProcess;
+    }
+
     writeToProcess(responseToProcess.toLocal8Bit());
 
     return true;
@@ -692,28 +1544,189 @@ bool CliInterface::checkForErrorMessage(const QString& line, int parameterIndex)
 
 bool CliInterface::doKill()
 {
-    if (m_process) {
-        // Give some time for the application to finish gracefully
-        m_abortingOperation = true;
-        if (!m_process->waitForFinished(5)) {
-            m_process->kill();
-        }
-        m_abortingOperation = false;
+    ReadOnlyArchiveInterface::doKill();
+
+    // This usually runs in the GUI thread, while the processes belong to
+    // the thread running the operation, which deletes them once they have
+    // finished: they are only sent signals here, with m_processesMutex
+    // held so that they cannot be deleted meanwhile. SIGTERM lets the
+    // programs remove the files they were writing and their temporary
+    // files. The ones still running after the grace period are killed
+    // from their own thread, and the operation ends once they have all
+    // finished.
+    QMutexLocker locker(&m_processesMutex);
+
+    const QList<Process*> processes = runningProcesses();
+    if (processes.isEmpty()) {
+        return false;
+    }
 
-        return true;
+    m_abortingOperation = true;
+
+    foreach(Process *process, processes) {
+#ifdef Q_OS_WIN
+        QMetaObject::invokeMethod(process, "terminate", Qt::QueuedConnection);
+#else
+        if (process->pid() > 0) {
+            ::kill(process->pid(), SIGTERM);
+        }
+#endif
+        QTimer::singleShot(KillGracePeriod, process, SLOT(kill()));
     }
 
-    return false;
+    locker.unlock();
+
+    // Stopped programs only handle the signal once they continue.
+    continueProcesses();
+
+    return true;
 }
 
 bool CliInterface::doSuspend()
 {
-    return false;
+    QMutexLocker locker(&m_pacingMutex);
+
+    // Programs started while suspended are stopped by startPacing().
+    ReadOnlyArchiveInterface::doSuspend();
+    stopProcesses();
+
+    return true;
 }
 
 bool CliInterface::doResume()
 {
-    return false;
+    QMutexLocker locker(&m_pacingMutex);
+
+    ReadOnlyArchiveInterface::doResume();
+
+    // The time spent suspended must not be made up for with a burst.
+    m_pacingDebt = 0;
+    m_pacingStopped = false;
+    m_pacedBytes.clear();
+    m_pacingTime.start();
+
+    continueProcesses();
+
+    return true;
+}
+
+QList<CliInterface::Process*> CliInterface::runningProcesses() const
+{
+    if (!m_parallelProcesses.isEmpty()) {
+        return m_parallelProcesses.keys();
+    }
+
+    QList<Process*> processes;
+    if (m_process) {
+        processes.append(m_process);
+    }
+
+    return processes;
+}
+
+void CliInterface::stopProcesses()
+{
+#ifndef Q_OS_WIN
+    QMutexLocker locker(&m_processesMutex);
+
+    foreach(Process *process, runningProcesses()) {
+        if (process->pid() > 0) {
+            ::kill(process->pid(), SIGSTOP);
+        }
+    }
+#endif
+}
+
+void CliInterface::continueProcesses()
+{
+#ifndef Q_OS_WIN
+    QMutexLocker locker(&m_processesMutex);
+
+    foreach(Process *process, runningProcesses()) {
+        if (process->pid() > 0) {
+            ::kill(process->pid(), SIGCONT);
+        }
+    }
+#endif
+}
+
+void CliInterface::startPacing(QTimer *timer)
+{
+    QMutexLocker locker(&m_pacingMutex);
+
+    m_pacingDebt = 0;
+    m_pacingStopped = false;
+    m_pacedBytes.clear();
+    m_pacingTime.start();
+
+    if (throttle()->isSuspended()) {
+        stopProcesses();
+    }
+
+    if (throttle()->bandwidthLimit() > 0) {
+        connect(timer, SIGNAL(timeout()), SLOT(paceProcesses()), Qt::DirectConnection);
+        timer->start(PacingInterval);
+    }
+}
+
+void CliInterface::paceProcesses()
+{
+    QMutexLocker locker(&m_pacingMutex);
+
+    const qint64 limit = throttle()->bandwidthLimit();
+    if ((limit <= 0) || throttle()->isSuspended() || cancellationToken()->isCancelled()) {
+        return;
+    }
+
+    // What the programs copied since the last time, counting what they
+    // read or wrote, whichever is more.
+    qint64 copied = 0;
+    QHash<Q_PID, qint64> pacedBytes;
+
+    foreach(Process *process, runningProcesses()) {
+        const qint64 bytes = qMax(readProcessBytes(process->pid()),
+                                  readProcessBytes(process->pid(), "wchar:"));
+        if (bytes < 0) {
+            continue;
+        }
+
+        copied += bytes - m_pacedBytes.value(process->pid(), 0);
+        pacedBytes.insert(process->pid(), bytes);
+    }
+
+    m_pacedBytes = pacedBytes;
+
+    // The programs are stopped for as long as they are ahead of the limit.
+    const qint64 elapsed = m_pacingTime.restart();
+    m_pacingDebt = qMax<qint64>(0, m_pacingDebt + copied - limit * elapsed / 1000);
+
+    const bool ahead = (m_pacingDebt > 0);
+    if (ahead != m_pacingStopped) {
+        m_pacingStopped = ahead;
+        if (ahead) {
+            stopProcesses();
+        } else {
+            continueProcesses();
+        }
+    }
+}
+
+QVariant CliInterface::programCapability(int program, const QString& name) const
+{
+    const QString programPath = locateProgram(parameterList().value(program).toStringList());
+    if (programPath.isEmpty()) {
+        return QVariant();
+    }
+
+    return s_programCache->capability(programPath, name);
+}
+
+void CliInterface::setProgramCapability(int program, const QString& name, const QVariant& value)
+{
+    const QString programPath = locateProgram(parameterList().value(program).toStringList());
+    if (!programPath.isEmpty()) {
+        s_programCache->setCapability(programPath, name, value);
+    }
 }
 
 void CliInterface::substituteListVariables(QStringList& params)
@@ -727,22 +1740,140 @@ void CliInterface::substituteListVariables(QStringList& params)
     }
 }
 
+QStringList CliInterface::compressionSwitches(const CompressionOptions& options) const
+{
+    QStringList switches;
+
+    const QString level = QLatin1String("GlobalCompressionLevel");
+    if (options.contains(level) && m_param.contains(CompressionLevelSwitch)) {
+        const int maximumLevel = m_param.value(MaximumCompressionLevel, 9).toInt();
+        const int scaledLevel = qRound(qBound(0, options.value(level).toInt(), 9) * maximumLevel / 9.0);
+
+        foreach(QString theSwitch, m_param.value(CompressionLevelSwitch).toStringList()) {
+            switches << theSwitch.replace(QLatin1String("$Level"), QString::number(scaledLevel));
+        }
+    }
+
+    const QString threads = QLatin1String("GlobalCompressionThreads");
+    if (options.contains(threads) && m_param.contains(CompressionThreadsSwitch)) {
+        const int threadCount = options.value(threads).toInt();
+
+        if (threadCount > 0) {
+            foreach(QString theSwitch, m_param.value(CompressionThreadsSwitch).toStringList()) {
+                switches << theSwitch.replace(QLatin1String("$Threads"), QString::number(threadCount));
+            }
+        }
+    }
+
+    const QString solid = QLatin1String("GlobalSolidArchive");
+    if (options.contains(solid) && m_param.contains(SolidSwitch)) {
+        const QStringList replacementFlags = m_param.value(SolidSwitch).toStringList();
+        Q_ASSERT(replacementFlags.size() == 2);
+
+        const QString theSwitch = options.value(solid).toBool() ? replacementFlags.at(0) : replacementFlags.at(1);
+        if (!theSwitch.isEmpty()) {
+            switches << theSwitch;
+        }
+    }
+
+    const QString dictionarySize = QLatin1String("GlobalDictionarySize");
+    if (options.contains(dictionarySize) && m_param.contains(DictionarySizeSwitch)) {
+        const int size = options.value(dictionarySize).toInt();
+
+        if (size > 0) {
+            foreach(QString theSwitch, m_param.value(DictionarySizeSwitch).toStringList()) {
+                switches << theSwitch.replace(QLatin1String("$Size"), QString::number(size));
+            }
+        }
+    }
+
+    kDebug() << "Compression switches:" << switches;
+
+    return switches;
+}
+
 QString CliInterface::escapeFileName(const QString& fileName) const
 {
     return fileName;
 }
 
+void CliInterface::sampleProgress()
+{
+    if (m_sampledBytesTotal <= 0) {
+        return;
+    }
+
+    qint64 bytes = 0;
+
+    if (m_parallelProcesses.isEmpty()) {
+        if (!m_process) {
+            return;
+        }
+
+        if (m_sampleArchivePosition) {
+            bytes = readFilePosition(m_process->pid(), QFileInfo(filename()).canonicalFilePath());
+        } else {
+            bytes = readProcessBytes(m_process->pid());
+        }
+    } else {
+        bytes = m_parallelFinishedSize;
+
+        QHash<Process*, ParallelProcess>::const_iterator it = m_parallelProcesses.constBegin();
+        for (; it != m_parallelProcesses.constEnd(); ++it) {
+            const qint64 processBytes = readProcessBytes(it.key()->pid());
+            if (processBytes < 0) {
+                return;
+            }
+            bytes += qMin<qint64>(processBytes, it.value().size);
+        }
+    }
+
+    if (bytes < 0) {
+        return;
+    }
+
+    // The programs may read more than expected (headers, other volumes),
+    // only the end of the process says the work is done.
+    const double value = qMin(0.99, double(bytes) / m_sampledBytesTotal);
+    if (value - m_lastSampledProgress < ProgressSamplingStep) {
+        return;
+    }
+
+    m_lastSampledProgress = value;
+    m_hasSampledProgress = true;
+    emit progress(value);
+}
+
+void CliInterface::reportProgress(double value)
+{
+    if (m_parallelProcesses.isEmpty()) {
+        emit progress(value);
+        return;
+    }
+
+    if (m_parallelProcesses.contains(m_outputProcess)) {
+        m_parallelProcesses[m_outputProcess].progress = value;
+    }
+
+    double extracted = m_parallelFinishedSize;
+    foreach(const ParallelProcess& state, m_parallelProcesses) {
+        extracted += state.size * state.progress;
+    }
+
+    emit progress(extracted / m_parallelTotalSize);
+}
+
 void CliInterface::writeToProcess(const QByteArray& data)
 {
-    Q_ASSERT(m_process);
+    Q_ASSERT(m_outputProcess);
     Q_ASSERT(!data.isNull());
 
     kDebug() << "Writing" << data << "to the process";
 
 #ifdef Q_OS_WIN
-    m_process->write(data);
+    m_outputProcess->write(data);
 #else
-    m_process->pty()->write(data);
+    m_outputProcess->pty()->write(data);
 #endif
 }
 
@@ -32,9 +32,11 @@
 #include "kerfuffle_export.h"
 #include <QtCore/QProcess>
 #include <QtCore/QRegExp>
+#include <QtCore/QSet>
 
 class KProcess;
 class KPtyProcess;
+class QTimer;
 
 namespace Kerfuffle
 {
@@ -73,6 +75,17 @@ enum CliInterfaceParameters {
      * $Archive - the path of the archive
      */
     ListArgs,
+    /**
+     * QStringList (default empty)
+     * The arguments that are passed to the list program to list only some
+     * entries of the archive, which is done after adding files to it.
+     * If not set, the whole archive is listed again instead. Special
+     * strings that will be substituted:
+     * $Archive - the path of the archive
+     * $Files - the paths of the added files in the archive; directories
+     * are followed by "path/*" to list their contents as well
+     */
+    ListFilesArgs,
 
     ///////////////[ EXTRACT ]/////////////
 
@@ -167,6 +180,14 @@ enum CliInterfaceParameters {
      * index 4 - Cancel operation
      */
     FileExistsInput,
+    /**
+     * Bool (default false)
+     * The extract program can be run several times at once on the same
+     * archive, each instance extracting a different set of files. This is
+     * only used for archives the plugin reported as non-solid while listing,
+     * see CliInterface::setSolidArchive().
+     */
+    ParallelExtraction,
 
     ///////////////[ DELETE ]/////////////
 
@@ -215,8 +236,46 @@ enum CliInterfaceParameters {
      * substituted:
      * $Archive - the path of the archive
      * $Files - the files selected to be added
+     * $CompressionSwitches - the switches for the compression options
+     * supported by the program (see below) which have been set
+     */
+    AddArgs,
+    /**
+     * QStringList (default empty)
+     * The switches to use for the GlobalCompressionLevel option. The
+     * variable $Level will be substituted for the level, scaled from the
+     * 0-9 range to the one given by MaximumCompressionLevel.
+     * Example: ("-mx=$Level")
+     */
+    CompressionLevelSwitch,
+    /**
+     * Int (default 9)
+     * The highest compression level supported by the program.
+     */
+    MaximumCompressionLevel,
+    /**
+     * QStringList (default empty)
+     * The switches to use for the GlobalCompressionThreads option. The
+     * variable $Threads will be substituted for the number of threads.
+     * Example: ("-mmt=$Threads")
+     */
+    CompressionThreadsSwitch,
+    /**
+     * QStringList (default empty)
+     * This should be a qstringlist with two elements, used for the
+     * GlobalSolidArchive option. The first one is used when creating a
+     * solid archive is requested, the second one when it is not. An
+     * empty string means that no switch is needed in that case.
+     * Example: ("-ms=on", "-ms=off")
+     */
+    SolidSwitch,
+    /**
+     * QStringList (default empty)
+     * The switches to use for the GlobalDictionarySize option. The variable
+     * $Size will be substituted for the dictionary size in KiB.
+     * Example: ("-md=$Sizek")
      */
-    AddArgs
+    DictionarySizeSwitch
 };
 
 typedef QHash<int, QVariant> ParameterList;
@@ -235,6 +294,7 @@ public:
     virtual ~CliInterface();
 
     virtual bool list();
+    virtual bool visitEntries(EntryVisitor *visitor);
     virtual bool copyFiles(const QList<QVariant> & files, const QString & destinationDirectory, ExtractionOptions options);
     virtual bool addFiles(const QStringList & files, const CompressionOptions& options);
     virtual bool deleteFiles(const QList<QVariant> & files);
@@ -270,9 +330,100 @@ public:
      */
     void setListEmptyLines(bool emptyLines);
 
+protected:
+    /**
+     * Tells whether the archive being listed is solid, that is, whether its
+     * entries have been compressed together in a single stream.
+     *
+     * Plugins whose programs support @c ParallelExtraction must call this
+     * while listing; archives whose solidness is unknown are always
+     * extracted by a single process.
+     */
+    void setSolidArchive(bool solid);
+
+    /**
+     * Returns what was remembered with setProgramCapability() about the
+     * program run for @p program (one of the ListProgram, ExtractProgram,
+     * DeleteProgram and AddProgram parameters), or an invalid QVariant.
+     *
+     * Capabilities are shared by all the instances of the plugins in the
+     * process, and are forgotten when the program's binary changes.
+     */
+    QVariant programCapability(int program, const QString& name) const;
+
+    /**
+     * Remembers something found out about the program run for @p program,
+     * such as its version, so that the next instances of the plugin do not
+     * have to find it out again.
+     *
+     * @see programCapability()
+     */
+    void setProgramCapability(int program, const QString& name, const QVariant& value);
+
 private:
+#ifdef Q_OS_WIN
+    typedef KProcess Process;
+#else
+    typedef KPtyProcess Process;
+#endif
+
     void substituteListVariables(QStringList& params);
 
+    /**
+     * Returns the switches which replace $CompressionSwitches in the
+     * arguments of the add program for the given @p options.
+     */
+    QStringList compressionSwitches(const CompressionOptions& options) const;
+
+    /**
+     * Lists only the files added by the last addFiles() call.
+     *
+     * @return @c false if the list program cannot do it, in which case the
+     * whole archive must be listed.
+     */
+    bool listAddedFiles();
+
+    /**
+     * Builds the argument list of the extract program for @p files.
+     *
+     * @return @c false if the user cancelled the password query.
+     */
+    bool substituteCopyVariables(QStringList& args, const QList<QVariant>& files, const ExtractionOptions& options);
+
+    /**
+     * Whether @p fileName is a directory, as far as the listing told.
+     */
+    bool isFolder(const QString& fileName) const;
+
+    /**
+     * The directories among @p files, without trailing slashes.
+     */
+    QSet<QString> selectedFolders(const QList<QVariant>& files) const;
+
+    /**
+     * The files extracted by copyFiles() for @p files: the files among
+     * them and the listed files inside the directories among them.
+     */
+    QStringList selectedFiles(const QList<QVariant>& files) const;
+
+    /**
+     * Whether the sizes of the listed files are worth keeping: they are
+     * only needed to plan parallel extractions.
+     */
+    bool keepsEntrySizes() const;
+
+    /**
+     * Splits the files which would be extracted by copyFiles() into groups
+     * of roughly the same compressed size, one for each extract process.
+     *
+     * @return @c false if the extraction should be done by a single process.
+     */
+    bool planParallelExtraction(const QList<QVariant>& files, const ExtractionOptions& options,
+                                QList<QVariantList>& groups, QList<qulonglong>& groupSizes) const;
+    bool copyFilesInParallel(const QList<QVariantList>& groups, const QList<qulonglong>& groupSizes,
+                             const QList<QVariant>& files, const QString& destinationDirectory,
+                             const ExtractionOptions& options);
+
     void cacheParameterList();
 
     /**
@@ -308,6 +459,54 @@ private:
      */
     bool runProcess(const QStringList& programNames, const QStringList& arguments);
 
+    /**
+     * Looks for the first of @p programNames which is present in the PATH.
+     * The locations are cached for the whole process.
+     *
+     * @return The full path to the program, or an empty string.
+     */
+    QString locateProgram(const QStringList& programNames) const;
+
+    /**
+     * Same as locateProgram(), but emits error() and finished() if none
+     * of the programs is found.
+     */
+    QString findProgram(const QStringList& programNames);
+
+    /**
+     * Creates a process running @p programPath with @p arguments, whose
+     * output is handled by readStdout(). The process is not started.
+     */
+    Process *createProcess(const QString& programPath, const QStringList& arguments);
+
+    /**
+     * The processes of the operation being run. Threads other than the one
+     * running the operation must hold m_processesMutex while they use them.
+     */
+    QList<Process*> runningProcesses() const;
+
+    /**
+     * Stops or continues the running processes with SIGSTOP and SIGCONT.
+     * They take m_processesMutex, so they can be called from any thread.
+     */
+    void stopProcesses();
+    void continueProcesses();
+
+    /**
+     * To be called once the processes have been started: stops them if
+     * the operation is suspended, and uses @p timer to keep them within
+     * the bandwidth limit, if there is one.
+     */
+    void startPacing(QTimer *timer);
+
+    void readProcessOutput(Process *process, QByteArray& stdOutData, bool handleAll);
+
+    /**
+     * Reports the progress of the process whose output is being handled,
+     * merging it with the other processes when extracting in parallel.
+     */
+    void reportProgress(double value);
+
     /**
      * Performs any additional escaping and processing on @p fileName
      * before passing it to the underlying process.
@@ -329,20 +528,105 @@ private:
     QRegExp m_passwordPromptPattern;
     QHash<int, QList<QRegExp> > m_patternCache;
 
-#ifdef Q_OS_WIN
-    KProcess *m_process;
-#else
-    KPtyProcess *m_process;
-#endif
+    Process *m_process;
+
+    /**
+     * The process whose output is currently being handled, and to which
+     * the answers to its prompts are written.
+     */
+    Process *m_outputProcess;
+
+    struct ParallelProcess {
+        QByteArray stdOutData;
+        qulonglong size;
+        double progress;
+        bool passwordSent;
+    };
+    QHash<Process*, ParallelProcess> m_parallelProcesses;
+
+    /**
+     * Held while m_process or the processes in m_parallelProcesses are
+     * created or deleted, and by the other threads while they use them.
+     */
+    QMutex m_processesMutex;
+    qulonglong m_parallelTotalSize;
+    qulonglong m_parallelFinishedSize;
+    bool m_parallelProcessFailed; // crashed or exited with an error code
+
+    /**
+     * The answer to "file exists" prompts once the user chose to overwrite
+     * or skip all files, replayed to each of the processes extracting in
+     * parallel.
+     */
+    QString m_fileExistsResponse;
+
+    /**
+     * The directory the programs are started in, or an empty string to
+     * inherit Ark's.
+     */
+    QString m_workingDirectory;
+
+    enum {
+        SolidnessUnknown = 0,
+        SolidArchive,
+        NonSolidArchive
+    } m_solidness;
+
+    // Compressed size of each file entry and the directory entries found
+    // by the last listing. The sizes are used to plan parallel extractions
+    // and to know how much data an extraction will read, and are dropped
+    // at the end of the listing when the archive cannot be extracted in
+    // parallel.
+    QHash<QString, qulonglong> m_entrySizes;
+    QSet<QString> m_listedDirectories;
+    int m_listedEntriesCount;
+
+    // The names under which the files of the last addFiles() call are
+    // stored in the archive, with a trailing slash for directories.
+    QStringList m_addedFiles;
+    bool m_listingAddedFiles;
+
+    // Set while visitEntries() runs and the visitor has not stopped yet.
+    EntryVisitor *m_entryVisitor;
+
+    // What is known about the amount of data the running program(s) will
+    // read, to sample their progress from /proc.
+    qint64 m_sampledBytesTotal;
+    bool m_sampleArchivePosition;
+    double m_lastSampledProgress;
+    bool m_hasSampledProgress;
 
     ParameterList m_param;
     QVariantList m_removedFiles;
     bool m_listEmptyLines;
     bool m_abortingOperation;
 
+    // Bandwidth limiting: how much each program had copied at the last
+    // check, and how far ahead of the limit they all are.
+    QMutex m_pacingMutex;
+    QHash<Q_PID, qint64> m_pacedBytes;
+    QElapsedTimer m_pacingTime;
+    qint64 m_pacingDebt;
+    bool m_pacingStopped;
+
 private slots:
     void readStdout(bool handleAll = false);
     void processFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void parallelProcessFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void rememberEntry(const ArchiveEntry& entry);
+
+    /**
+     * Reports the progress of the running program(s) from how much of the
+     * archive or of the files being added they have read, which is more
+     * accurate than their own output, when there is any.
+     */
+    void sampleProgress();
+
+    /**
+     * Stops the running programs while they are ahead of the bandwidth
+     * limit, and continues them once they are not.
+     */
+    void paceProcesses();
 };
 }
 
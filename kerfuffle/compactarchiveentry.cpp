@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "compactarchiveentry.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+
+#include <KGlobal>
+
+namespace Kerfuffle
+{
+
+// Owners, groups and the like only take a handful of values in an archive.
+// Past this many different strings, something else is being interned and
+// sharing would not pay off anymore.
+static const int MaximumInternedStrings = 10000;
+
+struct StringPool
+{
+    QMutex mutex;
+    QSet<QString> strings;
+};
+
+K_GLOBAL_STATIC(StringPool, s_stringPool)
+
+CompactArchiveEntry::CompactArchiveEntry()
+    : m_size(0)
+    , m_compressedSize(0)
+    , m_timestamp(0)
+    , m_flags(0)
+    , m_pathNode(0)
+    , m_pathTrie(0)
+{
+}
+
+CompactArchiveEntry::CompactArchiveEntry(const ArchiveEntry &entry, const PathTrie *pathTrie)
+    : m_size(0)
+    , m_compressedSize(0)
+    , m_timestamp(0)
+    , m_flags(0)
+    , m_pathNode(0)
+    , m_pathTrie(pathTrie)
+{
+    // The path node must be known before the file name is compared to its
+    // path, and the file name before the InternalID is compared to it.
+    if (entry.contains(PathNode)) {
+        setValue(PathNode, entry.value(PathNode));
+    }
+    if (entry.contains(FileName)) {
+        setValue(FileName, entry.value(FileName));
+    }
+
+    ArchiveEntry::const_iterator it = entry.constBegin();
+    for (; it != entry.constEnd(); ++it) {
+        if ((it.key() != FileName) && (it.key() != PathNode)) {
+            setValue(it.key(), it.value());
+        }
+    }
+}
+
+QString CompactArchiveEntry::fileName() const
+{
+    if (!(m_flags & FileNameFromPathFlag)) {
+        return m_fileName;
+    }
+
+    const QString path = m_pathTrie->path(m_pathNode);
+    return (m_flags & FileNameHasSlashFlag) ? path + QLatin1Char('/') : path;
+}
+
+bool CompactArchiveEntry::setFileNameFromPath(const QString &fileName)
+{
+    if (!m_pathTrie || !(m_flags & HasPathNode) || (m_pathNode >= quint32(m_pathTrie->count()))) {
+        return false;
+    }
+
+    const QString path = m_pathTrie->path(m_pathNode);
+    if (!fileName.startsWith(path)) {
+        return false;
+    }
+
+    if (fileName.size() == path.size()) {
+        setFlag(FileNameHasSlashFlag, false);
+    } else if ((fileName.size() == path.size() + 1) && fileName.endsWith(QLatin1Char('/'))) {
+        setFlag(FileNameHasSlashFlag, true);
+    } else {
+        return false;
+    }
+
+    setFlag(FileNameFromPathFlag, true);
+    m_fileName.clear();
+
+    return true;
+}
+
+QString CompactArchiveEntry::intern(const QString &string)
+{
+    if (string.isEmpty()) {
+        return QString();
+    }
+
+    QMutexLocker locker(&s_stringPool->mutex);
+
+    QSet<QString>::const_iterator it = s_stringPool->strings.constFind(string);
+    if (it != s_stringPool->strings.constEnd()) {
+        return *it;
+    }
+
+    if (s_stringPool->strings.size() < MaximumInternedStrings) {
+        s_stringPool->strings.insert(string);
+    }
+
+    return string;
+}
+
+quint32 CompactArchiveEntry::presenceFlag(int key)
+{
+    switch (key) {
+    case FileName:
+        return HasFileName;
+    case InternalID:
+        return HasInternalID;
+    case Size:
+        return HasSize;
+    case CompressedSize:
+        return HasCompressedSize;
+    case Timestamp:
+        return HasTimestamp;
+    case IsDirectory:
+        return HasIsDirectory;
+    case IsPasswordProtected:
+        return HasIsPasswordProtected;
+    case Permissions:
+        return HasPermissions;
+    case Owner:
+        return HasOwner;
+    case Group:
+        return HasGroup;
+    case Method:
+        return HasMethod;
+    case Version:
+        return HasVersion;
+    case PathNode:
+        return HasPathNode;
+    default:
+        return 0;
+    }
+}
+
+QString *CompactArchiveEntry::internedField(int key)
+{
+    return const_cast<QString*>(static_cast<const CompactArchiveEntry*>(this)->internedField(key));
+}
+
+const QString *CompactArchiveEntry::internedField(int key) const
+{
+    switch (key) {
+    case Permissions:
+        return &m_permissions;
+    case Owner:
+        return &m_owner;
+    case Group:
+        return &m_group;
+    case Method:
+        return &m_method;
+    case Version:
+        return &m_version;
+    default:
+        return 0;
+    }
+}
+
+void CompactArchiveEntry::setFlag(quint32 flag, bool on)
+{
+    if (on) {
+        m_flags |= flag;
+    } else {
+        m_flags &= ~flag;
+    }
+}
+
+bool CompactArchiveEntry::contains(int key) const
+{
+    return (m_flags & presenceFlag(key)) || m_extra.contains(key);
+}
+
+QVariant CompactArchiveEntry::value(int key) const
+{
+    const quint32 flag = presenceFlag(key);
+
+    if (!flag || !(m_flags & flag)) {
+        return m_extra.value(key);
+    }
+
+    switch (key) {
+    case FileName:
+    case InternalID:
+        return fileName();
+    case Size:
+        return m_size;
+    case CompressedSize:
+        return m_compressedSize;
+    case Timestamp:
+        return timestamp();
+    case IsDirectory:
+        return isDirectory();
+    case IsPasswordProtected:
+        return isPasswordProtected();
+    case PathNode:
+        return m_pathNode;
+    default:
+        return *internedField(key);
+    }
+}
+
+void CompactArchiveEntry::setValue(int key, const QVariant &value)
+{
+    // An InternalID equal to the file name is not stored, and neither is a
+    // file name built from the path node, so they have to be kept before
+    // what they are built from changes.
+    const bool fileNameChanges = (key == FileName) ||
+                                 ((key == PathNode) && (m_flags & FileNameFromPathFlag));
+
+    if (fileNameChanges && (m_flags & HasInternalID)) {
+        setFlag(HasInternalID, false);
+        m_extra[InternalID] = fileName();
+    }
+
+    if ((key == PathNode) && (m_flags & FileNameFromPathFlag)) {
+        m_fileName = fileName();
+        setFlag(FileNameFromPathFlag | FileNameHasSlashFlag, false);
+    }
+
+    m_extra.remove(key);
+    setFlag(presenceFlag(key), false);
+
+    bool ok = false;
+
+    switch (key) {
+    case FileName:
+        setFlag(FileNameFromPathFlag | FileNameHasSlashFlag, false);
+        m_fileName.clear();
+        if (value.type() == QVariant::String) {
+            if (!setFileNameFromPath(value.toString())) {
+                m_fileName = value.toString();
+            }
+            ok = true;
+        }
+        break;
+    case InternalID:
+        ok = (value.type() == QVariant::String) &&
+             (m_flags & HasFileName) &&
+             (value.toString() == fileName());
+        break;
+    case Size:
+        m_size = value.toLongLong(&ok);
+        break;
+    case CompressedSize:
+        m_compressedSize = value.toLongLong(&ok);
+        break;
+    case Timestamp:
+        if ((value.type() == QVariant::DateTime) && value.toDateTime().isValid()) {
+            const QDateTime dateTime(value.toDateTime());
+            m_timestamp = dateTime.toMSecsSinceEpoch();
+            setFlag(TimestampIsUtcFlag, dateTime.timeSpec() == Qt::UTC);
+            ok = true;
+        }
+        break;
+    case IsDirectory:
+        if (value.type() == QVariant::Bool) {
+            setFlag(IsDirectoryFlag, value.toBool());
+            ok = true;
+        }
+        break;
+    case IsPasswordProtected:
+        if (value.type() == QVariant::Bool) {
+            setFlag(IsPasswordProtectedFlag, value.toBool());
+            ok = true;
+        }
+        break;
+    case PathNode:
+        m_pathNode = value.toUInt(&ok);
+        break;
+    case Permissions:
+    case Owner:
+    case Group:
+    case Method:
+    case Version:
+        if (value.type() == QVariant::String) {
+            *internedField(key) = intern(value.toString());
+            ok = true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (ok) {
+        setFlag(presenceFlag(key), true);
+    } else {
+        m_extra.insert(key, value);
+    }
+}
+
+ArchiveEntry CompactArchiveEntry::toArchiveEntry() const
+{
+    static const int typedKeys[] = {
+        FileName, InternalID, Size, CompressedSize, Timestamp, IsDirectory,
+        IsPasswordProtected, Permissions, Owner, Group, Method, Version,
+        PathNode
+    };
+
+    ArchiveEntry entry(m_extra);
+
+    for (uint i = 0; i < sizeof(typedKeys) / sizeof(typedKeys[0]); ++i) {
+        if (m_flags & presenceFlag(typedKeys[i])) {
+            entry.insert(typedKeys[i], value(typedKeys[i]));
+        }
+    }
+
+    return entry;
+}
+
+QDateTime CompactArchiveEntry::timestamp() const
+{
+    if (!(m_flags & HasTimestamp)) {
+        return m_extra.value(Timestamp).toDateTime();
+    }
+
+    const QDateTime dateTime(QDateTime::fromMSecsSinceEpoch(m_timestamp));
+
+    return (m_flags & TimestampIsUtcFlag) ? dateTime.toUTC() : dateTime;
+}
+
+} // namespace Kerfuffle
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COMPACTARCHIVEENTRY_H
+#define COMPACTARCHIVEENTRY_H
+
+#include "kerfuffle_export.h"
+#include "archive.h"
+#include "pathtrie.h"
+
+#include <QDateTime>
+#include <QString>
+#include <QVariant>
+
+namespace Kerfuffle
+{
+
+/**
+ * A memory-friendly version of ArchiveEntry, for keeping the entries of
+ * big archives around.
+ *
+ * The properties every plugin sets are stored as typed fields instead of
+ * QVariants in a hash: sizes as 64-bit integers, the timestamp as
+ * milliseconds since the epoch and the boolean properties as flags. The
+ * owner, group, permissions, method and version strings are shared among
+ * all entries having the same values, and the InternalID is only stored
+ * when it differs from the file name. The file name itself is not stored
+ * when it can be built again from the PathNode of the entry, if the
+ * PathTrie the node belongs to is given. Anything else goes into a hash
+ * which is empty for most entries.
+ *
+ * The EntryMetaDataType keys can still be used with value() and
+ * contains(), and toArchiveEntry() gives back an equivalent ArchiveEntry.
+ */
+class KERFUFFLE_EXPORT CompactArchiveEntry
+{
+public:
+    CompactArchiveEntry();
+
+    /**
+     * @p pathTrie is the trie of the PathNode of @p entry, if any. It must
+     * outlive the CompactArchiveEntry.
+     */
+    explicit CompactArchiveEntry(const ArchiveEntry &entry, const PathTrie *pathTrie = 0);
+
+    bool contains(int key) const;
+    QVariant value(int key) const;
+
+    QVariant operator[](int key) const
+    {
+        return value(key);
+    }
+
+    void setValue(int key, const QVariant &value);
+
+    ArchiveEntry toArchiveEntry() const;
+
+    QString fileName() const;
+
+    qint64 size() const
+    {
+        return m_size;
+    }
+
+    qint64 compressedSize() const
+    {
+        return m_compressedSize;
+    }
+
+    QDateTime timestamp() const;
+
+    bool isDirectory() const
+    {
+        return m_flags & IsDirectoryFlag;
+    }
+
+    bool isPasswordProtected() const
+    {
+        return m_flags & IsPasswordProtectedFlag;
+    }
+
+    const PathTrie *pathTrie() const
+    {
+        return m_pathTrie;
+    }
+
+    /**
+     * The PathTrie node of the entry, or PathTrie::InvalidNode if it has
+     * none.
+     */
+    PathTrie::Node pathNode() const
+    {
+        return (m_flags & HasPathNode) ? m_pathNode : PathTrie::InvalidNode;
+    }
+
+    /**
+     * Returns the instance of @p string shared by all entries, so that
+     * equal strings are only kept in memory once.
+     */
+    static QString intern(const QString &string);
+
+private:
+    enum Flag {
+        HasFileName             = 1 << 0,
+        HasInternalID           = 1 << 1,
+        HasSize                 = 1 << 2,
+        HasCompressedSize       = 1 << 3,
+        HasTimestamp            = 1 << 4,
+        HasIsDirectory          = 1 << 5,
+        HasIsPasswordProtected  = 1 << 6,
+        HasPermissions          = 1 << 7,
+        HasOwner                = 1 << 8,
+        HasGroup                = 1 << 9,
+        HasMethod               = 1 << 10,
+        HasVersion              = 1 << 11,
+        IsDirectoryFlag         = 1 << 12,
+        IsPasswordProtectedFlag = 1 << 13,
+        TimestampIsUtcFlag      = 1 << 14,
+        HasPathNode             = 1 << 15,
+        FileNameFromPathFlag    = 1 << 16,
+        FileNameHasSlashFlag    = 1 << 17
+    };
+
+    static quint32 presenceFlag(int key);
+    QString *internedField(int key);
+    const QString *internedField(int key) const;
+    void setFlag(quint32 flag, bool on);
+    bool setFileNameFromPath(const QString &fileName);
+
+    QString m_fileName;
+    QString m_permissions;
+    QString m_owner;
+    QString m_group;
+    QString m_method;
+    QString m_version;
+    qint64 m_size;
+    qint64 m_compressedSize;
+    qint64 m_timestamp;
+    quint32 m_flags;
+    PathTrie::Node m_pathNode;
+    const PathTrie *m_pathTrie;
+    ArchiveEntry m_extra;
+};
+
+} // namespace Kerfuffle
+
+#endif // COMPACTARCHIVEENTRY_H
@@ -28,6 +28,7 @@
 #include "extractiondialog.h"
 #include "settings.h"
 
+#include <KGlobal>
 #include <KLocale>
 #include <KIconLoader>
 #include <KMessageBox>
@@ -162,6 +163,18 @@ void ExtractionDialog::setShowSelectedFiles(bool value)
     }
 }
 
+void ExtractionDialog::setFileTotals(int allFiles, qint64 allSize, int selectedFiles, qint64 selectedSize)
+{
+    m_ui->allFilesButton->setText(i18nc("@option:radio %1 is the number of files and %2 their size",
+                                        "All &files (%1, %2)",
+                                        i18np("1 file", "%1 files", allFiles),
+                                        KGlobal::locale()->formatByteSize(allSize)));
+    m_ui->selectedFilesButton->setText(i18nc("@option:radio %1 is the number of files and %2 their size",
+                                             "&Selected files only (%1, %2)",
+                                             i18np("1 file", "%1 files", selectedFiles),
+                                             KGlobal::locale()->formatByteSize(selectedSize)));
+}
+
 bool ExtractionDialog::extractAllFiles() const
 {
     return m_ui->allFilesButton->isChecked();
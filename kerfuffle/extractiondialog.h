@@ -52,6 +52,12 @@ public:
     void setCloseAfterExtraction(bool);
     void setAutoSubfolder(bool value);
 
+    /**
+     * Shows the number of files in the archive and in the selection, and
+     * the size of their contents, next to the choice of what to extract.
+     */
+    void setFileTotals(int allFiles, qint64 allSize, int selectedFiles, qint64 selectedSize);
+
     bool extractAllFiles() const;
     bool openDestinationAfterExtraction() const;
     bool closeAfterExtraction() const;
@@ -26,67 +26,231 @@
  */
 
 #include "jobs.h"
+#include "jobscheduler.h"
 
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
 #include <QThread>
+#include <QWaitCondition>
 
 #include <KDebug>
 #include <KLocale>
 
+#ifdef Q_OS_LINUX
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 //#define DEBUG_RACECONDITION
 
 namespace Kerfuffle
 {
 
-class Job::Private : public QThread
+// From linux/ioprio.h, which is not installed everywhere.
+static const int IoprioWhoProcess = 1;
+static const int IoprioClassShift = 13;
+static const int IoprioClassBestEffort = 2;
+static const int IoprioClassIdle = 3;
+static const int IoprioDefaultLevel = 4;
+
+/**
+ * Returns the I/O priority of the calling thread, or -1 if it cannot be
+ * told.
+ */
+static int currentIoPriority()
+{
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_get)
+    return syscall(SYS_ioprio_get, IoprioWhoProcess, 0);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Sets the I/O priority of the calling thread, which the processes it
+ * starts inherit.
+ */
+static void setIoPriority(int priority)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_ioprio_set)
+    if (syscall(SYS_ioprio_set, IoprioWhoProcess, 0, priority) != 0) {
+        kDebug() << "Could not set the I/O priority to" << priority;
+    }
+#else
+    Q_UNUSED(priority)
+#endif
+}
+
+/**
+ * Returns the I/O priority for the IOPriorityClass option @p name, or -1
+ * to leave the priority alone.
+ */
+static int ioPriorityForClass(const QString &name)
+{
+    if (name == QLatin1String("idle")) {
+        return IoprioClassIdle << IoprioClassShift;
+    } else if (name == QLatin1String("best-effort")) {
+        return (IoprioClassBestEffort << IoprioClassShift) | IoprioDefaultLevel;
+    }
+
+    return -1;
+}
+
+class Job::Private : public QRunnable
 {
 public:
-    Private(Job *job, QObject *parent = 0)
-        : QThread(parent)
-        , q(job)
+    Private(Job *job)
+        : q(job)
+        , m_isActive(false)
+        , m_isWorking(false)
+        , m_isSuspended(false)
     {
-        connect(q, SIGNAL(result(KJob*)), SLOT(quit()));
+        setAutoDelete(false);
     }
 
     virtual void run();
 
+    void setActive(bool active);
+    void waitForFinished();
+
+    /**
+     * Suspends or resumes the archive interface if the job is running,
+     * or remembers to suspend it once it starts.
+     */
+    bool setSuspended(bool suspended);
+
 private:
     Job *q;
+
+    QMutex m_mutex;
+    QWaitCondition m_finishedCondition;
+    bool m_isActive;
+    bool m_isWorking;
+    bool m_isSuspended;
 };
 
 void Job::Private::run()
 {
-    q->doWork();
+    ReadOnlyArchiveInterface *interface = q->archiveInterface();
 
-    if (q->isRunning()) {
-        exec();
+    // The worker thread and the interface are used by other jobs
+    // afterwards, so whatever is changed here is restored below.
+    const int ioPriority = q->m_ioPriority;
+    const int previousIoPriority = currentIoPriority();
+    if ((ioPriority >= 0) && (previousIoPriority >= 0)) {
+        setIoPriority(ioPriority);
     }
 
+    interface->throttle()->setBandwidthLimit(q->m_bandwidthLimit);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_isWorking = true;
+        if (m_isSuspended) {
+            interface->doSuspend();
+        }
+    }
+
+    {
+        QEventLoop eventLoop;
+        QObject::connect(q, SIGNAL(result(KJob*)), &eventLoop, SLOT(quit()));
+
+        q->doWork();
+
+        if (q->isRunning()) {
+            eventLoop.exec();
+        }
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_isWorking = false;
+    }
+
+    interface->throttle()->resume();
+    interface->throttle()->setBandwidthLimit(0);
+
+    if ((ioPriority >= 0) && (previousIoPriority >= 0)) {
+        setIoPriority(previousIoPriority);
+    }
+
+    // The worker thread is reused by other jobs, so objects scheduled for
+    // deletion by this one must not wait for the thread to exit.
+    QCoreApplication::sendPostedEvents(0, QEvent::DeferredDelete);
+
 #ifdef DEBUG_RACECONDITION
     QThread::sleep(2);
 #endif
+
+    // q may already be under destruction at this point, in which case the
+    // destructor is blocked in waitForFinished().
+    JobScheduler::self()->jobFinished(q);
+
+    QMutexLocker locker(&m_mutex);
+    m_isActive = false;
+    m_finishedCondition.wakeAll();
+}
+
+void Job::Private::setActive(bool active)
+{
+    QMutexLocker locker(&m_mutex);
+    m_isActive = active;
+}
+
+bool Job::Private::setSuspended(bool suspended)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_isWorking) {
+        ReadOnlyArchiveInterface *interface = q->archiveInterface();
+        if (!(suspended ? interface->doSuspend() : interface->doResume())) {
+            return false;
+        }
+    }
+
+    m_isSuspended = suspended;
+    return true;
+}
+
+void Job::Private::waitForFinished()
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_isActive) {
+        m_finishedCondition.wait(&m_mutex);
+    }
 }
 
 Job::Job(ReadOnlyArchiveInterface *interface, QObject *parent)
     : KJob(parent)
     , m_archiveInterface(interface)
     , m_isRunning(false)
+    , m_priority(BulkPriority)
+    , m_bandwidthLimit(0)
+    , m_ioPriority(-1)
     , d(new Private(this))
 {
     static bool onlyOnce = false;
     if (!onlyOnce) {
         qRegisterMetaType<QPair<QString, QString> >("QPair<QString,QString>");
+        qRegisterMetaType<ArchiveEntry>("ArchiveEntry");
+        qRegisterMetaType<QVector<ArchiveEntry> >("QVector<ArchiveEntry>");
         onlyOnce = true;
     }
 
-    setCapabilities(KJob::Killable);
+    setCapabilities(KJob::Killable | KJob::Suspendable);
 }
 
 Job::~Job()
 {
-    if (d->isRunning()) {
-        d->wait();
+    if (JobScheduler::self()->unschedule(this)) {
+        d->setActive(false);
     }
 
+    d->waitForFinished();
+
     delete d;
 }
 
@@ -100,10 +264,21 @@ bool Job::isRunning() const
     return m_isRunning;
 }
 
+Job::Priority Job::priority() const
+{
+    return m_priority;
+}
+
+void Job::setPriority(Priority priority)
+{
+    m_priority = priority;
+}
+
 void Job::start()
 {
     m_isRunning = true;
-    d->start();
+    d->setActive(true);
+    JobScheduler::self()->schedule(this, d);
 }
 
 void Job::emitResult()
@@ -115,7 +290,9 @@ void Job::emitResult()
 void Job::connectToArchiveInterfaceSignals()
 {
     connect(archiveInterface(), SIGNAL(error(QString,QString)), SLOT(onError(QString,QString)));
-    connect(archiveInterface(), SIGNAL(entry(ArchiveEntry)), SLOT(onEntry(ArchiveEntry)));
+    // Queued even when the batch is flushed from the GUI thread, so that
+    // it is not delivered before the ones still waiting in the queue.
+    connect(archiveInterface(), SIGNAL(entries(QVector<ArchiveEntry>)), SLOT(onEntries(QVector<ArchiveEntry>)), Qt::QueuedConnection);
     connect(archiveInterface(), SIGNAL(entryRemoved(QString)), SLOT(onEntryRemoved(QString)));
     connect(archiveInterface(), SIGNAL(progress(double)), SLOT(onProgress(double)));
     connect(archiveInterface(), SIGNAL(info(QString)), SLOT(onInfo(QString)));
@@ -131,9 +308,13 @@ void Job::onError(const QString & message, const QString & details)
     setErrorText(message);
 }
 
-void Job::onEntry(const ArchiveEntry & archiveEntry)
+void Job::onEntries(const QVector<ArchiveEntry> & archiveEntries)
 {
-    emit newEntry(archiveEntry);
+    emit newEntries(archiveEntries);
+
+    foreach(const ArchiveEntry &archiveEntry, archiveEntries) {
+        emit newEntry(archiveEntry);
+    }
 }
 
 void Job::onProgress(double value)
@@ -155,6 +336,9 @@ void Job::onFinished(bool result)
 {
     kDebug() << result;
 
+    // Send the last entries before the result.
+    archiveInterface()->flushEntries();
+
     archiveInterface()->disconnect(this);
 
     emitResult();
@@ -168,6 +352,14 @@ void Job::onUserQuery(Query *query)
 bool Job::doKill()
 {
     kDebug();
+
+    // A job which has not been started yet can just be dropped.
+    if (JobScheduler::self()->unschedule(this)) {
+        m_isRunning = false;
+        d->setActive(false);
+        return true;
+    }
+
     bool ret = archiveInterface()->doKill();
     if (!ret) {
         kDebug() << "Killing does not seem to be supported here.";
@@ -175,14 +367,34 @@ bool Job::doKill()
     return ret;
 }
 
+bool Job::doSuspend()
+{
+    kDebug();
+    return d->setSuspended(true);
+}
+
+bool Job::doResume()
+{
+    kDebug();
+    return d->setSuspended(false);
+}
+
+void Job::setResourceOptions(const QHash<QString, QVariant> &options)
+{
+    m_bandwidthLimit = options.value(QLatin1String("BandwidthLimit")).toLongLong();
+    m_ioPriority = ioPriorityForClass(options.value(QLatin1String("IOPriorityClass")).toString());
+}
+
 ListJob::ListJob(ReadOnlyArchiveInterface *interface, QObject *parent)
     : Job(interface, parent)
     , m_isSingleFolderArchive(true)
     , m_isPasswordProtected(false)
     , m_extractedFilesSize(0)
 {
-    connect(this, SIGNAL(newEntry(ArchiveEntry)),
-            this, SLOT(onNewEntry(ArchiveEntry)));
+    setPriority(ListingPriority);
+
+    connect(this, SIGNAL(newEntries(QVector<ArchiveEntry>)),
+            this, SLOT(onNewEntries(QVector<ArchiveEntry>)));
 }
 
 void ListJob::doWork()
@@ -211,22 +423,25 @@ bool ListJob::isSingleFolderArchive() const
     return m_isSingleFolderArchive;
 }
 
-void ListJob::onNewEntry(const ArchiveEntry& entry)
+void ListJob::onNewEntries(const QVector<ArchiveEntry>& entries)
 {
-    m_extractedFilesSize += entry[ Size ].toLongLong();
-    m_isPasswordProtected |= entry [ IsPasswordProtected ].toBool();
+    foreach(const ArchiveEntry &entry, entries) {
+        m_extractedFilesSize += entry[ Size ].toLongLong();
+        m_isPasswordProtected |= entry [ IsPasswordProtected ].toBool();
 
-    if (m_isSingleFolderArchive) {
-        const QString fileName(entry[FileName].toString());
-        const QString basePath(fileName.split(QLatin1Char( '/' )).at(0));
+        if (m_isSingleFolderArchive) {
+            const PathTrie *pathTrie = archiveInterface()->pathTrie();
+            const PathTrie::Node pathNode = entry[PathNode].toUInt();
+            const QString basePath(pathTrie->name(pathTrie->topLevelNode(pathNode)));
 
-        if (m_basePath.isEmpty()) {
-            m_basePath = basePath;
-            m_subfolderName = basePath;
-        } else {
-            if (m_basePath != basePath) {
-                m_isSingleFolderArchive = false;
-                m_subfolderName.clear();
+            if (m_basePath.isEmpty()) {
+                m_basePath = basePath;
+                m_subfolderName = basePath;
+            } else {
+                if (m_basePath != basePath) {
+                    m_isSingleFolderArchive = false;
+                    m_subfolderName.clear();
+                }
             }
         }
     }
@@ -237,6 +452,28 @@ QString ListJob::subfolderName() const
     return m_subfolderName;
 }
 
+VisitJob::VisitJob(EntryVisitor *visitor, ReadOnlyArchiveInterface *interface, QObject *parent)
+    : Job(interface, parent)
+    , m_visitor(visitor)
+{
+    setPriority(ListingPriority);
+}
+
+void VisitJob::doWork()
+{
+    emit description(this, i18n("Loading archive..."));
+    connectToArchiveInterfaceSignals();
+
+    // The visitor gets the entries directly.
+    disconnect(archiveInterface(), SIGNAL(entries(QVector<ArchiveEntry>)), this, SLOT(onEntries(QVector<ArchiveEntry>)));
+
+    bool ret = archiveInterface()->visitEntries(m_visitor);
+
+    if (!archiveInterface()->waitForFinishedSignal()) {
+        onFinished(ret);
+    }
+}
+
 ExtractJob::ExtractJob(const QVariantList& files, const QString& destinationDir, ExtractionOptions options, ReadOnlyArchiveInterface *interface, QObject *parent)
     : Job(interface, parent)
     , m_files(files)
@@ -244,6 +481,7 @@ ExtractJob::ExtractJob(const QVariantList& files, const QString& destinationDir,
     , m_options(options)
 {
     setDefaultOptions();
+    setResourceOptions(m_options);
 }
 
 void ExtractJob::doWork()
@@ -299,6 +537,7 @@ AddJob::AddJob(const QStringList& files, const CompressionOptions& options , Rea
     , m_files(files)
     , m_options(options)
 {
+    setResourceOptions(m_options);
 }
 
 void AddJob::doWork()
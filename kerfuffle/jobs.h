@@ -36,6 +36,7 @@
 #include <KJob>
 #include <QList>
 #include <QVariant>
+#include <QVector>
 #include <QString>
 
 namespace Kerfuffle
@@ -48,18 +49,43 @@ class KERFUFFLE_EXPORT Job : public KJob
     Q_OBJECT
 
 public:
+    /**
+     * The order in which queued jobs are started by the JobScheduler.
+     */
+    enum Priority {
+        InteractivePriority, ///< The user is waiting for it, e.g. a preview.
+        ListingPriority,     ///< Loading the contents of an archive.
+        BulkPriority         ///< Extracting, adding and deleting files.
+    };
+
     void start();
 
     bool isRunning() const;
 
+    Priority priority() const;
+
+    /**
+     * Sets the priority of the job. Has no effect once the job has been
+     * started.
+     */
+    void setPriority(Priority priority);
+
 protected:
     Job(ReadOnlyArchiveInterface *interface, QObject *parent = 0);
     virtual ~Job();
     virtual bool doKill();
+    virtual bool doSuspend();
+    virtual bool doResume();
     virtual void emitResult();
 
     ReadOnlyArchiveInterface *archiveInterface();
 
+    /**
+     * Reads the BandwidthLimit and IOPriorityClass options, which are
+     * applied while the job runs.
+     */
+    void setResourceOptions(const QHash<QString, QVariant> &options);
+
     void connectToArchiveInterfaceSignals();
 
 public slots:
@@ -68,7 +94,7 @@ public slots:
 protected slots:
     virtual void onError(const QString &message, const QString &details);
     virtual void onInfo(const QString &info);
-    virtual void onEntry(const ArchiveEntry &archiveEntry);
+    virtual void onEntries(const QVector<ArchiveEntry> &archiveEntries);
     virtual void onProgress(double progress);
     virtual void onEntryRemoved(const QString &path);
     virtual void onFinished(bool result);
@@ -78,12 +104,23 @@ signals:
     void entryRemoved(const QString & entry);
     void error(const QString& errorMessage, const QString& details);
     void newEntry(const ArchiveEntry &);
+
+    /**
+     * The new entries, in batches. Emitted before the newEntry() signals
+     * for the same entries.
+     */
+    void newEntries(const QVector<ArchiveEntry> &);
     void userQuery(Kerfuffle::Query*);
 
 private:
+    friend class JobScheduler;
+
     ReadOnlyArchiveInterface *m_archiveInterface;
 
     bool m_isRunning;
+    Priority m_priority;
+    qint64 m_bandwidthLimit;
+    int m_ioPriority;
 
     class Private;
     Private * const d;
@@ -112,7 +149,28 @@ private:
     qlonglong m_extractedFilesSize;
 
 private slots:
-    void onNewEntry(const ArchiveEntry&);
+    void onNewEntries(const QVector<ArchiveEntry>&);
+};
+
+/**
+ * Hands the entries of an archive to an EntryVisitor until it asks to
+ * stop. No newEntry() signals are emitted.
+ *
+ * The visitor is called from the job's thread and must stay alive until
+ * the job has finished.
+ */
+class KERFUFFLE_EXPORT VisitJob : public Job
+{
+    Q_OBJECT
+
+public:
+    VisitJob(EntryVisitor *visitor, ReadOnlyArchiveInterface *interface, QObject *parent = 0);
+
+public slots:
+    virtual void doWork();
+
+private:
+    EntryVisitor *m_visitor;
 };
 
 class KERFUFFLE_EXPORT ExtractJob : public Job
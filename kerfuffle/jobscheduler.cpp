@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "jobscheduler.h"
+#include "archiveinterface.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <KDebug>
+#include <KGlobal>
+
+namespace Kerfuffle
+{
+
+// Interactive jobs are not bound by maximumConcurrentJobs(), so the pool
+// itself must have room for a few more threads.
+static const int InteractiveThreadReserve = 4;
+
+// How long the scheduler waits at exit for the cancelled jobs to stop.
+static const int ShutdownTimeout = 5000;
+
+K_GLOBAL_STATIC(JobScheduler, s_jobScheduler)
+
+JobScheduler *JobScheduler::self()
+{
+    return s_jobScheduler;
+}
+
+JobScheduler::JobScheduler()
+    : m_pool(new QThreadPool)
+    , m_runningBoundedJobs(0)
+    , m_maximumConcurrentJobs(qMax(2, QThread::idealThreadCount()))
+{
+    m_pool->setMaxThreadCount(m_maximumConcurrentJobs + InteractiveThreadReserve);
+}
+
+JobScheduler::~JobScheduler()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+
+        // Nothing is left to report the results of the jobs to at exit,
+        // so the queued ones are dropped and the running ones killed.
+        m_queue.clear();
+
+        foreach(const RunningJob& runningJob, m_runningJobs) {
+            runningJob.archiveInterface->doKill();
+            runningJob.archiveInterface->throttle()->resume();
+        }
+    }
+
+    // A job may still be waiting for something which will never come,
+    // such as the answer to a query once the GUI is gone. Its thread
+    // cannot be stopped, and deleting the pool would wait for it, so the
+    // pool is left behind for the process exit to clean up.
+    if (!m_pool->waitForDone(ShutdownTimeout)) {
+        kWarning() << "Jobs still running at exit, not waiting for them";
+        return;
+    }
+
+    delete m_pool;
+}
+
+int JobScheduler::maximumConcurrentJobs() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maximumConcurrentJobs;
+}
+
+void JobScheduler::setMaximumConcurrentJobs(int count)
+{
+    QMutexLocker locker(&m_mutex);
+
+    m_maximumConcurrentJobs = qMax(1, count);
+    m_pool->setMaxThreadCount(m_maximumConcurrentJobs + InteractiveThreadReserve);
+
+    startJobs();
+}
+
+void JobScheduler::schedule(Job *job, QRunnable *runnable)
+{
+    QueuedJob queuedJob;
+    queuedJob.job = job;
+    queuedJob.runnable = runnable;
+    queuedJob.archiveInterface = job->archiveInterface();
+    queuedJob.concurrentReader = 0;
+    queuedJob.priority = job->priority();
+    queuedJob.modifiesArchive = (qobject_cast<AddJob*>(job) || qobject_cast<DeleteJob*>(job));
+
+    // Only interactive extractions are worth a second read of the archive,
+    // e.g. to preview a file while the whole archive is being extracted.
+    // Called here since schedule() runs in the thread of the interface.
+    if ((queuedJob.priority == Job::InteractivePriority) && qobject_cast<ExtractJob*>(job)) {
+        queuedJob.concurrentReader = queuedJob.archiveInterface->concurrentReader();
+    }
+
+    QMutexLocker locker(&m_mutex);
+
+    m_queue.append(queuedJob);
+    startJobs();
+}
+
+bool JobScheduler::unschedule(Job *job)
+{
+    QMutexLocker locker(&m_mutex);
+
+    for (int i = 0; i < m_queue.size(); ++i) {
+        if (m_queue.at(i).job == job) {
+            m_queue.removeAt(i);
+
+            // A job modifying the archive may have been holding back the
+            // ones queued after it.
+            startJobs();
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobScheduler::jobFinished(Job *job)
+{
+    QMutexLocker locker(&m_mutex);
+
+    Q_ASSERT(m_runningJobs.contains(job));
+    const RunningJob runningJob = m_runningJobs.take(job);
+
+    m_busyInterfaces.remove(runningJob.archiveInterface);
+    if (runningJob.isBounded) {
+        --m_runningBoundedJobs;
+    }
+
+    startJobs();
+}
+
+ReadOnlyArchiveInterface *JobScheduler::interfaceFor(const QueuedJob& queuedJob) const
+{
+    bool isArchiveModified = false;
+    bool isArchiveRead = false;
+
+    foreach(const RunningJob& runningJob, m_runningJobs) {
+        if (runningJob.archive == queuedJob.archiveInterface) {
+            isArchiveModified = isArchiveModified || runningJob.modifiesArchive;
+            isArchiveRead = true;
+        }
+    }
+
+    if (!m_busyInterfaces.contains(queuedJob.archiveInterface) &&
+        !(queuedJob.modifiesArchive && isArchiveRead)) {
+        return queuedJob.archiveInterface;
+    }
+
+    if (queuedJob.concurrentReader && !queuedJob.modifiesArchive && !isArchiveModified &&
+        !m_busyInterfaces.contains(queuedJob.concurrentReader)) {
+        return queuedJob.concurrentReader;
+    }
+
+    return 0;
+}
+
+bool JobScheduler::canStart(int index) const
+{
+    const QueuedJob& queuedJob = m_queue.at(index);
+
+    if ((queuedJob.priority != Job::InteractivePriority) &&
+        (m_runningBoundedJobs >= m_maximumConcurrentJobs)) {
+        return false;
+    }
+
+    // Jobs are queued in the order they were started, so anything before
+    // this job on the same archive was started earlier. A job may only
+    // overtake it if neither of them changes the archive.
+    for (int i = 0; i < index; ++i) {
+        const QueuedJob& earlierJob = m_queue.at(i);
+
+        if ((earlierJob.archiveInterface == queuedJob.archiveInterface) &&
+            (earlierJob.modifiesArchive || queuedJob.modifiesArchive)) {
+            return false;
+        }
+    }
+
+    return interfaceFor(queuedJob) != 0;
+}
+
+void JobScheduler::startJobs()
+{
+    for (int priority = Job::InteractivePriority; priority <= Job::BulkPriority; ++priority) {
+        int i = 0;
+
+        while (i < m_queue.size()) {
+            if ((m_queue.at(i).priority != priority) || !canStart(i)) {
+                ++i;
+                continue;
+            }
+
+            const QueuedJob queuedJob = m_queue.takeAt(i);
+            ReadOnlyArchiveInterface *interface = interfaceFor(queuedJob);
+
+            RunningJob runningJob;
+            runningJob.archive = queuedJob.archiveInterface;
+            runningJob.archiveInterface = interface;
+            runningJob.isBounded = (queuedJob.priority != Job::InteractivePriority);
+            runningJob.modifiesArchive = queuedJob.modifiesArchive;
+
+            // The job connects to its interface once it runs, and is only
+            // killed or suspended through it after unschedule() has failed,
+            // so it can be switched to the concurrent reader here.
+            queuedJob.job->m_archiveInterface = interface;
+
+            // Done under the mutex, so that a job killed from now on is
+            // seen as running and its cancellation is not lost.
+            interface->cancellationToken()->reset();
+
+            m_runningJobs.insert(queuedJob.job, runningJob);
+            m_busyInterfaces.insert(interface);
+            if (runningJob.isBounded) {
+                ++m_runningBoundedJobs;
+            }
+
+            kDebug() << "Starting job" << queuedJob.job << "with priority" << priority
+                     << "-" << m_queue.size() << "job(s) still queued";
+
+            m_pool->start(queuedJob.runnable);
+        }
+    }
+}
+
+} // namespace Kerfuffle
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef JOBSCHEDULER_H
+#define JOBSCHEDULER_H
+
+#include "kerfuffle_export.h"
+#include "jobs.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+
+namespace Kerfuffle
+{
+
+class ReadOnlyArchiveInterface;
+
+/**
+ * Runs the jobs of all archives on a shared pool of worker threads.
+ *
+ * Queued jobs are started by priority (see Job::Priority), and in the
+ * order they were started within the same priority. At most
+ * maximumConcurrentJobs() jobs run at the same time, except for
+ * interactive ones, which are never held back by other archives' jobs.
+ *
+ * Archive interfaces keep the state of the operation they are running, so
+ * only one job runs on a given interface at a time. Jobs which read an
+ * archive may be reordered among themselves, but never across a job
+ * which modifies the same archive.
+ *
+ * Running jobs are not preempted. An interactive extraction from an
+ * archive which is busy is run on the archive's concurrentReader() if the
+ * backend has one and nothing is modifying the archive. Otherwise it waits
+ * for the running job to finish, and is then started before the other
+ * jobs queued on that archive.
+ */
+class KERFUFFLE_EXPORT JobScheduler
+{
+public:
+    static JobScheduler *self();
+
+    JobScheduler();
+    ~JobScheduler();
+
+    int maximumConcurrentJobs() const;
+    void setMaximumConcurrentJobs(int count);
+
+    /**
+     * Queues @p job and starts it as soon as its priority and the jobs
+     * running on the same archive allow.
+     */
+    void schedule(Job *job, QRunnable *runnable);
+
+    /**
+     * Removes @p job from the queue.
+     *
+     * @return @c true if the job was queued, @c false if it has already
+     *         been started or was never scheduled.
+     */
+    bool unschedule(Job *job);
+
+    /**
+     * Must be called by the worker thread once @p job is done, so that
+     * the jobs waiting for it can be started. @p job may already be
+     * under destruction.
+     */
+    void jobFinished(Job *job);
+
+private:
+    struct QueuedJob {
+        Job *job;
+        QRunnable *runnable;
+        ReadOnlyArchiveInterface *archiveInterface;
+        ReadOnlyArchiveInterface *concurrentReader;
+        Job::Priority priority;
+        bool modifiesArchive;
+    };
+
+    struct RunningJob {
+        /// The interface of the archive, which identifies it.
+        ReadOnlyArchiveInterface *archive;
+        /// The interface the job runs on: the archive's own one, or its
+        /// concurrent reader.
+        ReadOnlyArchiveInterface *archiveInterface;
+        bool isBounded;
+        bool modifiesArchive;
+    };
+
+    /**
+     * Returns the interface the queued job can run on now, or 0 if it has
+     * to wait.
+     */
+    ReadOnlyArchiveInterface *interfaceFor(const QueuedJob& queuedJob) const;
+    bool canStart(int index) const;
+    void startJobs();
+
+    mutable QMutex m_mutex;
+    /// Not deleted if jobs are still running at exit, see the destructor.
+    QThreadPool *m_pool;
+    QList<QueuedJob> m_queue;
+    QHash<Job*, RunningJob> m_runningJobs;
+    QSet<ReadOnlyArchiveInterface*> m_busyInterfaces;
+    int m_runningBoundedJobs;
+    int m_maximumConcurrentJobs;
+};
+
+} // namespace Kerfuffle
+
+#endif // JOBSCHEDULER_H
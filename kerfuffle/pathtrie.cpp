@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "pathtrie.h"
+
+#include <QReadLocker>
+#include <QStringList>
+#include <QWriteLocker>
+
+namespace Kerfuffle
+{
+
+const PathTrie::Node PathTrie::RootNode;
+const PathTrie::Node PathTrie::InvalidNode;
+
+/**
+ * Stores in @p component the next component of @p path starting at
+ * @p position, skipping empty components and ".".
+ *
+ * @return @c false if there are no components left.
+ */
+static bool nextComponent(const QString &path, int *position, QString *component)
+{
+    const int length = path.length();
+
+    while (*position < length) {
+        int end = path.indexOf(QLatin1Char('/'), *position);
+        if (end < 0) {
+            end = length;
+        }
+
+        const int start = *position;
+        *position = end + 1;
+
+        if ((end == start) || ((end == start + 1) && (path.at(start) == QLatin1Char('.')))) {
+            continue;
+        }
+
+        *component = path.mid(start, end - start);
+        return true;
+    }
+
+    return false;
+}
+
+PathTrie::PathTrie()
+{
+    NodeData root;
+    root.parent = InvalidNode;
+    root.component = 0;
+    root.depth = 0;
+
+    m_nodes.append(root);
+    m_components.append(QString());
+}
+
+quint64 PathTrie::childKey(Node parent, quint32 component)
+{
+    return (quint64(parent) << 32) | component;
+}
+
+PathTrie::Node PathTrie::insert(const QString &path)
+{
+    QWriteLocker locker(&m_lock);
+
+    Node node = RootNode;
+    int position = 0;
+    QString component;
+
+    while (nextComponent(path, &position, &component)) {
+        QHash<QString, quint32>::const_iterator componentIt = m_componentIds.constFind(component);
+        quint32 componentId;
+
+        if (componentIt != m_componentIds.constEnd()) {
+            componentId = componentIt.value();
+        } else {
+            componentId = m_components.size();
+            m_components.append(component);
+            m_componentIds.insert(component, componentId);
+        }
+
+        const quint64 key = childKey(node, componentId);
+        QHash<quint64, Node>::const_iterator childIt = m_children.constFind(key);
+
+        if (childIt != m_children.constEnd()) {
+            node = childIt.value();
+        } else {
+            NodeData data;
+            data.parent = node;
+            data.component = componentId;
+            data.depth = m_nodes.at(node).depth + 1;
+
+            const Node child = m_nodes.size();
+            m_nodes.append(data);
+            m_children.insert(key, child);
+
+            node = child;
+        }
+    }
+
+    return node;
+}
+
+PathTrie::Node PathTrie::find(const QString &path) const
+{
+    QReadLocker locker(&m_lock);
+
+    Node node = RootNode;
+    int position = 0;
+    QString component;
+
+    while (nextComponent(path, &position, &component)) {
+        QHash<QString, quint32>::const_iterator componentIt = m_componentIds.constFind(component);
+        if (componentIt == m_componentIds.constEnd()) {
+            return InvalidNode;
+        }
+
+        QHash<quint64, Node>::const_iterator childIt =
+            m_children.constFind(childKey(node, componentIt.value()));
+        if (childIt == m_children.constEnd()) {
+            return InvalidNode;
+        }
+
+        node = childIt.value();
+    }
+
+    return node;
+}
+
+PathTrie::Node PathTrie::parent(Node node) const
+{
+    QReadLocker locker(&m_lock);
+    return m_nodes.at(node).parent;
+}
+
+QString PathTrie::name(Node node) const
+{
+    QReadLocker locker(&m_lock);
+    return m_components.at(m_nodes.at(node).component);
+}
+
+int PathTrie::depth(Node node) const
+{
+    QReadLocker locker(&m_lock);
+    return m_nodes.at(node).depth;
+}
+
+PathTrie::Node PathTrie::topLevelNode(Node node) const
+{
+    QReadLocker locker(&m_lock);
+
+    while (m_nodes.at(node).depth > 1) {
+        node = m_nodes.at(node).parent;
+    }
+
+    return node;
+}
+
+QString PathTrie::path(Node node) const
+{
+    QReadLocker locker(&m_lock);
+
+    QStringList components;
+    while (node != RootNode) {
+        components.prepend(m_components.at(m_nodes.at(node).component));
+        node = m_nodes.at(node).parent;
+    }
+
+    return components.join(QLatin1String("/"));
+}
+
+int PathTrie::count() const
+{
+    QReadLocker locker(&m_lock);
+    return m_nodes.size();
+}
+
+} // namespace Kerfuffle
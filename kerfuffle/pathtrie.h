@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PATHTRIE_H
+#define PATHTRIE_H
+
+#include "kerfuffle_export.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+namespace Kerfuffle
+{
+
+/**
+ * The paths of the entries in an archive, split into their components once.
+ *
+ * Each path is a node whose parent is the path of the folder containing
+ * it, so the parent folder, the file name or the top-level folder of an
+ * entry are found without splitting its path again. Equal components share
+ * a single string, and full paths are only built again by path().
+ *
+ * Paths are normalized when they are added: empty components and "." are
+ * skipped, so "./a//b/" and "a/b" are the same node, and "/" is the root.
+ *
+ * Nodes are never removed, so they can be kept as handles for as long as
+ * the trie exists. All methods are thread-safe.
+ */
+class KERFUFFLE_EXPORT PathTrie
+{
+public:
+    typedef quint32 Node;
+
+    static const Node RootNode = 0;
+    static const Node InvalidNode = 0xffffffff;
+
+    PathTrie();
+
+    /**
+     * Returns the node for @p path, adding it and its missing ancestors.
+     */
+    Node insert(const QString &path);
+
+    /**
+     * Returns the node for @p path, or InvalidNode if it has never been
+     * added.
+     */
+    Node find(const QString &path) const;
+
+    Node parent(Node node) const;
+
+    /**
+     * The last component of the path of @p node.
+     */
+    QString name(Node node) const;
+
+    /**
+     * The number of components in the path of @p node.
+     */
+    int depth(Node node) const;
+
+    /**
+     * The ancestor of @p node at the top level, or @p node itself if it is
+     * at the top level.
+     */
+    Node topLevelNode(Node node) const;
+
+    /**
+     * Builds the normalized path of @p node again, without a trailing slash.
+     */
+    QString path(Node node) const;
+
+    int count() const;
+
+private:
+    struct NodeData {
+        Node parent;
+        quint32 component;
+        quint32 depth;
+    };
+
+    static quint64 childKey(Node parent, quint32 component);
+
+    mutable QReadWriteLock m_lock;
+    QVector<NodeData> m_nodes;
+    QVector<QString> m_components;
+    QHash<QString, quint32> m_componentIds;
+    QHash<quint64, Node> m_children;
+};
+
+} // namespace Kerfuffle
+
+#endif // PATHTRIE_H
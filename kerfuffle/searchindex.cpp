@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "searchindex.h"
+
+#include <QReadLocker>
+#include <QRegExp>
+#include <QSet>
+#include <QStringList>
+#include <QWriteLocker>
+
+#include <algorithm>
+#include <iterator>
+
+namespace Kerfuffle
+{
+
+static const int TrigramLength = 3;
+
+SearchIndex::SearchIndex()
+{
+}
+
+bool SearchIndex::isWildcard(const QChar &character)
+{
+    return (character == QLatin1Char('*')) ||
+           (character == QLatin1Char('?')) ||
+           (character == QLatin1Char('['));
+}
+
+quint64 SearchIndex::trigramKey(const QChar *characters)
+{
+    return (quint64(characters[0].unicode()) << 32) |
+           (quint64(characters[1].unicode()) << 16) |
+           characters[2].unicode();
+}
+
+void SearchIndex::insert(PathTrie::Node node, const QString &name)
+{
+    const QString foldedName = name.toCaseFolded();
+
+    QWriteLocker locker(&m_lock);
+
+    const quint32 position = m_names.size();
+    m_nodes.append(node);
+    m_names.append(name);
+
+    QSet<quint64> trigrams;
+    for (int i = 0; i + TrigramLength <= foldedName.length(); ++i) {
+        trigrams.insert(trigramKey(foldedName.constData() + i));
+    }
+
+    foreach(quint64 trigram, trigrams) {
+        m_postings[trigram].append(position);
+    }
+}
+
+QVector<quint32> SearchIndex::candidates(const QStringList &literals) const
+{
+    QSet<quint64> trigrams;
+    foreach(const QString &literal, literals) {
+        const QString foldedLiteral = literal.toCaseFolded();
+
+        for (int i = 0; i + TrigramLength <= foldedLiteral.length(); ++i) {
+            trigrams.insert(trigramKey(foldedLiteral.constData() + i));
+        }
+    }
+
+    if (trigrams.isEmpty()) {
+        QVector<quint32> all(m_names.size());
+        for (int i = 0; i < all.size(); ++i) {
+            all[i] = i;
+        }
+        return all;
+    }
+
+    // Start with the rarest trigram, so the intersections stay small.
+    QList<const QVector<quint32>*> postings;
+    foreach(quint64 trigram, trigrams) {
+        QHash<quint64, QVector<quint32> >::const_iterator it = m_postings.constFind(trigram);
+        if (it == m_postings.constEnd()) {
+            return QVector<quint32>();
+        }
+        postings.append(&it.value());
+    }
+
+    const QVector<quint32> *rarest = postings.first();
+    foreach(const QVector<quint32> *list, postings) {
+        if (list->size() < rarest->size()) {
+            rarest = list;
+        }
+    }
+
+    QVector<quint32> result = *rarest;
+    foreach(const QVector<quint32> *list, postings) {
+        if ((list == rarest) || result.isEmpty()) {
+            continue;
+        }
+
+        // The positions in each list are in ascending order.
+        QVector<quint32> intersection;
+        std::set_intersection(result.constBegin(), result.constEnd(),
+                              list->constBegin(), list->constEnd(),
+                              std::back_inserter(intersection));
+        result = intersection;
+    }
+
+    return result;
+}
+
+QVector<PathTrie::Node> SearchIndex::find(const QString &pattern) const
+{
+    if (pattern.isEmpty()) {
+        return QVector<PathTrie::Node>();
+    }
+
+    QStringList literals;
+    bool hasWildcards = false;
+
+    int start = 0;
+    for (int i = 0; i <= pattern.length(); ++i) {
+        if ((i < pattern.length()) && !isWildcard(pattern.at(i))) {
+            continue;
+        }
+
+        if (i < pattern.length()) {
+            hasWildcards = true;
+        }
+
+        literals.append(pattern.mid(start, i - start));
+
+        // Skip the set of characters of a '[...]' wildcard.
+        if ((i < pattern.length()) && (pattern.at(i) == QLatin1Char('['))) {
+            const int end = pattern.indexOf(QLatin1Char(']'), i + 2);
+            if (end != -1) {
+                i = end;
+            }
+        }
+
+        start = i + 1;
+    }
+
+    const QRegExp wildcard(pattern, Qt::CaseInsensitive, QRegExp::Wildcard);
+
+    QReadLocker locker(&m_lock);
+
+    QVector<PathTrie::Node> nodes;
+    QSet<PathTrie::Node> foundNodes;
+
+    foreach(quint32 position, candidates(literals)) {
+        const QString &name = m_names.at(position);
+
+        const bool matches = hasWildcards ?
+                             wildcard.exactMatch(name) :
+                             name.contains(pattern, Qt::CaseInsensitive);
+
+        if (matches) {
+            const PathTrie::Node node = m_nodes.at(position);
+            if (!foundNodes.contains(node)) {
+                foundNodes.insert(node);
+                nodes.append(node);
+            }
+        }
+    }
+
+    return nodes;
+}
+
+int SearchIndex::count() const
+{
+    QReadLocker locker(&m_lock);
+    return m_names.size();
+}
+
+void SearchIndex::clear()
+{
+    QWriteLocker locker(&m_lock);
+
+    m_nodes.clear();
+    m_names.clear();
+    m_postings.clear();
+}
+
+} // namespace Kerfuffle
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include "kerfuffle_export.h"
+#include "pathtrie.h"
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace Kerfuffle
+{
+
+/**
+ * An index of the names of the entries in an archive, for finding those
+ * matching a search query without looking at every name.
+ *
+ * Names are split into trigrams, the sequences of three characters they
+ * contain, and each trigram points to the names containing it. A query
+ * only checks the names containing all the trigrams of its literal parts.
+ * Characters are compared case-insensitively.
+ *
+ * Entries are identified by their PathTrie node. All methods are
+ * thread-safe.
+ */
+class KERFUFFLE_EXPORT SearchIndex
+{
+public:
+    SearchIndex();
+
+    void insert(PathTrie::Node node, const QString &name);
+
+    /**
+     * Returns the nodes whose name contains @p pattern. If @p pattern has
+     * wildcards ('*', '?' or '['), the whole name must match it instead.
+     *
+     * Each node is returned once, in the order it was first inserted.
+     */
+    QVector<PathTrie::Node> find(const QString &pattern) const;
+
+    int count() const;
+
+    void clear();
+
+private:
+    static bool isWildcard(const QChar &character);
+    static quint64 trigramKey(const QChar *characters);
+
+    /**
+     * Returns the positions in m_names of the names which contain all the
+     * trigrams of @p literals, or of all names if the literals are too
+     * short to have any.
+     */
+    QVector<quint32> candidates(const QStringList &literals) const;
+
+    mutable QReadWriteLock m_lock;
+    QVector<PathTrie::Node> m_nodes;
+    QVector<QString> m_names;
+    QHash<quint64, QVector<quint32> > m_postings;
+};
+
+} // namespace Kerfuffle
+
+#endif // SEARCHINDEX_H
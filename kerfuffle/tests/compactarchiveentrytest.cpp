@@ -0,0 +1,228 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "kerfuffle/compactarchiveentry.h"
+
+#include <qtest_kde.h>
+
+#include <qvector.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using Kerfuffle::ArchiveEntry;
+using Kerfuffle::CompactArchiveEntry;
+
+class CompactArchiveEntryTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testRoundTrip();
+    void testInternalID();
+    void testFileNameFromPathTrie();
+    void testUntypedValues();
+    void testInternedStrings();
+    void benchmarkBytesPerEntry();
+};
+
+QTEST_KDEMAIN_CORE(CompactArchiveEntryTest)
+
+// An entry like the ones the libarchive plugin emits. All the strings are
+// created anew, as they would be when read from an archive.
+static ArchiveEntry createEntry(int number)
+{
+    ArchiveEntry e;
+
+    e[Kerfuffle::FileName] = QString(QLatin1String("dir%1/file%2.txt")).arg(number / 100).arg(number);
+    e[Kerfuffle::InternalID] = e[Kerfuffle::FileName];
+    e[Kerfuffle::Permissions] = QString(QLatin1String("-rw-r--r--"));
+    e[Kerfuffle::Owner] = QString(QLatin1String("user"));
+    e[Kerfuffle::Group] = QString(QLatin1String("users"));
+    e[Kerfuffle::Size] = qlonglong(number) * 1000;
+    e[Kerfuffle::Timestamp] = QDateTime::fromTime_t(1300000000 + number);
+    e[Kerfuffle::IsDirectory] = false;
+
+    return e;
+}
+
+static qint64 allocatedBytes()
+{
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#else
+    return mallinfo().uordblks;
+#endif
+#else
+    return -1;
+#endif
+}
+
+void CompactArchiveEntryTest::testRoundTrip()
+{
+    ArchiveEntry e(createEntry(42));
+    e[Kerfuffle::CompressedSize] = qlonglong(5000000000LL);
+    e[Kerfuffle::IsPasswordProtected] = true;
+    e[Kerfuffle::Method] = QLatin1String("Deflate");
+    e[Kerfuffle::CRC] = QLatin1String("deadbeef");
+    e[Kerfuffle::Link] = QLatin1String("../target");
+
+    const CompactArchiveEntry compact(e);
+
+    QCOMPARE(compact.toArchiveEntry(), e);
+
+    QCOMPARE(compact.fileName(), QLatin1String("dir0/file42.txt"));
+    QCOMPARE(compact.size(), 42000LL);
+    QCOMPARE(compact.compressedSize(), 5000000000LL);
+    QCOMPARE(compact.timestamp(), QDateTime::fromTime_t(1300000042));
+    QVERIFY(!compact.isDirectory());
+    QVERIFY(compact.isPasswordProtected());
+
+    QVERIFY(compact.contains(Kerfuffle::Link));
+    QVERIFY(!compact.contains(Kerfuffle::Comment));
+    QCOMPARE(compact[Kerfuffle::CRC].toString(), QLatin1String("deadbeef"));
+    QVERIFY(!compact.value(Kerfuffle::Comment).isValid());
+}
+
+void CompactArchiveEntryTest::testInternalID()
+{
+    ArchiveEntry e;
+    e[Kerfuffle::FileName] = QLatin1String("a.txt");
+
+    CompactArchiveEntry compact(e);
+    QVERIFY(!compact.contains(Kerfuffle::InternalID));
+
+    compact.setValue(Kerfuffle::InternalID, QLatin1String("a.txt"));
+    QCOMPARE(compact.value(Kerfuffle::InternalID).toString(), QLatin1String("a.txt"));
+
+    // The InternalID must not follow the file name.
+    compact.setValue(Kerfuffle::FileName, QLatin1String("b.txt"));
+    QCOMPARE(compact.value(Kerfuffle::InternalID).toString(), QLatin1String("a.txt"));
+    QCOMPARE(compact.value(Kerfuffle::FileName).toString(), QLatin1String("b.txt"));
+
+    e[Kerfuffle::InternalID] = QLatin1String("c.txt");
+    QCOMPARE(CompactArchiveEntry(e).toArchiveEntry(), e);
+}
+
+void CompactArchiveEntryTest::testFileNameFromPathTrie()
+{
+    Kerfuffle::PathTrie pathTrie;
+
+    ArchiveEntry file;
+    file[Kerfuffle::FileName] = QLatin1String("dir/file.txt");
+    file[Kerfuffle::InternalID] = QLatin1String("dir/file.txt");
+    file[Kerfuffle::PathNode] = pathTrie.insert(QLatin1String("dir/file.txt"));
+
+    const CompactArchiveEntry compactFile(file, &pathTrie);
+    QCOMPARE(compactFile.fileName(), QLatin1String("dir/file.txt"));
+    QCOMPARE(compactFile.toArchiveEntry(), file);
+
+    ArchiveEntry dir;
+    dir[Kerfuffle::FileName] = QLatin1String("dir/");
+    dir[Kerfuffle::PathNode] = pathTrie.insert(QLatin1String("dir/"));
+    QCOMPARE(CompactArchiveEntry(dir, &pathTrie).toArchiveEntry(), dir);
+
+    // Names which are not normalized cannot be built from the trie.
+    ArchiveEntry unnormalized;
+    unnormalized[Kerfuffle::FileName] = QLatin1String("dir//other.txt");
+    unnormalized[Kerfuffle::PathNode] = pathTrie.insert(QLatin1String("dir//other.txt"));
+    QCOMPARE(CompactArchiveEntry(unnormalized, &pathTrie).toArchiveEntry(), unnormalized);
+
+    // The file name must not follow a new path node.
+    CompactArchiveEntry moved(file, &pathTrie);
+    moved.setValue(Kerfuffle::PathNode, dir.value(Kerfuffle::PathNode));
+    QCOMPARE(moved.fileName(), QLatin1String("dir/file.txt"));
+    QCOMPARE(moved.value(Kerfuffle::InternalID).toString(), QLatin1String("dir/file.txt"));
+}
+
+void CompactArchiveEntryTest::testUntypedValues()
+{
+    ArchiveEntry e;
+    e[Kerfuffle::FileName] = QLatin1String("a.txt");
+    e[Kerfuffle::Size] = QLatin1String("unknown");
+    e[Kerfuffle::Timestamp] = QDateTime();
+    e[Kerfuffle::IsDirectory] = QLatin1String("no");
+    e[Kerfuffle::Custom + 1] = 12;
+
+    const CompactArchiveEntry compact(e);
+
+    QCOMPARE(compact.toArchiveEntry(), e);
+    QCOMPARE(compact.size(), 0LL);
+    QCOMPARE(compact[Kerfuffle::Custom + 1].toInt(), 12);
+}
+
+void CompactArchiveEntryTest::testInternedStrings()
+{
+    const CompactArchiveEntry first(createEntry(1));
+    const CompactArchiveEntry second(createEntry(2));
+
+    QCOMPARE(first[Kerfuffle::Owner].toString(), QLatin1String("user"));
+    QCOMPARE(first[Kerfuffle::Owner].toString().constData(),
+             second[Kerfuffle::Owner].toString().constData());
+    QCOMPARE(first[Kerfuffle::Permissions].toString().constData(),
+             second[Kerfuffle::Permissions].toString().constData());
+}
+
+void CompactArchiveEntryTest::benchmarkBytesPerEntry()
+{
+    if (allocatedBytes() < 0) {
+        QSKIP("Heap usage cannot be measured on this platform. Skipping test.", SkipSingle);
+    }
+
+    const int count = 100000;
+    qint64 hashBytes;
+    qint64 compactBytes;
+
+    {
+        const qint64 before = allocatedBytes();
+
+        QVector<ArchiveEntry> entries(count);
+        for (int i = 0; i < count; ++i) {
+            entries[i] = createEntry(i);
+        }
+
+        hashBytes = (allocatedBytes() - before) / count;
+    }
+
+    {
+        const qint64 before = allocatedBytes();
+
+        QVector<CompactArchiveEntry> entries(count);
+        for (int i = 0; i < count; ++i) {
+            entries[i] = CompactArchiveEntry(createEntry(i));
+        }
+
+        compactBytes = (allocatedBytes() - before) / count;
+    }
+
+    qDebug("ArchiveEntry: %lld bytes per entry", hashBytes);
+    qDebug("CompactArchiveEntry: %lld bytes per entry", compactBytes);
+
+    QVERIFY(compactBytes < hashBytes);
+}
+
+#include "compactarchiveentrytest.moc"
@@ -24,6 +24,7 @@
  */
 
 #include "kerfuffle/jobs.h"
+#include "kerfuffle/jobscheduler.h"
 
 #include "jsonarchiveinterface.h"
 
@@ -54,6 +55,7 @@ private Q_SLOTS:
     void testIsPasswordProtected();
     void testIsSingleFolderArchive();
     void testListEntries();
+    void testEntriesAreBatched();
 
     // ExtractJob-related tests
     void testExtractJobAccessors();
@@ -64,6 +66,10 @@ private Q_SLOTS:
     // AddJob-related tests
     void testAddEntry();
 
+    // JobScheduler-related tests
+    void testDefaultPriorities();
+    void testQueuedJobsKeepArchiveOrder();
+
 private:
     JSONArchiveInterface *createArchiveInterface(const QString& filePath);
     QList<Kerfuffle::ArchiveEntry> listEntries(JSONArchiveInterface *iface);
@@ -251,6 +257,24 @@ void JobsTest::testListEntries()
     iface->deleteLater();
 }
 
+void JobsTest::testEntriesAreBatched()
+{
+    JSONArchiveInterface *iface =
+        createArchiveInterface(QLatin1String(KDESRCDIR "data/archive001.json"));
+
+    Kerfuffle::ListJob *listJob = new Kerfuffle::ListJob(iface, this);
+    QSignalSpy batchSpy(listJob, SIGNAL(newEntries(QVector<ArchiveEntry>)));
+    QSignalSpy entrySpy(listJob, SIGNAL(newEntry(ArchiveEntry)));
+
+    startAndWaitForResult(listJob);
+
+    // The four entries are too few to be split.
+    QCOMPARE(batchSpy.count(), 1);
+    QCOMPARE(entrySpy.count(), 4);
+
+    iface->deleteLater();
+}
+
 void JobsTest::slotNewEntry(const ArchiveEntry& entry)
 {
     m_entries.append(entry);
@@ -363,4 +387,62 @@ void JobsTest::testAddEntry()
     iface->deleteLater();
 }
 
+void JobsTest::testDefaultPriorities()
+{
+    JSONArchiveInterface *iface = createArchiveInterface(QLatin1String(KDESRCDIR "data/archive001.json"));
+
+    Kerfuffle::ListJob *listJob = new Kerfuffle::ListJob(iface, this);
+    QCOMPARE(listJob->priority(), Kerfuffle::Job::ListingPriority);
+
+    Kerfuffle::ExtractJob *extractJob =
+        new Kerfuffle::ExtractJob(QVariantList(), QLatin1String("/tmp/some-dir"),
+                                  Kerfuffle::ExtractionOptions(), iface, this);
+    QCOMPARE(extractJob->priority(), Kerfuffle::Job::BulkPriority);
+
+    extractJob->setPriority(Kerfuffle::Job::InteractivePriority);
+    QCOMPARE(extractJob->priority(), Kerfuffle::Job::InteractivePriority);
+
+    delete listJob;
+    delete extractJob;
+
+    iface->deleteLater();
+}
+
+void JobsTest::testQueuedJobsKeepArchiveOrder()
+{
+    Kerfuffle::JobScheduler *scheduler = Kerfuffle::JobScheduler::self();
+    const int maximumConcurrentJobs = scheduler->maximumConcurrentJobs();
+
+    JSONArchiveInterface *iface = createArchiveInterface(QLatin1String(KDESRCDIR "data/archive001.json"));
+
+    // Keep the bulk job below queued for a while behind a job on another
+    // archive.
+    scheduler->setMaximumConcurrentJobs(1);
+
+    JSONArchiveInterface *otherIface = createArchiveInterface(QLatin1String(KDESRCDIR "data/archive002.json"));
+    Kerfuffle::ListJob *otherListJob = new Kerfuffle::ListJob(otherIface, this);
+
+    QVariantList filesToDelete;
+    filesToDelete.append(QLatin1String("c.txt"));
+    Kerfuffle::DeleteJob *deleteJob = new Kerfuffle::DeleteJob(filesToDelete, iface, this);
+
+    // The listing has a higher priority than the deletion, but must not
+    // overtake it since they work on the same archive.
+    m_entries.clear();
+    Kerfuffle::ListJob *listJob = new Kerfuffle::ListJob(iface, this);
+    connect(listJob, SIGNAL(newEntry(ArchiveEntry)),
+            SLOT(slotNewEntry(ArchiveEntry)));
+
+    otherListJob->start();
+    deleteJob->start();
+    startAndWaitForResult(listJob);
+
+    QCOMPARE(m_entries.count(), 3);
+
+    scheduler->setMaximumConcurrentJobs(maximumConcurrentJobs);
+
+    iface->deleteLater();
+    otherIface->deleteLater();
+}
+
 #include "jobstest.moc"
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "kerfuffle/pathtrie.h"
+
+#include <qtest_kde.h>
+
+using Kerfuffle::PathTrie;
+
+class PathTrieTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testNormalization();
+    void testNodes();
+    void testFind();
+};
+
+QTEST_KDEMAIN_CORE(PathTrieTest)
+
+void PathTrieTest::testNormalization()
+{
+    PathTrie pathTrie;
+
+    const PathTrie::Node node = pathTrie.insert(QLatin1String("a/b"));
+
+    QCOMPARE(pathTrie.insert(QLatin1String("./a//b/")), node);
+    QCOMPARE(pathTrie.insert(QLatin1String("/a/./b")), node);
+    QCOMPARE(pathTrie.insert(QLatin1String("/")), PathTrie::RootNode);
+    QCOMPARE(pathTrie.insert(QLatin1String(".")), PathTrie::RootNode);
+    QCOMPARE(pathTrie.insert(QString()), PathTrie::RootNode);
+
+    // "..." and ".a" are regular names.
+    QVERIFY(pathTrie.insert(QLatin1String("a/.../.a")) != node);
+
+    QCOMPARE(pathTrie.count(), 5);
+}
+
+void PathTrieTest::testNodes()
+{
+    PathTrie pathTrie;
+
+    const PathTrie::Node file = pathTrie.insert(QLatin1String("aDir/bDir/c.txt"));
+    const PathTrie::Node dir = pathTrie.parent(file);
+    const PathTrie::Node topLevel = pathTrie.parent(dir);
+
+    QCOMPARE(pathTrie.name(file), QLatin1String("c.txt"));
+    QCOMPARE(pathTrie.name(dir), QLatin1String("bDir"));
+    QCOMPARE(pathTrie.name(topLevel), QLatin1String("aDir"));
+    QCOMPARE(pathTrie.parent(topLevel), PathTrie::RootNode);
+
+    QCOMPARE(pathTrie.depth(file), 3);
+    QCOMPARE(pathTrie.depth(PathTrie::RootNode), 0);
+    QCOMPARE(pathTrie.topLevelNode(file), topLevel);
+    QCOMPARE(pathTrie.topLevelNode(topLevel), topLevel);
+
+    QCOMPARE(pathTrie.path(file), QLatin1String("aDir/bDir/c.txt"));
+    QCOMPARE(pathTrie.path(PathTrie::RootNode), QString());
+
+    // Equal components are shared.
+    const PathTrie::Node other = pathTrie.insert(QLatin1String("c.txt"));
+    QVERIFY(other != file);
+    QCOMPARE(pathTrie.name(other).constData(), pathTrie.name(file).constData());
+}
+
+void PathTrieTest::testFind()
+{
+    PathTrie pathTrie;
+
+    const PathTrie::Node node = pathTrie.insert(QLatin1String("aDir/b.txt"));
+
+    QCOMPARE(pathTrie.find(QLatin1String("./aDir/b.txt")), node);
+    QCOMPARE(pathTrie.find(QLatin1String("aDir/")), pathTrie.parent(node));
+    QCOMPARE(pathTrie.find(QLatin1String("b.txt")), PathTrie::InvalidNode);
+    QCOMPARE(pathTrie.find(QLatin1String("aDir/c.txt")), PathTrie::InvalidNode);
+    QCOMPARE(pathTrie.count(), 3);
+}
+
+#include "pathtrietest.moc"
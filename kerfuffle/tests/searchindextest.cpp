@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "kerfuffle/searchindex.h"
+
+#include <qtest_kde.h>
+
+using Kerfuffle::PathTrie;
+using Kerfuffle::SearchIndex;
+
+Q_DECLARE_METATYPE(QVector<PathTrie::Node>)
+
+class SearchIndexTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void testFind_data();
+    void testFind();
+    void testDuplicates();
+    void testClear();
+
+private:
+    SearchIndex m_index;
+};
+
+QTEST_KDEMAIN_CORE(SearchIndexTest)
+
+void SearchIndexTest::init()
+{
+    m_index.clear();
+
+    m_index.insert(1, QLatin1String("README"));
+    m_index.insert(2, QLatin1String("main.cpp"));
+    m_index.insert(3, QLatin1String("main.h"));
+    m_index.insert(4, QLatin1String("Makefile"));
+    m_index.insert(5, QLatin1String("archive.tar.gz"));
+    m_index.insert(6, QLatin1String("a"));
+}
+
+void SearchIndexTest::testFind_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QVector<PathTrie::Node> >("expectedNodes");
+
+    QTest::newRow("empty pattern")
+        << QString() << QVector<PathTrie::Node>();
+
+    QTest::newRow("substring")
+        << QString(QLatin1String("main")) << (QVector<PathTrie::Node>() << 2 << 3);
+
+    QTest::newRow("case-insensitive substring")
+        << QString(QLatin1String("MAKE")) << (QVector<PathTrie::Node>() << 4);
+
+    QTest::newRow("substring shorter than a trigram")
+        << QString(QLatin1String("a")) << (QVector<PathTrie::Node>() << 1 << 2 << 3 << 4 << 5 << 6);
+
+    QTest::newRow("no match")
+        << QString(QLatin1String("zip")) << QVector<PathTrie::Node>();
+
+    QTest::newRow("trigram in no name")
+        << QString(QLatin1String("mainmain")) << QVector<PathTrie::Node>();
+
+    QTest::newRow("star")
+        << QString(QLatin1String("*.cpp")) << (QVector<PathTrie::Node>() << 2);
+
+    QTest::newRow("wildcards match whole names")
+        << QString(QLatin1String("main*")) << (QVector<PathTrie::Node>() << 2 << 3);
+
+    QTest::newRow("question mark")
+        << QString(QLatin1String("main.?")) << (QVector<PathTrie::Node>() << 3);
+
+    QTest::newRow("character set")
+        << QString(QLatin1String("[mr]*")) << (QVector<PathTrie::Node>() << 1 << 2 << 3 << 4);
+
+    QTest::newRow("several literals")
+        << QString(QLatin1String("arc*.gz")) << (QVector<PathTrie::Node>() << 5);
+}
+
+void SearchIndexTest::testFind()
+{
+    QFETCH(QString, pattern);
+    QFETCH(QVector<PathTrie::Node>, expectedNodes);
+
+    QCOMPARE(m_index.find(pattern), expectedNodes);
+}
+
+void SearchIndexTest::testDuplicates()
+{
+    m_index.insert(2, QLatin1String("main.cpp"));
+
+    QCOMPARE(m_index.count(), 7);
+    QCOMPARE(m_index.find(QLatin1String("main.cpp")), QVector<PathTrie::Node>() << 2);
+}
+
+void SearchIndexTest::testClear()
+{
+    m_index.clear();
+
+    QCOMPARE(m_index.count(), 0);
+    QVERIFY(m_index.find(QLatin1String("main")).isEmpty());
+}
+
+#include "searchindextest.moc"
@@ -23,7 +23,10 @@
 
 #include "archivemodel.h"
 #include "kerfuffle/archive.h"
+#include "kerfuffle/compactarchiveentry.h"
 #include "kerfuffle/jobs.h"
+#include "kerfuffle/pathtrie.h"
+#include "kerfuffle/searchindex.h"
 
 #include <KDebug>
 #include <KIconLoader>
@@ -37,71 +40,97 @@
 #include <QList>
 #include <QMimeData>
 #include <QPersistentModelIndex>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QPixmap>
+#include <QQueue>
+#include <QRegExp>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
+#include <QWaitCondition>
+#include <QtConcurrentMap>
+#include <QtConcurrentRun>
 #include <QtDBus/QtDBus>
 
 #include <algorithm>
+#include <limits>
+#include <new>
 
 using namespace Kerfuffle;
 
-class ArchiveDirNode;
+// How often, in milliseconds, the entries listed so far are shown while an
+// archive is being opened.
+static const int PublishInterval = 100;
+
+// Folders with at least this many entries are sorted by two threads, and
+// the smaller ones several at a time.
+static const int BigFolderSize = 50000;
+
+// How many nodes of each kind are allocated at once by a NodeArena.
+static const int NodesPerBlock = 4096;
 
-//used to speed up the loading of large archives
-static ArchiveNode* s_previousMatch = NULL;
-K_GLOBAL_STATIC(QStringList, s_previousPieces)
+class ArchiveDirNode;
 
 
 // TODO: This class hierarchy needs some love.
 //       Having a parent take a child class as a parameter in the constructor
 //       should trigger one's spider-sense (TM).
+//
+// Nodes are created and destroyed by the NodeArena of their tree. There are
+// no virtual methods, so that nodes do not carry a vtable pointer.
 class ArchiveNode
 {
 public:
-    ArchiveNode(ArchiveDirNode *parent, const ArchiveEntry & entry)
-        : m_parent(parent)
+    ArchiveNode(ArchiveDirNode *parent, const ArchiveEntry & entry, const QString & name, const PathTrie *pathTrie)
+        : m_entry(entry, pathTrie)
+        , m_name(name)
+        , m_parent(parent)
+        , m_row(0)
+        , m_isDir(false)
     {
-        setEntry(entry);
     }
 
-    virtual ~ArchiveNode()
-    {
-    }
-
-    const ArchiveEntry &entry() const
+    const CompactArchiveEntry &entry() const
     {
         return m_entry;
     }
 
-    void setEntry(const ArchiveEntry& entry)
-    {
-        m_entry = entry;
-
-        const QStringList pieces = entry[FileName].toString().split(QLatin1Char( '/' ), QString::SkipEmptyParts);
-        m_name = pieces.isEmpty() ? QString() : pieces.last();
-
-        if (entry[IsDirectory].toBool()) {
-            m_icon = KIconLoader::global()->loadMimeTypeIcon(KMimeType::mimeType(QLatin1String("inode/directory"))->iconName(), KIconLoader::Small);
-        } else {
-            const KMimeType::Ptr mimeType = KMimeType::findByPath(m_entry[FileName].toString(), 0, true);
-            m_icon = KIconLoader::global()->loadMimeTypeIcon(mimeType->iconName(), KIconLoader::Small);
-        }
-    }
+    /**
+     * Replaces the entry of the node, updating the totals of the folders
+     * containing it.
+     */
+    void setEntry(const ArchiveEntry& entry);
 
     ArchiveDirNode *parent() const
     {
         return m_parent;
     }
 
-    int row() const;
+    /**
+     * The position of the node in its parent's entries, kept up to date by
+     * ArchiveDirNode.
+     */
+    int row() const
+    {
+        return m_row;
+    }
 
-    virtual bool isDir() const
+    void setRow(int row)
     {
-        return false;
+        m_row = row;
     }
 
-    QPixmap icon() const
+    /**
+     * Whether the node is among the entries of its parent. New nodes are
+     * only added to their parent after they have been filled.
+     */
+    bool isAttached() const;
+
+    bool isDir() const
     {
-        return m_icon;
+        return m_isDir;
     }
 
     QString name() const
@@ -110,33 +139,40 @@ public:
     }
 
 protected:
-    void setIcon(const QPixmap &icon)
+    ArchiveNode(ArchiveDirNode *parent, const ArchiveEntry & entry, const QString & name, const PathTrie *pathTrie, bool isDir)
+        : m_entry(entry, pathTrie)
+        , m_name(name)
+        , m_parent(parent)
+        , m_row(0)
+        , m_isDir(isDir)
     {
-        m_icon = icon;
     }
 
 private:
-    ArchiveEntry    m_entry;
-    QPixmap         m_icon;
+    CompactArchiveEntry m_entry;
     QString         m_name;
     ArchiveDirNode *m_parent;
+    int             m_row;
+    bool            m_isDir;
 };
 
 
 class ArchiveDirNode: public ArchiveNode
 {
 public:
-    ArchiveDirNode(ArchiveDirNode *parent, const ArchiveEntry & entry)
-        : ArchiveNode(parent, entry)
+    ArchiveDirNode(ArchiveDirNode *parent, const ArchiveEntry & entry, const QString & name, const PathTrie *pathTrie)
+        : ArchiveNode(parent, entry, name, pathTrie, true)
+        , m_dirCount(0)
+        , m_fileCount(0)
+        , m_totalFileCount(0)
+        , m_totalSize(0)
+        , m_totalCompressedSize(0)
+        , m_sortGeneration(0)
+        , m_wasShown(false)
     {
     }
 
-    ~ArchiveDirNode()
-    {
-        clear();
-    }
-
-    QList<ArchiveNode*> entries()
+    const QList<ArchiveNode*> &entries() const
     {
         return m_entries;
     }
@@ -144,154 +180,917 @@ public:
     void setEntryAt(int index, ArchiveNode* value)
     {
         m_entries[index] = value;
+        value->setRow(index);
     }
 
+    /**
+     * Appends @p entry, which leaves the entries unsorted.
+     */
     void appendEntry(ArchiveNode* entry)
     {
+        entry->setRow(m_entries.size());
         m_entries.append(entry);
+        m_sortGeneration = 0;
+
+        childAdded(entry, 1);
+    }
+
+    /**
+     * Removes the entries from @p first to @p last and returns them. The
+     * rows of the following entries are left alone, so that several ranges
+     * can be removed before calling updateRows() once.
+     */
+    QList<ArchiveNode*> takeEntries(int first, int last)
+    {
+        const QList<ArchiveNode*> removed = m_entries.mid(first, last - first + 1);
+        m_entries.erase(m_entries.begin() + first, m_entries.begin() + last + 1);
+
+        foreach(ArchiveNode *entry, removed) {
+            childAdded(entry, -1);
+        }
+
+        return removed;
     }
 
-    void removeEntryAt(int index)
+    /**
+     * Updates the rows of the entries from @p first on.
+     */
+    void updateRows(int first)
     {
-        delete m_entries.takeAt(index);
+        for (int i = first; i < m_entries.size(); ++i) {
+            m_entries.at(i)->setRow(i);
+        }
     }
 
-    virtual bool isDir() const
+    /**
+     * The number of folders and files directly in this folder.
+     */
+    int dirCount() const
     {
-        return true;
+        return m_dirCount;
+    }
+
+    int fileCount() const
+    {
+        return m_fileCount;
+    }
+
+    /**
+     * The number of files in this folder and its subfolders, and the size
+     * of their contents.
+     */
+    int totalFileCount() const
+    {
+        return m_totalFileCount;
+    }
+
+    qint64 totalSize() const
+    {
+        return m_totalSize;
+    }
+
+    qint64 totalCompressedSize() const
+    {
+        return m_totalCompressedSize;
+    }
+
+    /**
+     * Adds the given amounts to the totals of this folder and of the folders
+     * containing it, as far as they are attached.
+     */
+    void addToTotals(int fileCount, qint64 size, qint64 compressedSize)
+    {
+        ArchiveDirNode *dir = this;
+
+        while (dir) {
+            dir->m_totalFileCount += fileCount;
+            dir->m_totalSize += size;
+            dir->m_totalCompressedSize += compressedSize;
+            Q_ASSERT(dir->m_totalFileCount >= 0);
+
+            // A folder which has not been attached yet passes its totals on
+            // when it is.
+            if (!dir->isAttached()) {
+                break;
+            }
+
+            dir = dir->parent();
+        }
     }
 
-    ArchiveNode* find(const QString & name)
+    /**
+     * Adds this folder and the subfolders which have been shown to
+     * @p store.
+     */
+    void returnShownDirNodes(QList<ArchiveDirNode*> *store)
     {
+        store->append(this);
+
         foreach(ArchiveNode *node, m_entries) {
-            if (node && (node->name() == name)) {
-                return node;
+            if (node->isDir() && static_cast<ArchiveDirNode*>(node)->wasShown()) {
+                static_cast<ArchiveDirNode*>(node)->returnShownDirNodes(store);
             }
         }
-        return 0;
     }
 
-    ArchiveNode* findByPath(const QStringList & pieces, int index = 0)
+    /**
+     * Whether a view has asked for the entries of this folder, which means
+     * they might be visible.
+     */
+    bool wasShown() const
+    {
+        return m_wasShown;
+    }
+
+    void setWasShown()
+    {
+        m_wasShown = true;
+    }
+
+    /**
+     * The sort() call the entries were last sorted by, see
+     * ArchiveModel::m_sortGeneration.
+     */
+    uint sortGeneration() const
+    {
+        return m_sortGeneration;
+    }
+
+    void setSortGeneration(uint generation)
+    {
+        m_sortGeneration = generation;
+    }
+
+private:
+    /**
+     * Updates the counts and totals after @p entry has been added
+     * (@p sign is 1) or removed (@p sign is -1).
+     */
+    void childAdded(ArchiveNode *entry, int sign)
+    {
+        if (entry->isDir()) {
+            const ArchiveDirNode *dir = static_cast<ArchiveDirNode*>(entry);
+
+            m_dirCount += sign;
+            addToTotals(sign * dir->totalFileCount(), sign * dir->totalSize(), sign * dir->totalCompressedSize());
+        } else {
+            m_fileCount += sign;
+            addToTotals(sign, sign * entry->entry().size(), sign * entry->entry().compressedSize());
+        }
+    }
+
+    QList<ArchiveNode*> m_entries;
+    int m_dirCount;
+    int m_fileCount;
+    int m_totalFileCount;
+    qint64 m_totalSize;
+    qint64 m_totalCompressedSize;
+    uint m_sortGeneration;
+    bool m_wasShown;
+};
+
+void ArchiveNode::setEntry(const ArchiveEntry& entry)
+{
+    const qint64 oldSize = m_entry.size();
+    const qint64 oldCompressedSize = m_entry.compressedSize();
+
+    m_entry = CompactArchiveEntry(entry, m_entry.pathTrie());
+
+    // The totals of folders only count the files in them.
+    if (!isDir() && isAttached()) {
+        m_parent->addToTotals(0, m_entry.size() - oldSize, m_entry.compressedSize() - oldCompressedSize);
+    }
+}
+
+bool ArchiveNode::isAttached() const
+{
+    if (!m_parent) {
+        return false;
+    }
+
+    const QList<ArchiveNode*> &siblings = m_parent->entries();
+    return (m_row < siblings.size()) && (siblings.at(m_row) == this);
+}
+
+/**
+ * Changes made to an ArchiveTree which have not been shown yet.
+ */
+struct TreeChanges
+{
+    bool isEmpty() const
+    {
+        return newNodes.isEmpty() && updates.isEmpty();
+    }
+
+    void clear()
+    {
+        newNodes.clear();
+        updates.clear();
+    }
+
+    /**
+     * The new nodes, in the order they were created. Folders always come
+     * before their contents.
+     */
+    QVector<ArchiveNode*> newNodes;
+
+    /**
+     * The existing nodes which were listed again, with their new entries.
+     */
+    QVector<QPair<ArchiveNode*, ArchiveEntry> > updates;
+};
+
+/**
+ * Hands out the memory for objects of type T from blocks of NodesPerBlock
+ * objects. Released slots are reused, and the blocks are only freed when
+ * the pool is deleted.
+ */
+template <typename T>
+class NodePool
+{
+public:
+    NodePool()
+        : m_used(NodesPerBlock)
+        , m_freeSlots(0)
+    {
+    }
+
+    ~NodePool()
     {
-        if (index == pieces.count()) {
-            return 0;
+        foreach(void *block, m_blocks) {
+            ::operator delete(block);
         }
+    }
 
-        ArchiveNode *next = find(pieces.at(index));
+    void *allocate()
+    {
+        if (m_freeSlots) {
+            FreeSlot *slot = m_freeSlots;
+            m_freeSlots = slot->next;
+            return slot;
+        }
 
-        if (index == pieces.count() - 1) {
-            return next;
+        if (m_used == NodesPerBlock) {
+            m_blocks.append(::operator new(NodesPerBlock * sizeof(T)));
+            m_used = 0;
         }
-        if (next && next->isDir()) {
-            return static_cast<ArchiveDirNode*>(next)->findByPath(pieces, index + 1);
+
+        return static_cast<char*>(m_blocks.last()) + (m_used++ * sizeof(T));
+    }
+
+    void release(void *memory)
+    {
+        FreeSlot *slot = static_cast<FreeSlot*>(memory);
+        slot->next = m_freeSlots;
+        m_freeSlots = slot;
+    }
+
+private:
+    struct FreeSlot
+    {
+        FreeSlot *next;
+    };
+
+    QVector<void*> m_blocks;
+    int m_used; // in the last block
+    FreeSlot *m_freeSlots;
+};
+
+/**
+ * Creates and destroys the nodes of an ArchiveTree. Nodes are allocated
+ * from big blocks instead of one by one, and the memory of all of them is
+ * freed with the blocks when the arena is deleted.
+ *
+ * Like the tree, an arena must only be used by one thread at a time.
+ */
+class NodeArena
+{
+public:
+    NodeArena()
+        : m_pathTrie(0)
+    {
+    }
+
+    /**
+     * The trie the PathNode of the entries belongs to, from which the
+     * entries of the nodes created next build their file name.
+     */
+    void setPathTrie(const PathTrie *pathTrie)
+    {
+        m_pathTrie = pathTrie;
+    }
+
+    ArchiveNode *createNode(ArchiveDirNode *parent, const ArchiveEntry &entry, const QString &name)
+    {
+        return new (m_filePool.allocate()) ArchiveNode(parent, entry, name, m_pathTrie);
+    }
+
+    ArchiveDirNode *createDirNode(ArchiveDirNode *parent, const ArchiveEntry &entry, const QString &name)
+    {
+        return new (m_dirPool.allocate()) ArchiveDirNode(parent, entry, name, m_pathTrie);
+    }
+
+    /**
+     * Destroys @p node, but not its children. The totals of the folders
+     * are not touched: nodes are taken out of their parent, which updates
+     * them, before being destroyed.
+     */
+    void destroyNode(ArchiveNode *node)
+    {
+        if (node->isDir()) {
+            ArchiveDirNode *dir = static_cast<ArchiveDirNode*>(node);
+            dir->~ArchiveDirNode();
+            m_dirPool.release(dir);
+        } else {
+            node->~ArchiveNode();
+            m_filePool.release(node);
         }
-        return 0;
     }
 
-    void returnDirNodes(QList<ArchiveDirNode*> *store)
+    /**
+     * Destroys @p node and its children without releasing their memory,
+     * which is freed along with the arena.
+     */
+    static void destroySubtree(ArchiveNode *node)
     {
-        foreach(ArchiveNode *node, m_entries) {
-            if (node->isDir()) {
-                store->prepend(static_cast<ArchiveDirNode*>(node));
-                static_cast<ArchiveDirNode*>(node)->returnDirNodes(store);
+        if (node->isDir()) {
+            ArchiveDirNode *dir = static_cast<ArchiveDirNode*>(node);
+            foreach(ArchiveNode *child, dir->entries()) {
+                destroySubtree(child);
             }
+            dir->~ArchiveDirNode();
+        } else {
+            node->~ArchiveNode();
         }
     }
 
-    void clear()
+private:
+    const PathTrie *m_pathTrie;
+    NodePool<ArchiveNode> m_filePool;
+    NodePool<ArchiveDirNode> m_dirPool;
+};
+
+/**
+ * The nodes of an archive, indexed by the PathTrie node of their path and
+ * by their name in a SearchIndex.
+ *
+ * Adding an entry only creates and indexes its nodes, and records them in a
+ * TreeChanges. They become part of the tree once the changes are applied,
+ * which can be done later and from another thread: this is what TreeBuilder
+ * does while an archive is being listed.
+ */
+class ArchiveTree
+{
+public:
+    explicit ArchiveTree(PathTrie *pathTrie = 0)
+        : m_pathTrie(pathTrie)
+        , m_rootNode(m_arena.createDirNode(0, ArchiveEntry(), QString()))
+    {
+        m_arena.setPathTrie(pathTrie);
+    }
+
+    /**
+     * Destroys the nodes attached to the tree. This takes a while for big
+     * archives, but does not need any other object, so the tree can be
+     * deleted in another thread.
+     */
+    virtual ~ArchiveTree()
+    {
+        NodeArena::destroySubtree(m_rootNode);
+    }
+
+    ArchiveDirNode *rootNode() const
+    {
+        return m_rootNode;
+    }
+
+    ArchiveNode *node(PathTrie::Node pathNode) const
+    {
+        return m_nodesByPath.value(pathNode);
+    }
+
+    /**
+     * The names of all the nodes created so far. Nodes are not removed
+     * from it, so the ones it returns might not exist anymore.
+     */
+    const SearchIndex &searchIndex() const
+    {
+        return m_searchIndex;
+    }
+
+    void setPathTrie(PathTrie *pathTrie)
+    {
+        m_pathTrie = pathTrie;
+        m_arena.setPathTrie(pathTrie);
+    }
+
+    /**
+     * Creates the node of @p entry and of the folders containing it, or
+     * records the new entry of the node if it already exists.
+     */
+    void addEntry(const ArchiveEntry &entry, TreeChanges *changes);
+
+    /**
+     * Appends the new nodes in @p changes to their parents, with one
+     * insertion per parent, and updates the existing ones.
+     */
+    void applyChanges(TreeChanges *changes);
+
+    /**
+     * Removes the entries of @p parent from @p first to @p last, and
+     * destroys them along with their children. Like
+     * ArchiveDirNode::takeEntries(), this leaves the rows of the following
+     * entries alone.
+     */
+    void removeNodes(ArchiveDirNode *parent, int first, int last);
+
+    /**
+     * Destroys the new nodes in @p changes instead of applying them.
+     */
+    void discardChanges(TreeChanges *changes);
+
+protected:
+    /**
+     * Called before and after the nodes from @p first to @p last are
+     * appended to the entries of @p parent.
+     */
+    virtual void aboutToInsertNodes(ArchiveDirNode *parent, int first, int last)
+    {
+        Q_UNUSED(parent)
+        Q_UNUSED(first)
+        Q_UNUSED(last)
+    }
+
+    virtual void nodesInserted()
+    {
+    }
+
+    /**
+     * Called once applyChanges() is done.
+     */
+    virtual void changesApplied()
+    {
+    }
+
+    /**
+     * Called after the entry of @p node has been changed.
+     */
+    virtual void nodeUpdated(ArchiveNode *node)
     {
-        qDeleteAll(m_entries);
-        m_entries.clear();
+        Q_UNUSED(node)
     }
 
 private:
-    QList<ArchiveNode*> m_entries;
+    /**
+     * Strips file names that start with './'.
+     *
+     * For more information, see bug 194241.
+     *
+     * @param fileName The file name that will be stripped.
+     *
+     * @return @p fileName without the leading './'
+     */
+    static QString cleanFileName(const QString& fileName);
+
+    /**
+     * Returns the node of the folder containing @p pathNode, creating the
+     * missing ArchiveDirNodes in the process.
+     */
+    ArchiveDirNode *parentFor(PathTrie::Node pathNode, TreeChanges *changes);
+
+    /**
+     * Removes @p node and its children from the index.
+     */
+    void forgetNode(ArchiveNode *node);
+
+    /**
+     * Destroys @p node and its children, releasing their memory.
+     */
+    void destroyNode(ArchiveNode *node);
+
+    PathTrie *m_pathTrie;
+    NodeArena m_arena;
+    ArchiveDirNode *m_rootNode;
+    QHash<PathTrie::Node, ArchiveNode*> m_nodesByPath;
+    SearchIndex m_searchIndex;
+};
+
+/**
+ * The tree shown by ArchiveModel, which tells the views about the nodes
+ * added to it.
+ */
+class ArchiveModel::Tree : public ArchiveTree
+{
+public:
+    explicit Tree(ArchiveModel *model)
+        : m_model(model)
+    {
+    }
+
+protected:
+    // New nodes only show up in the results of a filter when it is applied
+    // again.
+    virtual void aboutToInsertNodes(ArchiveDirNode *parent, int first, int last)
+    {
+        if (!m_model->isFiltering()) {
+            m_model->beginInsertRows(m_model->indexForNode(parent), first, last);
+
+            // The views do not ask to fetch the entries of a folder they
+            // already show, so it has to be sorted again right away. While
+            // an archive is being listed, this would sort the same folders
+            // over and over: they are sorted once it is done instead.
+            if (!m_model->isLoading() && ((parent == rootNode()) || parent->wasShown())) {
+                m_model->m_unsortedDirNodes.append(parent);
+            }
+        }
+    }
+
+    virtual void nodesInserted()
+    {
+        if (!m_model->isFiltering()) {
+            m_model->endInsertRows();
+        }
+    }
+
+    virtual void changesApplied()
+    {
+        m_model->sortUnsortedDirNodes();
+    }
+
+    virtual void nodeUpdated(ArchiveNode *node)
+    {
+        const QModelIndex index = m_model->indexForNode(node);
+        if (index.isValid()) {
+            emit m_model->dataChanged(index, index.sibling(index.row(), m_model->columnCount() - 1));
+        }
+    }
+
+private:
+    ArchiveModel *m_model;
+};
+
+/**
+ * Adds the entries of a ListJob to an ArchiveTree in a thread of the global
+ * QThreadPool, one batch after the other as they arrive.
+ *
+ * The nodes are only recorded by the worker thread; publishChanges() makes
+ * them part of the tree from the GUI thread. This way the GUI thread does
+ * not spend any time building the nodes, while the views can still show
+ * them before listing is over.
+ */
+class TreeBuilder : public QRunnable
+{
+public:
+    explicit TreeBuilder(ArchiveTree *tree)
+        : m_tree(tree)
+        , m_isRunning(false)
+        , m_isCancelled(false)
+    {
+        setAutoDelete(false);
+    }
+
+    /**
+     * Drops the queued entries and destroys the nodes which have not been
+     * published. Only the batch being added, if any, is waited for.
+     */
+    ~TreeBuilder()
+    {
+        {
+            QMutexLocker locker(&m_queueMutex);
+            m_batches.clear();
+            m_isCancelled = true;
+        }
+
+        waitForDone();
+        m_tree->discardChanges(&m_changes);
+    }
+
+    /**
+     * Queues @p entries to be added to the tree.
+     */
+    void addEntries(const QVector<ArchiveEntry> &entries)
+    {
+        QMutexLocker locker(&m_queueMutex);
+
+        m_batches.enqueue(entries);
+
+        if (!m_isRunning) {
+            m_isRunning = true;
+            QThreadPool::globalInstance()->start(this);
+        }
+    }
+
+    /**
+     * Blocks until all the queued entries have been added to the tree.
+     */
+    void waitForDone()
+    {
+        QMutexLocker locker(&m_queueMutex);
+
+        while (m_isRunning) {
+            m_batchesDone.wait(&m_queueMutex);
+        }
+    }
+
+    /**
+     * Applies the changes made to the tree so far. Must be called from the
+     * GUI thread.
+     */
+    void publishChanges()
+    {
+        QMutexLocker locker(&m_treeMutex);
+
+        if (!m_changes.isEmpty()) {
+            m_tree->applyChanges(&m_changes);
+        }
+    }
+
+    /**
+     * The mutex held while the worker thread changes the tree. The GUI
+     * thread must hold it to look nodes up while entries are being added.
+     */
+    QMutex *treeMutex()
+    {
+        return &m_treeMutex;
+    }
+
+    virtual void run()
+    {
+        forever {
+            QVector<ArchiveEntry> entries;
+
+            {
+                QMutexLocker locker(&m_queueMutex);
+
+                if (m_isCancelled || m_batches.isEmpty()) {
+                    m_isRunning = false;
+                    m_batchesDone.wakeAll();
+                    return;
+                }
+
+                entries = m_batches.dequeue();
+            }
+
+            // The GUI thread only changes the nodes while applying the
+            // changes, so it cannot do it in the middle of a batch.
+            QMutexLocker locker(&m_treeMutex);
+
+            foreach(const ArchiveEntry &entry, entries) {
+                m_tree->addEntry(entry, &m_changes);
+            }
+        }
+    }
+
+private:
+    ArchiveTree *m_tree;
+    TreeChanges m_changes;
+    QMutex m_treeMutex;
+
+    QQueue<QVector<ArchiveEntry> > m_batches;
+    bool m_isRunning;
+    bool m_isCancelled; // set when the builder is deleted
+    QMutex m_queueMutex;
+    QWaitCondition m_batchesDone;
 };
 
 /**
- * Helper functor used by qStableSort.
+ * Returns a key of @p text which compares like
+ * KStringHandler::naturalCompare() does, but with a plain string comparison:
+ * case is ignored and numbers are compared by value, so that "file9" comes
+ * before "File10".
+ *
+ * Each run of digits is replaced by a '0', the number of digits once the
+ * leading zeros are stripped, and these digits. The '0' sorts numbers
+ * against the other characters like digits do.
+ */
+static QString naturalSortKey(const QString &text)
+{
+    QString key;
+    key.reserve(text.size() + 8);
+
+    const int size = text.size();
+    int i = 0;
+    while (i < size) {
+        if (!text.at(i).isDigit()) {
+            key.append(text.at(i).toLower());
+            ++i;
+            continue;
+        }
+
+        int start = i;
+        while ((i < size) && text.at(i).isDigit()) {
+            ++i;
+        }
+        while ((start < i - 1) && (text.at(start) == QLatin1Char('0'))) {
+            ++start;
+        }
+
+        key.append(QLatin1Char('0'));
+        key.append(QChar(ushort(qMin(i - start, 0xffff))));
+        key.append(text.constData() + start, i - start);
+    }
+
+    return key;
+}
+
+/**
+ * Sorts the entries of folders by one of their properties.
+ *
+ * Folders always come before files. The property of each entry is read
+ * once into a SortKey, so comparisons neither go through QVariants nor
+ * truncate sizes, and file names are turned into their naturalSortKey()
+ * once per node instead of once per comparison. Very big folders are sorted by two threads.
  *
- * It always sorts folders before files.
+ * The sorter can also be passed to QtConcurrent::blockingMap() to sort
+ * several folders at a time, and sort lists of nodes from different
+ * folders, in which case file names are compared with their paths.
  *
  * @internal
  */
 class ArchiveModelSorter
 {
 public:
+    struct SortKey
+    {
+        ArchiveNode *node;
+        bool isDir;
+        qint64 number;
+        QString text;
+    };
+
     ArchiveModelSorter(int column, Qt::SortOrder order)
         : m_sortColumn(column)
         , m_sortOrder(order)
+        , m_isNumeric((column == Size) || (column == CompressedSize) || (column == Timestamp))
     {
     }
 
-    virtual ~ArchiveModelSorter()
+    void operator()(ArchiveDirNode *dir) const
     {
+        sort(dir);
     }
 
-    inline bool operator()(const QPair<ArchiveNode*, int> &left, const QPair<ArchiveNode*, int> &right) const
+    inline bool operator()(const SortKey &left, const SortKey &right) const
     {
+        // #234373: sort folders before files
+        if (left.isDir != right.isDir) {
+            return left.isDir;
+        }
+
         if (m_sortOrder == Qt::AscendingOrder) {
             return lessThan(left, right);
         } else {
-            return !lessThan(left, right);
+            return lessThan(right, left);
         }
     }
 
-protected:
-    bool lessThan(const QPair<ArchiveNode*, int> &left, const QPair<ArchiveNode*, int> &right) const
+    void sort(ArchiveDirNode *dir) const
     {
-        const ArchiveNode * const leftNode = left.first;
-        const ArchiveNode * const rightNode = right.first;
+        const QVector<SortKey> keys = sortedKeys(dir->entries(), false);
 
-        // #234373: sort folders before files
-        if ((leftNode->isDir()) && (!rightNode->isDir())) {
-            return (m_sortOrder == Qt::AscendingOrder);
-        } else if ((!leftNode->isDir()) && (rightNode->isDir())) {
-            return !(m_sortOrder == Qt::AscendingOrder);
+        for (int i = 0; i < keys.size(); ++i) {
+            dir->setEntryAt(i, keys.at(i).node);
+        }
+    }
+
+    void sort(QList<ArchiveNode*> *nodes) const
+    {
+        const QVector<SortKey> keys = sortedKeys(*nodes, true);
+
+        for (int i = 0; i < keys.size(); ++i) {
+            (*nodes)[i] = keys.at(i).node;
+        }
+    }
+
+private:
+    QVector<SortKey> sortedKeys(const QList<ArchiveNode*> &nodes, bool byPath) const
+    {
+        QVector<SortKey> keys(nodes.size());
+        for (int i = 0; i < nodes.size(); ++i) {
+            keys[i] = sortKey(nodes.at(i), byPath);
+        }
+
+        // Big lists are sorted in two halves at the same time.
+        if (keys.size() >= BigFolderSize) {
+            SortKey * const middle = keys.begin() + keys.size() / 2;
+
+            QFuture<void> firstHalf = QtConcurrent::run(&ArchiveModelSorter::sortRange, keys.begin(), middle, *this);
+            sortRange(middle, keys.end(), *this);
+            firstHalf.waitForFinished();
+
+            std::inplace_merge(keys.begin(), middle, keys.end(), *this);
+        } else {
+            sortRange(keys.begin(), keys.end(), *this);
         }
 
-        const QVariant &leftEntry = leftNode->entry()[m_sortColumn];
-        const QVariant &rightEntry = rightNode->entry()[m_sortColumn];
+        return keys;
+    }
+
+    static void sortRange(SortKey *begin, SortKey *end, const ArchiveModelSorter &sorter)
+    {
+        std::stable_sort(begin, end, sorter);
+    }
+
+    SortKey sortKey(ArchiveNode *node, bool byPath) const
+    {
+        SortKey key;
+        key.node = node;
+        key.isDir = node->isDir();
+        key.number = 0;
 
         switch (m_sortColumn) {
         case FileName:
-            return leftNode->name() < rightNode->name();
+            key.text = naturalSortKey(byPath ? node->entry().fileName() : node->name());
+            break;
         case Size:
+            key.number = node->entry().size();
+            break;
         case CompressedSize:
-            return leftEntry.toInt() < rightEntry.toInt();
+            key.number = node->entry().compressedSize();
+            break;
+        case Timestamp: {
+            const QDateTime timestamp = node->entry().timestamp();
+            key.number = timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : std::numeric_limits<qint64>::min();
+            break;
+        }
         default:
-            return leftEntry.toString() < rightEntry.toString();
+            key.text = node->entry().value(m_sortColumn).toString();
+            break;
         }
 
-        // We should not get here.
-        Q_ASSERT(false);
-        return false;
+        return key;
+    }
+
+    bool lessThan(const SortKey &left, const SortKey &right) const
+    {
+        if (m_isNumeric) {
+            return left.number < right.number;
+        }
+
+        return left.text < right.text;
     }
 
-private:
     int m_sortColumn;
     Qt::SortOrder m_sortOrder;
+    bool m_isNumeric;
 };
 
-int ArchiveNode::row() const
+/**
+ * Returns the nodes in @p nodes which are not in a folder among them.
+ */
+template <typename Node>
+static QList<Node*> outermost(const QSet<Node*> &nodes)
 {
-    if (parent()) {
-        return parent()->entries().indexOf(const_cast<ArchiveNode*>(this));
+    QList<Node*> outermostNodes;
+
+    foreach(Node *node, nodes) {
+        bool isInFolder = false;
+        for (Node *ancestor = node->parent(); ancestor; ancestor = ancestor->parent()) {
+            if (nodes.contains(ancestor)) {
+                isInFolder = true;
+                break;
+            }
+        }
+
+        if (!isInFolder) {
+            outermostNodes << node;
+        }
     }
-    return 0;
+
+    return outermostNodes;
+}
+
+static void deleteTree(ArchiveTree *tree)
+{
+    delete tree;
 }
 
 ArchiveModel::ArchiveModel(const QString &dbusPathName, QObject *parent)
     : QAbstractItemModel(parent)
-    , m_rootNode(new ArchiveDirNode(0, ArchiveEntry()))
+    , m_tree(new Tree(this))
+    , m_treeBuilder(0)
+    , m_publishTimer(new QTimer(this))
+    , m_sortColumn(-1)
+    , m_sortOrder(Qt::AscendingOrder)
+    , m_sortGeneration(0)
     , m_dbusPathName(dbusPathName)
 {
+    m_publishTimer->setInterval(PublishInterval);
+    connect(m_publishTimer, SIGNAL(timeout()),
+            this, SLOT(slotPublishEntries()));
 }
 
 ArchiveModel::~ArchiveModel()
 {
-    delete m_rootNode;
-    m_rootNode = 0;
+    delete m_treeBuilder;
+    m_treeBuilder = 0;
+
+    // The trees being deleted in other threads need the code of this
+    // library.
+    m_treeTeardowns.waitForFinished();
+
+    delete m_tree;
+    m_tree = 0;
 }
 
 QVariant ArchiveModel::data(const QModelIndex &index, int role) const
@@ -304,7 +1103,8 @@ QVariant ArchiveModel::data(const QModelIndex &index, int role) const
             int columnId = m_showColumns.at(index.column());
             switch (columnId) {
             case FileName:
-                return node->name();
+                // The results of a filter come from different folders.
+                return isFiltering() ? node->entry().fileName() : node->name();
             case Size:
                 if (node->isDir()) {
                     int dirs;
@@ -353,12 +1153,12 @@ QVariant ArchiveModel::data(const QModelIndex &index, int role) const
         }
         case Qt::DecorationRole:
             if (index.column() == 0) {
-                return node->icon();
+                return iconForNode(node);
             }
             return QVariant();
         case Qt::FontRole: {
             QFont f;
-            f.setItalic(node->entry()[ IsPasswordProtected ].toBool());
+            f.setItalic(node->entry().isPasswordProtected());
             return f;
         }
         default:
@@ -427,7 +1227,11 @@ QVariant ArchiveModel::headerData(int section, Qt::Orientation, int role) const
 QModelIndex ArchiveModel::index(int row, int column, const QModelIndex &parent) const
 {
     if (hasIndex(row, column, parent)) {
-        ArchiveDirNode *parentNode = parent.isValid() ? static_cast<ArchiveDirNode*>(parent.internalPointer()) : m_rootNode;
+        if (isFiltering()) {
+            return createIndex(row, column, m_filterResults.at(row));
+        }
+
+        ArchiveDirNode *parentNode = parent.isValid() ? static_cast<ArchiveDirNode*>(parent.internalPointer()) : m_tree->rootNode();
 
         Q_ASSERT(parentNode->isDir());
 
@@ -442,10 +1246,10 @@ QModelIndex ArchiveModel::index(int row, int column, const QModelIndex &parent)
 
 QModelIndex ArchiveModel::parent(const QModelIndex &index) const
 {
-    if (index.isValid()) {
+    if (index.isValid() && !isFiltering()) {
         ArchiveNode *item = static_cast<ArchiveNode*>(index.internalPointer());
         Q_ASSERT(item);
-        if (item->parent() && (item->parent() != m_rootNode)) {
+        if (item->parent() && (item->parent() != m_tree->rootNode())) {
             return createIndex(item->parent()->row(), 0, item->parent());
         }
     }
@@ -457,11 +1261,21 @@ ArchiveEntry ArchiveModel::entryForIndex(const QModelIndex &index)
     if (index.isValid()) {
         ArchiveNode *item = static_cast<ArchiveNode*>(index.internalPointer());
         Q_ASSERT(item);
-        return item->entry();
+        return item->entry().toArchiveEntry();
     }
     return ArchiveEntry();
 }
 
+QString ArchiveModel::nameForIndex(const QModelIndex &index) const
+{
+    if (index.isValid()) {
+        ArchiveNode *item = static_cast<ArchiveNode*>(index.internalPointer());
+        Q_ASSERT(item);
+        return item->name();
+    }
+    return QString();
+}
+
 int ArchiveModel::childCount(const QModelIndex &index, int &dirs, int &files) const
 {
     if (index.isValid()) {
@@ -469,25 +1283,99 @@ int ArchiveModel::childCount(const QModelIndex &index, int &dirs, int &files) co
         ArchiveNode *item = static_cast<ArchiveNode*>(index.internalPointer());
         Q_ASSERT(item);
         if (item->isDir()) {
-            const QList<ArchiveNode*> entries = static_cast<ArchiveDirNode*>(item)->entries();
-            foreach(const ArchiveNode *node, entries) {
-                if (node->isDir()) {
-                    dirs++;
-                } else {
-                    files++;
-                }
+            const ArchiveDirNode *dir = static_cast<ArchiveDirNode*>(item);
+            dirs = dir->dirCount();
+            files = dir->fileCount();
+            return dir->entries().count();
+        }
+        return 0;
+    }
+    return -1;
+}
+
+void ArchiveModel::totals(const QModelIndexList &indexes, int &files, qint64 &size, qint64 &compressedSize) const
+{
+    files = 0;
+    size = compressedSize = 0;
+
+    foreach(const ArchiveNode *node, outermostNodes(indexes)) {
+        if (node->isDir()) {
+            const ArchiveDirNode *dir = static_cast<const ArchiveDirNode*>(node);
+            files += dir->totalFileCount();
+            size += dir->totalSize();
+            compressedSize += dir->totalCompressedSize();
+        } else {
+            ++files;
+            size += node->entry().size();
+            compressedSize += node->entry().compressedSize();
+        }
+    }
+}
+
+QList<QVariant> ArchiveModel::internalIdsWithChildren(const QModelIndexList &indexes) const
+{
+    QList<QVariant> ids;
+
+    QList<const ArchiveNode*> nodes = outermostNodes(indexes);
+    while (!nodes.isEmpty()) {
+        const ArchiveNode *node = nodes.takeLast();
+
+        const QVariant id = node->entry().value(InternalID);
+        if (id.isValid()) {
+            ids << id;
+        }
+
+        if (node->isDir()) {
+            foreach(const ArchiveNode *child, static_cast<const ArchiveDirNode*>(node)->entries()) {
+                nodes << child;
+            }
+        }
+    }
+
+    return ids;
+}
+
+QList<QVariant> ArchiveModel::internalIdsForExtraction(const QModelIndexList &indexes) const
+{
+    QList<QVariant> ids;
+
+    QList<const ArchiveNode*> nodes = outermostNodes(indexes);
+    while (!nodes.isEmpty()) {
+        const ArchiveNode *node = nodes.takeLast();
+
+        const QVariant id = node->entry().value(InternalID);
+        if (id.isValid()) {
+            ids << id;
+        } else if (node->isDir()) {
+            // The folders created for the paths of the entries are unknown
+            // to the backends.
+            foreach(const ArchiveNode *child, static_cast<const ArchiveDirNode*>(node)->entries()) {
+                nodes << child;
             }
-            return entries.count();
         }
-        return 0;
     }
-    return -1;
+
+    return ids;
+}
+
+QList<const ArchiveNode*> ArchiveModel::outermostNodes(const QModelIndexList &indexes) const
+{
+    QSet<const ArchiveNode*> nodes;
+    foreach(const QModelIndex &index, indexes) {
+        nodes.insert(index.isValid() ? static_cast<ArchiveNode*>(index.internalPointer()) : m_tree->rootNode());
+    }
+
+    return outermost(nodes);
 }
 
 int ArchiveModel::rowCount(const QModelIndex &parent) const
 {
+    if (isFiltering()) {
+        return parent.isValid() ? 0 : m_filterResults.count();
+    }
+
     if (parent.column() <= 0) {
-        ArchiveNode *parentNode = parent.isValid() ? static_cast<ArchiveNode*>(parent.internalPointer()) : m_rootNode;
+        ArchiveNode *parentNode = parent.isValid() ? static_cast<ArchiveNode*>(parent.internalPointer()) : m_tree->rootNode();
 
         if (parentNode && parentNode->isDir()) {
             return static_cast<ArchiveDirNode*>(parentNode)->entries().count();
@@ -500,7 +1388,7 @@ int ArchiveModel::columnCount(const QModelIndex &parent) const
 {
     return m_showColumns.size();
     if (parent.isValid()) {
-        return static_cast<ArchiveNode*>(parent.internalPointer())->entry().size();
+        return static_cast<ArchiveNode*>(parent.internalPointer())->entry().toArchiveEntry().size();
     }
 }
 
@@ -510,43 +1398,159 @@ void ArchiveModel::sort(int column, Qt::SortOrder order)
         return;
     }
 
-    emit layoutAboutToBeChanged();
+    m_sortColumn = m_showColumns.at(column);
+    m_sortOrder = order;
+    ++m_sortGeneration;
 
+    // The folders are sorted by fetchMore() once the tree is shown again.
+    if (isFiltering()) {
+        emit layoutAboutToBeChanged();
+
+        ArchiveModelSorter(m_sortColumn, m_sortOrder).sort(&m_filterResults);
+        updateFilterRows();
+        updatePersistentIndexes();
+
+        emit layoutChanged();
+        return;
+    }
+
+    // Only the folders which may be visible are sorted now. fetchMore()
+    // sorts the others when they are shown.
     QList<ArchiveDirNode*> dirNodes;
-    m_rootNode->returnDirNodes(&dirNodes);
-    dirNodes.append(m_rootNode);
+    m_tree->rootNode()->returnShownDirNodes(&dirNodes);
+
+    emit layoutAboutToBeChanged();
+
+    sortDirNodes(dirNodes);
+    updatePersistentIndexes();
 
-    const ArchiveModelSorter modelSorter(m_showColumns.at(column), order);
+    emit layoutChanged();
+}
+
+void ArchiveModel::sortDirNodes(const QList<ArchiveDirNode*> &dirNodes)
+{
+    const ArchiveModelSorter modelSorter(m_sortColumn, m_sortOrder);
 
-    foreach(ArchiveDirNode* dir, dirNodes) {
-        QVector < QPair<ArchiveNode*,int> > sorting(dir->entries().count());
-        for (int i = 0; i < dir->entries().count(); ++i) {
-            ArchiveNode *item = dir->entries().at(i);
-            sorting[i].first = item;
-            sorting[i].second = i;
+    QList<ArchiveDirNode*> smallDirNodes;
+    foreach(ArchiveDirNode *dir, dirNodes) {
+        dir->setSortGeneration(m_sortGeneration);
+
+        // Big folders are already sorted by several threads.
+        if (dir->entries().count() >= BigFolderSize) {
+            modelSorter.sort(dir);
+        } else {
+            smallDirNodes.append(dir);
         }
+    }
+
+    QtConcurrent::blockingMap(smallDirNodes, modelSorter);
+}
+
+void ArchiveModel::sortShownDirNodes()
+{
+    if (m_sortColumn == -1) {
+        return;
+    }
 
-        std::stable_sort(sorting.begin(), sorting.end(), modelSorter);
+    QList<ArchiveDirNode*> dirNodes;
+    m_tree->rootNode()->returnShownDirNodes(&dirNodes);
 
-        QModelIndexList fromIndexes;
-        QModelIndexList toIndexes;
-        for (int r = 0; r < sorting.count(); ++r) {
-            ArchiveNode *item = sorting.at(r).first;
-            toIndexes.append(createIndex(r, 0, item));
-            fromIndexes.append(createIndex(sorting.at(r).second, 0, sorting.at(r).first));
-            dir->setEntryAt(r, sorting.at(r).first);
+    QList<ArchiveDirNode*> unsortedDirNodes;
+    foreach(ArchiveDirNode *dir, dirNodes) {
+        if (dir->sortGeneration() != m_sortGeneration) {
+            unsortedDirNodes.append(dir);
         }
+    }
+
+    if (unsortedDirNodes.isEmpty()) {
+        return;
+    }
+
+    emit layoutAboutToBeChanged();
+
+    sortDirNodes(unsortedDirNodes);
+    updatePersistentIndexes();
+
+    emit layoutChanged();
+}
 
-        changePersistentIndexList(fromIndexes, toIndexes);
+void ArchiveModel::sortUnsortedDirNodes()
+{
+    const QList<ArchiveDirNode*> dirNodes = m_unsortedDirNodes;
+    m_unsortedDirNodes.clear();
 
-        emit dataChanged(
-            index(0, 0, indexForNode(dir)),
-            index(dir->entries().size() - 1, 0, indexForNode(dir)));
+    if ((m_sortColumn == -1) || dirNodes.isEmpty()) {
+        return;
     }
 
+    emit layoutAboutToBeChanged();
+
+    sortDirNodes(dirNodes);
+    updatePersistentIndexes();
+
     emit layoutChanged();
 }
 
+bool ArchiveModel::canFetchMore(const QModelIndex &parent) const
+{
+    if (isFiltering()) {
+        return false;
+    }
+
+    ArchiveNode *node = parent.isValid() ? static_cast<ArchiveNode*>(parent.internalPointer()) : m_tree->rootNode();
+    if (!node->isDir()) {
+        return false;
+    }
+
+    // Views ask this before laying out the entries of a folder, and call
+    // fetchMore() if it returns true.
+    const ArchiveDirNode *dir = static_cast<ArchiveDirNode*>(node);
+    if (!dir->wasShown()) {
+        return true;
+    }
+
+    return (m_sortColumn != -1) && (dir->sortGeneration() != m_sortGeneration);
+}
+
+void ArchiveModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+
+    ArchiveDirNode *dir = parent.isValid() ? static_cast<ArchiveDirNode*>(parent.internalPointer()) : m_tree->rootNode();
+    dir->setWasShown();
+
+    if ((m_sortColumn == -1) || (dir->sortGeneration() == m_sortGeneration)) {
+        return;
+    }
+
+    ArchiveModelSorter(m_sortColumn, m_sortOrder).sort(dir);
+    dir->setSortGeneration(m_sortGeneration);
+
+    // The entries have not been laid out by any view yet, so only
+    // persistent indexes can refer to them.
+    updatePersistentIndexes();
+}
+
+void ArchiveModel::updatePersistentIndexes()
+{
+    QModelIndexList fromIndexes;
+    QModelIndexList toIndexes;
+
+    foreach(const QModelIndex &index, persistentIndexList()) {
+        ArchiveNode *node = static_cast<ArchiveNode*>(index.internalPointer());
+        const int row = rowForNode(node);
+
+        if (row != index.row()) {
+            fromIndexes.append(index);
+            toIndexes.append(createIndex(row, index.column(), node));
+        }
+    }
+
+    changePersistentIndexList(fromIndexes, toIndexes);
+}
+
 Qt::DropActions ArchiveModel::supportedDropActions() const
 {
     return Qt::CopyAction | Qt::MoveAction;
@@ -621,7 +1625,7 @@ bool ArchiveModel::dropMimeData(const QMimeData * data, Qt::DropAction action, i
 }
 
 // For a rationale, see bugs #194241 and #241967
-QString ArchiveModel::cleanFileName(const QString& fileName)
+QString ArchiveTree::cleanFileName(const QString& fileName)
 {
     if ((fileName == QLatin1String("/")) ||
         (fileName == QLatin1String("."))) { // "." is present in ISO files
@@ -633,66 +1637,71 @@ QString ArchiveModel::cleanFileName(const QString& fileName)
     return fileName;
 }
 
-ArchiveDirNode* ArchiveModel::parentFor(const ArchiveEntry& entry)
+ArchiveDirNode *ArchiveTree::parentFor(PathTrie::Node pathNode, TreeChanges *changes)
 {
-    QStringList pieces = entry[ FileName ].toString().split(QLatin1Char( '/' ), QString::SkipEmptyParts);
-    if (pieces.isEmpty()) {
-        return NULL;
+    const PathTrie::Node parentPath = m_pathTrie->parent(pathNode);
+
+    if (parentPath == PathTrie::RootNode) {
+        return m_rootNode;
     }
-    pieces.removeLast();
 
-    if (s_previousMatch) {
-        //the number of path elements must be the same for the shortcut
-        //to work
-        if (s_previousPieces->count() == pieces.count()) {
-            bool equal = true;
+    ArchiveNode *node = m_nodesByPath.value(parentPath);
+    if (node && node->isDir()) {
+        return static_cast<ArchiveDirNode*>(node);
+    }
 
-            //make sure all the pieces match up
-            for (int i = 0; i < s_previousPieces->count(); ++i) {
-                if (s_previousPieces->at(i) != pieces.at(i)) {
-                    equal = false;
-                    break;
-                }
-            }
+    ArchiveDirNode *parent = parentFor(parentPath, changes);
+    const QString name = m_pathTrie->name(parentPath);
 
-            //if match return it
-            if (equal) {
-                return static_cast<ArchiveDirNode*>(s_previousMatch);
-            }
-        }
+    ArchiveEntry e;
+    if (node) {
+        //Maybe we have both a file and a directory of the same name
+        // We avoid removing previous entries unless necessary
+        e = node->entry().toArchiveEntry();
+    } else {
+        e[ FileName ] = (parent == m_rootNode) ?
+                        name : parent->entry()[ FileName ].toString() + QLatin1Char( '/' ) + name;
+        e[ IsDirectory ] = true;
+        e[ PathNode ] = parentPath;
     }
 
-    ArchiveDirNode *parent = m_rootNode;
+    ArchiveDirNode *dirNode = m_arena.createDirNode(parent, e, name);
+    m_nodesByPath.insert(parentPath, dirNode);
+    m_searchIndex.insert(parentPath, name);
+    changes->newNodes.append(dirNode);
 
-    foreach(const QString &piece, pieces) {
-        ArchiveNode *node = parent->find(piece);
-        if (!node) {
-            ArchiveEntry e;
-            e[ FileName ] = (parent == m_rootNode) ?
-                            piece : parent->entry()[ FileName ].toString() + QLatin1Char( '/' ) + piece;
-            e[ IsDirectory ] = true;
-            node = new ArchiveDirNode(parent, e);
-            insertNode(node);
-        }
-        if (!node->isDir()) {
-            ArchiveEntry e(node->entry());
-            node = new ArchiveDirNode(parent, e);
-            //Maybe we have both a file and a directory of the same name
-            // We avoid removing previous entries unless necessary
-            insertNode(node);
-        }
-        parent = static_cast<ArchiveDirNode*>(node);
+    return dirNode;
+}
+
+QPixmap ArchiveModel::iconForNode(const ArchiveNode *node) const
+{
+    // The MIME type is looked up by name only, which is fast, and many
+    // files share it, so the icons are cached by MIME type. Extensions are
+    // not enough: e.g. CMakeLists.txt and notes.txt have different ones.
+    const KMimeType::Ptr mimeType = node->isDir() ?
+                                    KMimeType::mimeType(QLatin1String("inode/directory")) :
+                                    KMimeType::findByPath(node->name(), 0, true);
+
+    QHash<QString, QPixmap>::const_iterator it = m_iconCache.constFind(mimeType->name());
+    if (it != m_iconCache.constEnd()) {
+        return it.value();
     }
 
-    s_previousMatch = parent;
-    *s_previousPieces = pieces;
+    const QPixmap icon = KIconLoader::global()->loadMimeTypeIcon(mimeType->iconName(), KIconLoader::Small);
+    m_iconCache.insert(mimeType->name(), icon);
 
-    return parent;
+    return icon;
 }
+
 QModelIndex ArchiveModel::indexForNode(ArchiveNode *node)
 {
     Q_ASSERT(node);
-    if (node != m_rootNode) {
+    if (isFiltering()) {
+        const int row = m_filterRows.value(node, -1);
+        return (row == -1) ? QModelIndex() : createIndex(row, 0, node);
+    }
+
+    if (node != m_tree->rootNode()) {
         Q_ASSERT(node->parent());
         Q_ASSERT(node->parent()->isDir());
         return createIndex(node->row(), 0, node);
@@ -700,27 +1709,174 @@ QModelIndex ArchiveModel::indexForNode(ArchiveNode *node)
     return QModelIndex();
 }
 
-void ArchiveModel::slotEntryRemoved(const QString & path)
+int ArchiveModel::rowForNode(ArchiveNode *node) const
 {
-    kDebug() << "Removed node at path " << path;
+    return isFiltering() ? m_filterRows.value(node, -1) : node->row();
+}
+
+bool ArchiveModel::isFiltering() const
+{
+    return !m_filter.isEmpty();
+}
 
-    const QString entryFileName(cleanFileName(path));
-    if (entryFileName.isEmpty()) {
+QString ArchiveModel::filter() const
+{
+    return m_filter;
+}
+
+void ArchiveModel::setFilter(const QString &pattern)
+{
+    if (pattern == m_filter) {
         return;
     }
 
-    ArchiveNode *entry = m_rootNode->findByPath(entryFileName.split(QLatin1Char( '/' ), QString::SkipEmptyParts));
-    if (entry) {
-        ArchiveDirNode *parent = entry->parent();
-        //QModelIndex index = indexForNode(entry);
+    beginResetModel();
+    m_filter = pattern;
+    applyFilter();
+    endResetModel();
+}
+
+void ArchiveModel::applyFilter()
+{
+    m_filterResults.clear();
+
+    if (isFiltering()) {
+        // While an archive is being listed, the worker thread adds nodes
+        // to the tree.
+        QMutexLocker locker(m_treeBuilder ? m_treeBuilder->treeMutex() : 0);
+
+        // Only the names are indexed. A pattern with a path is looked up by
+        // the text after its last slash, which must start the name, and the
+        // text before that must end the path of the folder. Wildcards may
+        // match slashes, so then every full path has to be checked.
+        const int slash = m_filter.lastIndexOf(QLatin1Char('/'));
+        const PathTrie *pathTrie = m_archive ? m_archive->pathTrie() : 0;
+        const bool hasPath = (slash != -1) && pathTrie;
+        const bool hasWildcards = m_filter.contains(QRegExp(QLatin1String("[*?[]")));
+        const QRegExp wildcard(m_filter, Qt::CaseInsensitive, QRegExp::Wildcard);
+
+        QString namePattern = m_filter;
+        if (hasPath) {
+            namePattern = hasWildcards ? QString(QLatin1String("*")) : m_filter.mid(slash + 1);
+            if (namePattern.isEmpty()) {
+                namePattern = QLatin1String("*");
+            }
+        }
+
+        foreach(PathTrie::Node pathNode, m_tree->searchIndex().find(namePattern)) {
+            // The index also has the nodes which have been removed, and
+            // those which have not been published yet.
+            ArchiveNode *node = m_tree->node(pathNode);
+            if (!node || !node->isAttached()) {
+                continue;
+            }
+
+            if (hasPath) {
+                const QString path = pathTrie->path(pathNode);
+                const int start = path.lastIndexOf(QLatin1Char('/')) - slash;
+                const bool matches = hasWildcards ?
+                                     wildcard.exactMatch(path) :
+                                     (start >= 0) && (QString::compare(path.mid(start, m_filter.length()), m_filter, Qt::CaseInsensitive) == 0);
+                if (!matches) {
+                    continue;
+                }
+            }
+
+            m_filterResults.append(node);
+        }
+    }
+
+    if (m_sortColumn != -1) {
+        ArchiveModelSorter(m_sortColumn, m_sortOrder).sort(&m_filterResults);
+    }
 
-        beginRemoveRows(indexForNode(parent), entry->row(), entry->row());
+    updateFilterRows();
+}
+
+void ArchiveModel::updateFilterRows()
+{
+    m_filterRows.clear();
+    m_filterRows.reserve(m_filterResults.count());
+
+    for (int i = 0; i < m_filterResults.count(); ++i) {
+        m_filterRows.insert(m_filterResults.at(i), i);
+    }
+}
+
+QSet<ArchiveDirNode*> ArchiveModel::removeNodes(const QSet<ArchiveNode*> &nodes)
+{
+    QHash<ArchiveDirNode*, QList<int> > rowsByParent;
+    foreach(ArchiveNode *node, outermost(nodes)) {
+        rowsByParent[node->parent()].append(node->row());
+    }
+
+    // Any of the results of the filter might be in a removed folder.
+    const bool resetModel = isFiltering();
+    if (resetModel) {
+        beginResetModel();
+    }
+
+    QHash<ArchiveDirNode*, QList<int> >::iterator it;
+    for (it = rowsByParent.begin(); it != rowsByParent.end(); ++it) {
+        ArchiveDirNode *parent = it.key();
+        QList<int> &rows = it.value();
+        std::sort(rows.begin(), rows.end());
+
+        const QModelIndex parentIndex = resetModel ? QModelIndex() : indexForNode(parent);
+
+        // Contiguous rows are removed together, starting from the last ones
+        // so that the rows of the others stay the same.
+        int last = rows.count() - 1;
+        while (last >= 0) {
+            int first = last;
+            while ((first > 0) && (rows.at(first - 1) == rows.at(first) - 1)) {
+                --first;
+            }
+
+            const int firstRow = rows.at(first);
+            const int lastRow = rows.at(last);
+
+            if (!resetModel) {
+                beginRemoveRows(parentIndex, firstRow, lastRow);
+            }
 
-        //delete parent->entries()[ entry->row() ];
-        //parent->entries()[ entry->row() ] = 0;
-        parent->removeEntryAt(entry->row());
+            m_tree->removeNodes(parent, firstRow, lastRow);
+
+            if (!resetModel) {
+                endRemoveRows();
+            }
+
+            last = first - 1;
+        }
+
+        parent->updateRows(rows.first());
+    }
+
+    if (resetModel) {
+        applyFilter();
+        endResetModel();
+    }
+
+    return QSet<ArchiveDirNode*>::fromList(rowsByParent.keys());
+}
+
+void ArchiveModel::slotEntryRemoved(const QString & path)
+{
+    kDebug() << "Removed node at path " << path;
+
+    const PathTrie::Node pathNode = m_archive->pathTrie()->find(path);
+    if ((pathNode == PathTrie::InvalidNode) || (pathNode == PathTrie::RootNode)) {
+        return;
+    }
 
-        endRemoveRows();
+    ArchiveNode *entry = m_tree->node(pathNode);
+    if (entry) {
+        // Deleting many files emits lots of these signals, so the nodes are
+        // removed together once they have been received.
+        if (m_pendingRemovals.isEmpty()) {
+            QTimer::singleShot(0, this, SLOT(slotRemovePendingNodes()));
+        }
+        m_pendingRemovals.insert(entry);
     } else {
         kDebug() << "Did not find the removed node";
     }
@@ -731,58 +1887,76 @@ void ArchiveModel::slotUserQuery(Kerfuffle::Query *query)
     query->execute();
 }
 
-void ArchiveModel::slotNewEntryFromSetArchive(const ArchiveEntry& entry)
+void ArchiveModel::slotNewEntriesFromSetArchive(const QVector<ArchiveEntry>& entries)
 {
-    // we cache all entries that appear when opening a new archive
-    // so we can all them together once it's done, this is a huge
-    // performance improvement because we save from doing lots of
-    // begin/endInsertRows
-    m_newArchiveEntries.push_back(entry);
-}
+    if (entries.isEmpty() || !m_treeBuilder) {
+        return;
+    }
 
-void ArchiveModel::slotNewEntry(const ArchiveEntry& entry)
-{
-    newEntry(entry, NotifyViews);
+    if (m_showColumns.isEmpty()) {
+        setupColumns(entries.first());
+    }
+
+    // The nodes are built in a worker thread as the entries arrive, and
+    // slotPublishEntries() shows them a folder at a time, which saves us
+    // from doing lots of begin/endInsertRows.
+    m_treeBuilder->addEntries(entries);
 }
 
-void ArchiveModel::newEntry(const ArchiveEntry& receivedEntry, InsertBehaviour behaviour)
+void ArchiveModel::slotNewEntries(const QVector<ArchiveEntry>& entries)
 {
-    if (receivedEntry[FileName].toString().isEmpty()) {
-        kDebug() << "Weird, received empty entry (no filename) - skipping";
+    if (entries.isEmpty()) {
         return;
     }
 
-    //if there are no addidional columns registered, then have a look at the
-    //entry and populate some
     if (m_showColumns.isEmpty()) {
-        //these are the columns we are interested in showing in the display
-        static const QList<int> columnsForDisplay =
-            QList<int>()
-            << FileName
-            << Size
-            << CompressedSize
-            << Permissions
-            << Owner
-            << Group
-            << Ratio
-            << CRC
-            << Method
-            << Version
-            << Timestamp
-            << Comment;
-
-        QList<int> toInsert;
-
-        foreach(int column, columnsForDisplay) {
-            if (receivedEntry.contains(column)) {
-                toInsert << column;
-            }
+        setupColumns(entries.first());
+    }
+
+    TreeChanges changes;
+    foreach(const ArchiveEntry &entry, entries) {
+        m_tree->addEntry(entry, &changes);
+    }
+    m_tree->applyChanges(&changes);
+}
+
+void ArchiveModel::setupColumns(const ArchiveEntry &entry)
+{
+    //these are the columns we are interested in showing in the display
+    static const QList<int> columnsForDisplay =
+        QList<int>()
+        << FileName
+        << Size
+        << CompressedSize
+        << Permissions
+        << Owner
+        << Group
+        << Ratio
+        << CRC
+        << Method
+        << Version
+        << Timestamp
+        << Comment;
+
+    QList<int> toInsert;
+
+    foreach(int column, columnsForDisplay) {
+        if (entry.contains(column)) {
+            toInsert << column;
         }
-        beginInsertColumns(QModelIndex(), 0, toInsert.size() - 1);
-        m_showColumns << toInsert;
-        endInsertColumns();
+    }
+    beginInsertColumns(QModelIndex(), 0, toInsert.size() - 1);
+    m_showColumns << toInsert;
+    endInsertColumns();
 
-        kDebug() << "Show columns detected: " << m_showColumns;
+    kDebug() << "Show columns detected: " << m_showColumns;
+}
+
+void ArchiveTree::addEntry(const ArchiveEntry& receivedEntry, TreeChanges *changes)
+{
+    if (receivedEntry[FileName].toString().isEmpty()) {
+        kDebug() << "Weird, received empty entry (no filename) - skipping";
+        return;
     }
 
     //make a copy
@@ -796,64 +1970,167 @@ void ArchiveModel::newEntry(const ArchiveEntry& receivedEntry, InsertBehaviour b
     }
     entry[FileName] = entryFileName;
 
+    // The jobs' entries come with their path already split.
+    if (!entry.contains(PathNode)) {
+        entry[PathNode] = m_pathTrie->insert(entryFileName);
+    }
+    const PathTrie::Node pathNode = entry[PathNode].toUInt();
+    if (pathNode == PathTrie::RootNode) {
+        return;
+    }
+
     /// 1. Skip already created nodes
-    if (m_rootNode) {
-        ArchiveNode *existing = m_rootNode->findByPath(entry[ FileName ].toString().split(QLatin1Char( '/' )));
-        if (existing) {
-            kDebug() << "Refreshing entry for" << entry[FileName].toString();
+    ArchiveNode *existing = m_nodesByPath.value(pathNode);
+    if (existing) {
+        kDebug() << "Refreshing entry for" << entry[FileName].toString();
+        changes->updates.append(qMakePair(existing, entry));
+        return;
+    }
 
-            // Multi-volume files are repeated at least in RAR archives.
-            // In that case, we need to sum the compressed size for each volume
-            qulonglong currentCompressedSize = existing->entry()[CompressedSize].toULongLong();
-            entry[CompressedSize] = currentCompressedSize + entry[CompressedSize].toULongLong();
+    /// 2. Find Parent Node, creating missing ArchiveDirNodes in the process
+    ArchiveDirNode *parent = parentFor(pathNode, changes);
+
+    /// 3. Create an ArchiveNode
+    const QString name = m_pathTrie->name(pathNode);
+    ArchiveNode *node;
+    if (entry[ FileName ].toString().endsWith(QLatin1Char( '/' )) || (entry.contains(IsDirectory) && entry[ IsDirectory ].toBool())) {
+        node = m_arena.createDirNode(parent, entry, name);
+    } else {
+        node = m_arena.createNode(parent, entry, name);
+    }
+    m_nodesByPath.insert(pathNode, node);
+    m_searchIndex.insert(pathNode, name);
+    changes->newNodes.append(node);
+}
+
+void ArchiveTree::applyChanges(TreeChanges *changes)
+{
+    QSet<ArchiveNode*> newNodes;
+    QList<ArchiveDirNode*> parents;
+    QHash<ArchiveDirNode*, QVector<ArchiveNode*> > nodesByParent;
+
+    foreach(ArchiveNode *node, changes->newNodes) {
+        newNodes.insert(node);
+
+        // Nobody knows about a folder created along with its contents yet,
+        // so these can be appended to it right away.
+        ArchiveDirNode *parent = node->parent();
+        if (newNodes.contains(parent)) {
+            parent->appendEntry(node);
+            continue;
+        }
 
-            //TODO: benchmark whether it's a bad idea to reset the entry here.
-            existing->setEntry(entry);
-            return;
+        if (!nodesByParent.contains(parent)) {
+            parents.append(parent);
         }
+        nodesByParent[parent].append(node);
     }
 
-    /// 2. Find Parent Node, creating missing ArchiveDirNodes in the process
-    ArchiveDirNode *parent = parentFor(entry);
+    foreach(ArchiveDirNode *parent, parents) {
+        const QVector<ArchiveNode*> nodes = nodesByParent.value(parent);
+        const int first = parent->entries().count();
 
-    /// 3. Create an ArchiveNode
-    QString name = entry[ FileName ].toString().split(QLatin1Char( '/' ), QString::SkipEmptyParts).last();
-    ArchiveNode *node = parent->find(name);
-    if (node) {
+        aboutToInsertNodes(parent, first, first + nodes.count() - 1);
+        foreach(ArchiveNode *node, nodes) {
+            parent->appendEntry(node);
+        }
+        nodesInserted();
+    }
+
+    typedef QPair<ArchiveNode*, ArchiveEntry> NodeUpdate;
+    foreach(const NodeUpdate &update, changes->updates) {
+        ArchiveNode *node = update.first;
+        ArchiveEntry entry = update.second;
+
+        // Multi-volume files are repeated at least in RAR archives.
+        // In that case, we need to sum the compressed size for each volume
+        const qint64 currentCompressedSize = node->entry().compressedSize();
+        entry[CompressedSize] = currentCompressedSize + entry[CompressedSize].toLongLong();
+
+        //TODO: benchmark whether it's a bad idea to reset the entry here.
         node->setEntry(entry);
-    } else {
-        if (entry[ FileName ].toString().endsWith(QLatin1Char( '/' )) || (entry.contains(IsDirectory) && entry[ IsDirectory ].toBool())) {
-            node = new ArchiveDirNode(parent, entry);
-        } else {
-            node = new ArchiveNode(parent, entry);
+        nodeUpdated(node);
+    }
+
+    changes->clear();
+
+    changesApplied();
+}
+
+void ArchiveTree::forgetNode(ArchiveNode *node)
+{
+    if (node->isDir()) {
+        foreach(ArchiveNode *child, static_cast<ArchiveDirNode*>(node)->entries()) {
+            forgetNode(child);
+        }
+    }
+
+    const PathTrie::Node pathNode = node->entry().pathNode();
+    if (m_nodesByPath.value(pathNode) == node) {
+        m_nodesByPath.remove(pathNode);
+    }
+}
+
+void ArchiveTree::destroyNode(ArchiveNode *node)
+{
+    if (node->isDir()) {
+        foreach(ArchiveNode *child, static_cast<ArchiveDirNode*>(node)->entries()) {
+            destroyNode(child);
         }
-        insertNode(node, behaviour);
     }
+
+    m_arena.destroyNode(node);
+}
+
+void ArchiveTree::removeNodes(ArchiveDirNode *parent, int first, int last)
+{
+    foreach(ArchiveNode *node, parent->takeEntries(first, last)) {
+        forgetNode(node);
+        destroyNode(node);
+    }
+}
+
+void ArchiveTree::discardChanges(TreeChanges *changes)
+{
+    // The new nodes have not been appended to their parents yet, not even
+    // those in new folders.
+    foreach(ArchiveNode *node, changes->newNodes) {
+        forgetNode(node);
+        m_arena.destroyNode(node);
+    }
+
+    changes->clear();
 }
 
 void ArchiveModel::slotLoadingFinished(KJob *job)
 {
-    //kDebug() << entry;
-    foreach(const ArchiveEntry &entry, m_newArchiveEntries) {
-        newEntry(entry, DoNotNotifyViews);
+    m_publishTimer->stop();
+
+    if (m_treeBuilder) {
+        m_treeBuilder->waitForDone();
+        m_treeBuilder->publishChanges();
+
+        delete m_treeBuilder;
+        m_treeBuilder = 0;
+
+        // Only the entries published before the filter was set are among
+        // its results.
+        if (isFiltering()) {
+            beginResetModel();
+            applyFilter();
+            endResetModel();
+        } else {
+            sortShownDirNodes();
+        }
     }
-    reset();
-    m_newArchiveEntries.clear();
 
     emit loadingFinished(job);
 }
 
-void ArchiveModel::insertNode(ArchiveNode *node, InsertBehaviour behaviour)
+void ArchiveModel::slotPublishEntries()
 {
-    Q_ASSERT(node);
-    ArchiveDirNode *parent = node->parent();
-    Q_ASSERT(parent);
-    if (behaviour == NotifyViews) {
-        beginInsertRows(indexForNode(parent), parent->entries().count(), parent->entries().count());
-    }
-    parent->appendEntry(node);
-    if (behaviour == NotifyViews) {
-        endInsertRows();
+    if (m_treeBuilder) {
+        m_treeBuilder->publishChanges();
     }
 }
 
@@ -862,22 +2139,42 @@ Kerfuffle::Archive* ArchiveModel::archive() const
     return m_archive.data();
 }
 
+bool ArchiveModel::isLoading() const
+{
+    return m_treeBuilder != 0;
+}
+
 KJob* ArchiveModel::setArchive(Kerfuffle::Archive *archive)
 {
+    // The builder of the previous archive uses its PathTrie.
+    m_publishTimer->stop();
+    delete m_treeBuilder;
+    m_treeBuilder = 0;
+
+    beginResetModel();
+
     m_archive.reset(archive);
 
-    m_rootNode->clear();
-    s_previousMatch = 0;
-    s_previousPieces->clear();
+    m_filterResults.clear();
+    m_filterRows.clear();
+    m_pendingRemovals.clear();
+
+    // Destroying millions of nodes takes a while, so the tree of the
+    // previous archive is deleted in another thread.
+    m_treeTeardowns.addFuture(QtConcurrent::run(&deleteTree, static_cast<ArchiveTree*>(m_tree)));
+    m_tree = new Tree(this);
+    m_tree->setPathTrie(m_archive ? m_archive->pathTrie() : 0);
 
     Kerfuffle::ListJob *job = NULL;
 
-    m_newArchiveEntries.clear();
     if (m_archive) {
+        m_treeBuilder = new TreeBuilder(m_tree);
+        m_publishTimer->start();
+
         job = m_archive->list(); // TODO: call "open" or "create"?
 
-        connect(job, SIGNAL(newEntry(ArchiveEntry)),
-                this, SLOT(slotNewEntryFromSetArchive(ArchiveEntry)));
+        connect(job, SIGNAL(newEntries(QVector<ArchiveEntry>)),
+                this, SLOT(slotNewEntriesFromSetArchive(QVector<ArchiveEntry>)));
 
         connect(job, SIGNAL(result(KJob*)),
                 this, SLOT(slotLoadingFinished(KJob*)));
@@ -890,7 +2187,7 @@ KJob* ArchiveModel::setArchive(Kerfuffle::Archive *archive)
         // TODO: make sure if it's ok to not have calls to beginRemoveColumns here
         m_showColumns.clear();
     }
-    reset();
+    endResetModel();
     return job;
 }
 
@@ -918,8 +2215,8 @@ AddJob* ArchiveModel::addFiles(const QStringList & filenames, const CompressionO
 
     if (!m_archive->isReadOnly()) {
         AddJob *job = m_archive->addFiles(filenames, options);
-        connect(job, SIGNAL(newEntry(ArchiveEntry)),
-                this, SLOT(slotNewEntry(ArchiveEntry)));
+        connect(job, SIGNAL(newEntries(QVector<ArchiveEntry>)),
+                this, SLOT(slotNewEntries(QVector<ArchiveEntry>)));
         connect(job, SIGNAL(userQuery(Kerfuffle::Query*)),
                 this, SLOT(slotUserQuery(Kerfuffle::Query*)));
 
@@ -938,7 +2235,7 @@ DeleteJob* ArchiveModel::deleteFiles(const QList<QVariant> & files)
                 this, SLOT(slotEntryRemoved(QString)));
 
         connect(job, SIGNAL(finished(KJob*)),
-                this, SLOT(slotCleanupEmptyDirs()));
+                this, SLOT(slotRemovePendingNodes()));
 
         connect(job, SIGNAL(userQuery(Kerfuffle::Query*)),
                 this, SLOT(slotUserQuery(Kerfuffle::Query*)));
@@ -947,42 +2244,24 @@ DeleteJob* ArchiveModel::deleteFiles(const QList<QVariant> & files)
     return 0;
 }
 
-void ArchiveModel::slotCleanupEmptyDirs()
+void ArchiveModel::slotRemovePendingNodes()
 {
-    kDebug();
-    QList<QPersistentModelIndex> queue;
-    QList<QPersistentModelIndex> nodesToDelete;
-
-    //add root nodes
-    for (int i = 0; i < rowCount(); ++i) {
-        queue.append(QPersistentModelIndex(index(i, 0)));
-    }
-
-    //breadth-first traverse
-    while (!queue.isEmpty()) {
-        QPersistentModelIndex node = queue.takeFirst();
-        ArchiveEntry entry = entryForIndex(node);
-        //kDebug() << "Trying " << entry[FileName].toString();
-
-        if (!hasChildren(node)) {
-            if (!entry.contains(InternalID)) {
-                nodesToDelete << node;
-            }
-        } else {
-            for (int i = 0; i < rowCount(node); ++i) {
-                queue.append(QPersistentModelIndex(index(i, 0, node)));
+    QSet<ArchiveNode*> nodes = m_pendingRemovals;
+    m_pendingRemovals.clear();
+
+    // The folders left empty are removed too, unless they are entries of
+    // the archive. Only the folders which contained removed nodes can be
+    // empty now.
+    while (!nodes.isEmpty()) {
+        const QSet<ArchiveDirNode*> parents = removeNodes(nodes);
+        nodes.clear();
+
+        foreach(ArchiveDirNode *dir, parents) {
+            if ((dir != m_tree->rootNode()) && dir->entries().isEmpty() && !dir->entry().contains(InternalID)) {
+                nodes.insert(dir);
             }
         }
     }
-
-    foreach(const QPersistentModelIndex& node, nodesToDelete) {
-        ArchiveNode *rawNode = static_cast<ArchiveNode*>(node.internalPointer());
-        kDebug() << "Delete with parent entries " << rawNode->parent()->entries() << " and row " << rawNode->row();
-        beginRemoveRows(parent(node), rawNode->row(), rawNode->row());
-        rawNode->parent()->removeEntryAt(rawNode->row());
-        endRemoveRows();
-        //kDebug() << "Removed entry " << entry[FileName].toString();
-    }
 }
 
 #include "archivemodel.moc"
@@ -23,7 +23,12 @@
 #define ARCHIVEMODEL_H
 
 #include <QAbstractItemModel>
+#include <QFutureSynchronizer>
+#include <QHash>
+#include <QPixmap>
 #include <QScopedPointer>
+#include <QSet>
+#include <QVector>
 
 #include <kjobtrackerinterface.h>
 #include "kerfuffle/archive.h"
@@ -37,6 +42,8 @@ namespace Kerfuffle
 
 class ArchiveNode;
 class ArchiveDirNode;
+class TreeBuilder;
+class QTimer;
 
 class ArchiveModel: public QAbstractItemModel
 {
@@ -55,7 +62,13 @@ public:
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
     int columnCount(const QModelIndex &parent = QModelIndex()) const;
 
+    /**
+     * Sorts the entries of the folders which have been shown, and marks the
+     * other ones to be sorted by fetchMore() when they are.
+     */
     virtual void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
+    virtual bool canFetchMore(const QModelIndex &parent) const;
+    virtual void fetchMore(const QModelIndex &parent);
 
     //drag and drop related
     virtual Qt::DropActions supportedDropActions() const;
@@ -67,15 +80,65 @@ public:
     KJob* setArchive(Kerfuffle::Archive *archive);
     Kerfuffle::Archive *archive() const;
 
+    /**
+     * Whether the contents of the archive are still being listed. The entries
+     * listed so far are already shown in the meantime.
+     */
+    bool isLoading() const;
+
     Kerfuffle::ArchiveEntry entryForIndex(const QModelIndex &index);
+
+    /**
+     * The name of the entry at @p index, without the path of its folder.
+     */
+    QString nameForIndex(const QModelIndex &index) const;
     int childCount(const QModelIndex &index, int &dirs, int &files) const;
 
+    /**
+     * Counts the files among @p indexes and in the folders among them, and
+     * sums the size of their contents. Entries in a folder which is also in
+     * @p indexes are only counted once, and an invalid index stands for the
+     * whole archive.
+     */
+    void totals(const QModelIndexList &indexes, int &files, qint64 &size, qint64 &compressedSize) const;
+
+    /**
+     * The InternalIDs of the entries at @p indexes and of all the entries
+     * in the folders among them.
+     */
+    QList<QVariant> internalIdsWithChildren(const QModelIndexList &indexes) const;
+
+    /**
+     * The InternalIDs to extract the entries at @p indexes and everything
+     * in the folders among them. Folders which are entries of the archive
+     * are passed as they are, the backends extract their contents too.
+     */
+    QList<QVariant> internalIdsForExtraction(const QModelIndexList &indexes) const;
+
+    /**
+     * The pattern set with setFilter(), or an empty string if the whole
+     * tree is shown.
+     */
+    QString filter() const;
+
     Kerfuffle::ExtractJob* extractFile(const QVariant& fileName, const QString & destinationDir, const Kerfuffle::ExtractionOptions options = Kerfuffle::ExtractionOptions()) const;
     Kerfuffle::ExtractJob* extractFiles(const QList<QVariant>& files, const QString & destinationDir, const Kerfuffle::ExtractionOptions options = Kerfuffle::ExtractionOptions()) const;
 
     Kerfuffle::AddJob* addFiles(const QStringList & paths, const Kerfuffle::CompressionOptions& options = Kerfuffle::CompressionOptions());
     Kerfuffle::DeleteJob* deleteFiles(const QList<QVariant> & files);
 
+public slots:
+    /**
+     * Shows the entries whose name matches @p pattern as a flat list,
+     * sorted like the tree, or the whole tree again if @p pattern is empty.
+     * See Kerfuffle::SearchIndex::find() for the syntax of @p pattern. If
+     * @p pattern contains a '/', it is matched against the paths of the
+     * entries instead: "doc/read" finds the names starting with "read" in
+     * the folders whose path ends with "doc", and a pattern with wildcards
+     * must match the whole path.
+     */
+    void setFilter(const QString &pattern);
+
 signals:
     void loadingStarted();
     void loadingFinished(KJob *);
@@ -84,41 +147,101 @@ signals:
     void droppedFiles(const QStringList& files, const QString& path = QString());
 
 private slots:
-    void slotNewEntryFromSetArchive(const ArchiveEntry& entry);
-    void slotNewEntry(const ArchiveEntry& entry);
+    void slotNewEntriesFromSetArchive(const QVector<ArchiveEntry>& entries);
+    void slotNewEntries(const QVector<ArchiveEntry>& entries);
     void slotLoadingFinished(KJob *job);
     void slotEntryRemoved(const QString & path);
     void slotUserQuery(Kerfuffle::Query *query);
-    void slotCleanupEmptyDirs();
+    void slotRemovePendingNodes();
+    void slotPublishEntries();
 
 private:
+    class Tree;
+
+    /**
+     * Adds the columns for the properties of @p entry which are shown.
+     */
+    void setupColumns(const Kerfuffle::ArchiveEntry &entry);
+
     /**
-     * Strips file names that start with './'.
-     *
-     * For more information, see bug 194241.
-     *
-     * @param fileName The file name that will be stripped.
-     *
-     * @return @p fileName without the leading './'
+     * Returns the icon of @p node. Icons are looked up when a node is shown,
+     * and cached in m_iconCache.
      */
-    QString cleanFileName(const QString& fileName);
+    QPixmap iconForNode(const ArchiveNode *node) const;
 
-    ArchiveDirNode* parentFor(const Kerfuffle::ArchiveEntry& entry);
     QModelIndex indexForNode(ArchiveNode *node);
-    static bool compareAscending(const QModelIndex& a, const QModelIndex& b);
-    static bool compareDescending(const QModelIndex& a, const QModelIndex& b);
+
+    /**
+     * The row of @p node in the tree, or in the results of the filter.
+     */
+    int rowForNode(ArchiveNode *node) const;
+
+    /**
+     * Returns the nodes at @p indexes which are not in a folder among
+     * them. An invalid index stands for the root node.
+     */
+    QList<const ArchiveNode*> outermostNodes(const QModelIndexList &indexes) const;
+
+    bool isFiltering() const;
+
     /**
-     * Insert the node @p node into the model, ensuring all views are notified
-     * of the change.
+     * Looks up the nodes matching m_filter and sorts them. The caller must
+     * reset the model.
      */
-    enum InsertBehaviour { NotifyViews, DoNotNotifyViews };
-    void insertNode(ArchiveNode *node, InsertBehaviour behaviour = NotifyViews);
-    void newEntry(const Kerfuffle::ArchiveEntry& entry, InsertBehaviour behaviour);
+    void applyFilter();
+    void updateFilterRows();
+
+    /**
+     * Removes @p nodes and their children from the tree, with one removal
+     * per range of contiguous rows. Returns the folders which contained
+     * them.
+     */
+    QSet<ArchiveDirNode*> removeNodes(const QSet<ArchiveNode*> &nodes);
+
+    /**
+     * Moves the persistent indexes to the rows their nodes are at after
+     * sorting.
+     */
+    void updatePersistentIndexes();
+
+    /**
+     * Sorts the entries of @p dirNodes, several folders at a time. The
+     * caller must emit the layout signals.
+     */
+    void sortDirNodes(const QList<ArchiveDirNode*> &dirNodes);
+
+    /**
+     * Sorts the shown folders which got new entries, see
+     * m_unsortedDirNodes.
+     */
+    void sortUnsortedDirNodes();
+
+    /**
+     * Sorts the shown folders which are not sorted, which are those which
+     * got new entries while the archive was being listed.
+     */
+    void sortShownDirNodes();
+    static bool compareAscending(const QModelIndex& a, const QModelIndex& b);
+    static bool compareDescending(const QModelIndex& a, const QModelIndex& b);
 
-    QList<Kerfuffle::ArchiveEntry> m_newArchiveEntries; // holds entries from opening a new archive until it's totally open
     QList<int> m_showColumns;
     QScopedPointer<Kerfuffle::Archive> m_archive;
-    ArchiveDirNode *m_rootNode;
+    Tree *m_tree;
+    TreeBuilder *m_treeBuilder; // builds the tree of the archive being opened
+    QFutureSynchronizer<void> m_treeTeardowns; // of the trees of the previous archives
+    QTimer *m_publishTimer;
+    mutable QHash<QString, QPixmap> m_iconCache; // by MIME type name
+
+    QString m_filter;
+    QList<ArchiveNode*> m_filterResults;
+    QHash<ArchiveNode*, int> m_filterRows; // the rows of m_filterResults
+
+    QSet<ArchiveNode*> m_pendingRemovals; // see slotEntryRemoved()
+
+    int m_sortColumn; // an EntryMetaDataType, or -1 if not sorted
+    Qt::SortOrder m_sortOrder;
+    uint m_sortGeneration; // incremented by each call to sort()
+    QList<ArchiveDirNode*> m_unsortedDirNodes; // shown folders entries were appended to, when not loading
 
     QString m_dbusPathName;
 };
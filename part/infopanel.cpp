@@ -112,7 +112,13 @@ void InfoPanel::setIndex(const QModelIndex& index)
             int dirs;
             int files;
             const int children = m_model->childCount(index, dirs, files);
-            additionalInfo->setText(KIO::itemsSummaryString(children, files, dirs, 0, false));
+
+            int totalFiles;
+            qint64 totalSize;
+            qint64 totalCompressedSize;
+            m_model->totals(QModelIndexList() << index, totalFiles, totalSize, totalCompressedSize);
+
+            additionalInfo->setText(KIO::itemsSummaryString(children, files, dirs, totalSize, true));
         } else if (entry.contains(Link)) {
             additionalInfo->setText(i18n("Symbolic Link"));
         } else {
@@ -124,9 +130,7 @@ void InfoPanel::setIndex(const QModelIndex& index)
             }
         }
 
-        const QStringList nameParts = entry[ FileName ].toString().split(QLatin1Char( '/' ), QString::SkipEmptyParts);
-        const QString name = (nameParts.count() > 0) ? nameParts.last() : entry[ FileName ].toString();
-        fileName->setText(name);
+        fileName->setText(m_model->nameForIndex(index));
 
         metadataLabel->setText(metadataTextFor(index));
         showMetaData();
@@ -142,11 +146,13 @@ void InfoPanel::setIndexes(const QModelIndexList &list)
     } else {
         iconLabel->setPixmap(KIconLoader::global()->loadIcon(QLatin1String( "utilities-file-archiver" ), KIconLoader::Desktop, KIconLoader::SizeHuge));
         fileName->setText(i18np("One file selected", "%1 files selected", list.size()));
-        quint64 totalSize = 0;
-        foreach(const QModelIndex& index, list) {
-            const ArchiveEntry& entry = m_model->entryForIndex(index);
-            totalSize += entry[ Size ].toULongLong();
-        }
+
+        // Includes the contents of the selected folders.
+        int totalFiles;
+        qint64 totalSize;
+        qint64 totalCompressedSize;
+        m_model->totals(list, totalFiles, totalSize, totalCompressedSize);
+
         additionalInfo->setText(KIO::convertSize(totalSize));
         hideMetaData();
     }
@@ -22,6 +22,7 @@
 #include "jobtracker.h"
 
 #include <KDebug>
+#include <KLocale>
 
 JobTrackerWidget::JobTrackerWidget(QWidget *parent)
         : QFrame(parent)
@@ -85,6 +86,19 @@ void JobTracker::percent(KJob *job, unsigned long  percent)
     m_ui->progressBar->setValue(percent);
 }
 
+void JobTracker::suspended(KJob *job)
+{
+    Q_UNUSED(job)
+    m_ui->informationLabel->setText(i18nc("@info:status", "Paused"));
+    m_ui->informationLabel->show();
+}
+
+void JobTracker::resumed(KJob *job)
+{
+    Q_UNUSED(job)
+    m_ui->informationLabel->hide();
+}
+
 void JobTracker::unregisterJob(KJob *job)
 {
     m_jobs.remove(job);
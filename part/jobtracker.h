@@ -56,6 +56,8 @@ protected slots:
     virtual void warning(KJob *job, const QString &plain, const QString &rich);
 
     virtual void percent(KJob *job, unsigned long  percent);
+    virtual void suspended(KJob *job);
+    virtual void resumed(KJob *job);
 
 private slots:
     void resetUi();
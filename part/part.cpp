@@ -45,6 +45,7 @@
 #include <KIO/NetAccess>
 #include <KIcon>
 #include <KInputDialog>
+#include <KLineEdit>
 #include <KMenu>
 #include <KMessageBox>
 #include <KPluginFactory>
@@ -79,6 +80,10 @@ namespace Ark
 
 static quint32 s_instanceCounter = 1;
 
+// How long to wait after the last key press in the search bar before
+// looking the query up, in milliseconds.
+static const int FilterDelay = 250;
+
 Part::Part(QWidget *parentWidget, QObject *parent, const QVariantList& args)
         : KParts::ReadWritePart(parent),
           m_splitter(0),
@@ -103,7 +108,26 @@ Part::Part(QWidget *parentWidget, QObject *parent, const QVariantList& args)
     m_view = new ArchiveView;
     m_infoPanel = new InfoPanel(m_model);
 
-    m_splitter->addWidget(m_view);
+    m_searchLine = new KLineEdit;
+    m_searchLine->setClickMessage(i18nc("@info:placeholder", "Search (e.g. *.txt)"));
+    m_searchLine->setClearButtonShown(true);
+
+    // Typing a query only looks it up once the user pauses.
+    m_filterTimer = new QTimer(this);
+    m_filterTimer->setSingleShot(true);
+    m_filterTimer->setInterval(FilterDelay);
+    connect(m_searchLine, SIGNAL(textChanged(QString)),
+            m_filterTimer, SLOT(start()));
+    connect(m_filterTimer, SIGNAL(timeout()),
+            this, SLOT(slotFilterChanged()));
+
+    QWidget *viewWidget = new QWidget;
+    QVBoxLayout *viewLayout = new QVBoxLayout(viewWidget);
+    viewLayout->setMargin(0);
+    viewLayout->addWidget(m_searchLine);
+    viewLayout->addWidget(m_view);
+
+    m_splitter->addWidget(viewWidget);
     m_splitter->addWidget(m_infoPanel);
 
     QList<int> splitterSizes = ArkSettings::splitterSizes();
@@ -191,7 +215,7 @@ void Part::extractSelectedFilesTo(const QString& localPath)
         internalRoot = m_model->entryForIndex(m_view->currentIndex().parent()).value(FileName);
     }
 
-    QList<QVariant> files = selectedFilesWithChildren();
+    QList<QVariant> files = m_model->internalIdsForExtraction(m_view->selectionModel()->selectedRows());
     if (files.isEmpty()) {
         return;
     }
@@ -204,6 +228,7 @@ void Part::extractSelectedFilesTo(const QString& localPath)
     }
 
     ExtractJob *job = m_model->extractFiles(files, localPath, options);
+    job->setPriority(Job::BulkPriority);
     registerJob(job);
 
     connect(job, SIGNAL(result(KJob*)),
@@ -296,7 +321,11 @@ void Part::updateActions()
 {
     bool isWritable = m_model->archive() && (!m_model->archive()->isReadOnly());
 
-    m_previewAction->setEnabled(!isBusy() && (m_view->selectionModel()->selectedRows().count() == 1)
+    // Previews can be asked for while the archive is being listed, and are
+    // extracted once listing is over.
+    const bool canPreview = !isBusy() || m_model->isLoading();
+
+    m_previewAction->setEnabled(canPreview && (m_view->selectionModel()->selectedRows().count() == 1)
                                 && isPreviewable(m_view->selectionModel()->currentIndex()));
     m_extractFilesAction->setEnabled(!isBusy() && (m_model->rowCount() > 0));
     m_addFilesAction->setEnabled(!isBusy() && isWritable);
@@ -363,7 +392,7 @@ void Part::slotQuickExtractFiles(QAction *triggeredAction)
 
         Kerfuffle::ExtractionOptions options;
         options[QLatin1String( "PreservePaths" )] = true;
-        QList<QVariant> files = selectedFiles();
+        QList<QVariant> files = m_model->internalIdsForExtraction(m_view->selectionModel()->selectedRows());
         ExtractJob *job = m_model->extractFiles(files, finalDestinationDirectory, options);
         registerJob(job);
 
@@ -384,6 +413,19 @@ void Part::selectionChanged()
     m_infoPanel->setIndexes(m_view->selectionModel()->selectedRows());
 }
 
+void Part::slotFilterChanged()
+{
+    m_filterTimer->stop();
+
+    const QString text = m_searchLine->text();
+    m_model->setFilter(text);
+
+    // Resetting the model collapsed the tree.
+    if (text.isEmpty()) {
+        m_view->expandToDepth(0);
+    }
+}
+
 KAboutData* Part::createAboutData()
 {
     return new KAboutData("ark", 0, ki18n("ArkPart"), "3.0");
@@ -469,6 +511,9 @@ bool Part::openFile()
         return false;
     }
 
+    m_searchLine->clear();
+    slotFilterChanged();
+
     KJob *job = m_model->setArchive(archive.take());
     registerJob(job);
     job->start();
@@ -534,9 +579,11 @@ void Part::setReadyGui()
 void Part::setBusyGui()
 {
     kDebug();
-    QApplication::setOverrideCursor(QCursor(Qt::WaitCursor));
+    // The entries listed so far can be browsed while an archive is opened.
+    const bool isLoading = m_model->isLoading();
+    QApplication::setOverrideCursor(QCursor(isLoading ? Qt::BusyCursor : Qt::WaitCursor));
     m_busy = true;
-    m_view->setEnabled(false);
+    m_view->setEnabled(isLoading);
     updateActions();
 }
 
@@ -575,6 +622,7 @@ void Part::preview(const QModelIndex &index, PreviewMode mode)
         m_previewDirList.append(new KTempDir);
         m_previewMode = mode;
         ExtractJob *job = m_model->extractFile(entry[InternalID], m_previewDirList.last()->name(), options);
+        job->setPriority(Job::InteractivePriority);
 
         registerJob(job);
         connect(job, SIGNAL(result(KJob*)),
@@ -653,6 +701,16 @@ void Part::slotExtractFiles()
 
     if (m_view->selectionModel()->selectedRows().count() > 0) {
         dialog.data()->setShowSelectedFiles(true);
+
+        int allFiles;
+        int selectedFiles;
+        qint64 allSize;
+        qint64 selectedSize;
+        qint64 compressedSize;
+        m_model->totals(QModelIndexList() << QModelIndex(), allFiles, allSize, compressedSize);
+        m_model->totals(m_view->selectionModel()->selectedRows(), selectedFiles, selectedSize, compressedSize);
+
+        dialog.data()->setFileTotals(allFiles, allSize, selectedFiles, selectedSize);
     }
 
     dialog.data()->setSingleFolderArchive(isSingleFolderArchive());
@@ -669,7 +727,7 @@ void Part::slotExtractFiles()
         //if the user has chosen to extract only selected entries, fetch these
         //from the listview
         if (!dialog.data()->extractAllFiles()) {
-            files = selectedFilesWithChildren();
+            files = m_model->internalIdsForExtraction(m_view->selectionModel()->selectedRows());
         }
 
         kDebug() << "Selected " << files;
@@ -699,44 +757,9 @@ QList<QVariant> Part::selectedFilesWithChildren()
 {
     Q_ASSERT(m_model);
 
-    QModelIndexList toIterate = m_view->selectionModel()->selectedRows();
-
-    for (int i = 0; i < toIterate.size(); ++i) {
-        QModelIndex index = toIterate.at(i);
-
-        for (int j = 0; j < m_model->rowCount(index); ++j) {
-            QModelIndex child = m_model->index(j, 0, index);
-            if (!toIterate.contains(child)) {
-                toIterate << child;
-            }
-        }
-    }
-
-    QVariantList ret;
-    foreach(const QModelIndex & index, toIterate) {
-        const ArchiveEntry& entry = m_model->entryForIndex(index);
-        if (entry.contains(InternalID)) {
-            ret << entry[ InternalID ];
-        }
-    }
-    return ret;
-}
-
-QList<QVariant> Part::selectedFiles()
-{
-    QStringList toSort;
-
-    foreach(const QModelIndex & index, m_view->selectionModel()->selectedRows()) {
-        const ArchiveEntry& entry = m_model->entryForIndex(index);
-        toSort << entry[ InternalID ].toString();
-    }
-
-    toSort.sort();
-    QVariantList ret;
-    foreach(const QString &i, toSort) {
-        ret << i;
-    }
-    return ret;
+    // Folders are expanded through the tree, so that this also works on the
+    // flat results of a search.
+    return m_model->internalIdsWithChildren(m_view->selectionModel()->selectedRows());
 }
 
 void Part::slotExtractionDone(KJob* job)
@@ -38,9 +38,11 @@ class KAbstractWidgetJobTracker;
 class KAboutData;
 class KAction;
 class KJob;
+class KLineEdit;
 
 class QAction;
 class QSplitter;
+class QTimer;
 class QTreeView;
 
 namespace Ark
@@ -90,6 +92,7 @@ private slots:
     void slotSaveAs();
     void updateActions();
     void selectionChanged();
+    void slotFilterChanged();
     void adjustColumns();
     void setBusyGui();
     void setReadyGui();
@@ -106,13 +109,14 @@ private:
     bool isSingleFolderArchive() const;
     QString detectSubfolder() const;
     bool isPreviewable(const QModelIndex& index) const;
-    QList<QVariant> selectedFiles();
     QList<QVariant> selectedFilesWithChildren();
     void registerJob(KJob *job);
     void preview(const QModelIndex &index, PreviewMode mode);
 
     ArchiveModel         *m_model;
     QTreeView            *m_view;
+    KLineEdit            *m_searchLine;
+    QTimer               *m_filterTimer;
     KAction              *m_previewChooseAppAction;
     KAction              *m_previewAction;
     KAction              *m_extractFilesAction;
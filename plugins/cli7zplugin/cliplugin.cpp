@@ -53,12 +53,18 @@ ParameterList CliPlugin::parameterList() const
         p[ListProgram] = p[ExtractProgram] = p[DeleteProgram] = p[AddProgram] = QStringList() << QLatin1String( "7z" ) << QLatin1String( "7za" ) << QLatin1String( "7zr" );
 
         p[ListArgs] = QStringList() << QLatin1String( "l" ) << QLatin1String( "-slt" ) << QLatin1String( "$Archive" );
+        p[ListFilesArgs] = QStringList() << QLatin1String( "l" ) << QLatin1String( "-slt" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[ParallelExtraction] = true;
         p[ExtractArgs] = QStringList() << QLatin1String( "$PreservePathSwitch" ) << QLatin1String( "$PasswordSwitch" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
         p[PreservePathSwitch] = QStringList() << QLatin1String( "x" ) << QLatin1String( "e" );
         p[PasswordSwitch] = QStringList() << QLatin1String( "-p$Password" );
         p[FileExistsExpression] = QLatin1String( "already exists. Overwrite with" );
         p[WrongPasswordPatterns] = QStringList() << QLatin1String( "Wrong password" );
-        p[AddArgs] = QStringList() << QLatin1String( "a" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[AddArgs] = QStringList() << QLatin1String( "a" ) << QLatin1String( "$CompressionSwitches" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[CompressionLevelSwitch] = QStringList() << QLatin1String( "-mx=$Level" );
+        p[CompressionThreadsSwitch] = QStringList() << QLatin1String( "-mmt=$Threads" );
+        p[SolidSwitch] = QStringList() << QLatin1String( "-ms=on" ) << QLatin1String( "-ms=off" );
+        p[DictionarySizeSwitch] = QStringList() << QLatin1String( "-md=$Sizek" );
         p[DeleteArgs] = QStringList() << QLatin1String( "d" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
 
         p[FileExistsInput] = QStringList()
@@ -111,11 +117,18 @@ bool CliPlugin::readListLine(const QString& line)
                 m_archiveType = ArchiveTypeTar;
             } else if (type == QLatin1String("Zip")) {
                 m_archiveType = ArchiveTypeZip;
+                setSolidArchive(false);
             } else {
                 // Should not happen
                 kWarning() << "Unsupported archive type";
                 return false;
             }
+        } else if (line.startsWith(QLatin1String("Solid = "))) {
+            // Only 7z archives can be solid here; the compressed tarballs
+            // are left to a single process anyway.
+            if (m_archiveType == ArchiveType7z) {
+                setSolidArchive(line.mid(8).trimmed() == QLatin1String("+"));
+            }
         }
 
         break;
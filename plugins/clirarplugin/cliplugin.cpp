@@ -41,13 +41,36 @@ CliPlugin::CliPlugin(QObject *parent, const QVariantList& args)
         , m_remainingIgnoredDetailsLines(0)
         , m_isUnrarFree(false)
         , m_isUnrarVersion5(false)
+        , m_isSolid(false)
+        , m_isFlavourKnown(false)
 {
+    // Which unrar flavour is installed is only found out while listing an
+    // archive; once it is known, use the right parser from the start.
+    const QString flavour = programCapability(ListProgram, QLatin1String("Flavour")).toString();
+    if (flavour == QLatin1String("unrar5")) {
+        m_isUnrarVersion5 = true;
+        setListEmptyLines(true);
+    } else if (flavour == QLatin1String("unrar-free")) {
+        m_isUnrarFree = true;
+    }
+    m_isFlavourKnown = !flavour.isEmpty();
 }
 
 CliPlugin::~CliPlugin()
 {
 }
 
+bool CliPlugin::list()
+{
+    // The same interface may list its archive again after it changed.
+    m_parseState = ParseStateColumnDescription1;
+    m_remainingIgnoredSubHeaderLines = 0;
+    m_remainingIgnoredDetailsLines = 0;
+    m_isSolid = false;
+
+    return CliInterface::list();
+}
+
 // #272281: the proprietary unrar program does not like trailing '/'s
 //          in directories passed to it when extracting only part of
 //          the files in an archive.
@@ -70,6 +93,8 @@ ParameterList CliPlugin::parameterList() const
         p[DeleteProgram] = p[AddProgram] = QStringList() << QLatin1String( "rar" );
 
         p[ListArgs] = QStringList() << QLatin1String( "vt" ) << QLatin1String( "-c-" ) << QLatin1String( "-v" ) << QLatin1String( "$Archive" );
+        p[ListFilesArgs] = QStringList() << QLatin1String( "vt" ) << QLatin1String( "-c-" ) << QLatin1String( "-v" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[ParallelExtraction] = true;
         p[ExtractArgs] = QStringList() << QLatin1String( "-kb" ) << QLatin1String( "-p-" )
                                        << QLatin1String( "$PreservePathSwitch" )
                                        << QLatin1String( "$PasswordSwitch" )
@@ -91,7 +116,12 @@ ParameterList CliPlugin::parameterList() const
                              << QLatin1String( "Q" ) //cancel
                              ;
 
-        p[AddArgs] = QStringList() << QLatin1String( "a" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[AddArgs] = QStringList() << QLatin1String( "a" ) << QLatin1String( "$CompressionSwitches" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[CompressionLevelSwitch] = QStringList() << QLatin1String( "-m$Level" );
+        p[MaximumCompressionLevel] = 5;
+        p[CompressionThreadsSwitch] = QStringList() << QLatin1String( "-mt$Threads" );
+        p[SolidSwitch] = QStringList() << QLatin1String( "-s" ) << QLatin1String( "-s-" );
+        p[DictionarySizeSwitch] = QStringList() << QLatin1String( "-md$Sizek" );
 
         p[PasswordPromptPattern] = QLatin1String("Enter password \\(will not be echoed\\) for");
 
@@ -164,6 +194,11 @@ bool CliPlugin::readListLine(const QString &line)
         QString key = line.left(colonPos).trimmed().toLower();
         QString value = line.mid(colonPos + 2);
 
+        if (key == QLatin1String("details")) {
+            setSolidArchive(value.contains(QLatin1String("solid")));
+            return true;
+        }
+
         if (key == QLatin1String("name")) {
             m_entryFileName = value;
             m_entryDetails.clear();
@@ -185,12 +220,18 @@ bool CliPlugin::readListLine(const QString &line)
     case ParseStateColumnDescription1:
         if (line.startsWith(QLatin1String("Details:"))) {
             m_isUnrarVersion5 = true;
+            m_isFlavourKnown = true;
             setListEmptyLines(true);
+            setProgramCapability(ListProgram, QLatin1String("Flavour"), QLatin1String("unrar5"));
+            // For example "Details: RAR 5, solid".
+            setSolidArchive(line.contains(QLatin1String("solid")));
             // no previously detected entry
             m_entryFileName.clear();
         }
         if (line.startsWith(columnDescription1String)) {
-            m_parseState = ParseStateColumnDescription2;
+            // Once the flavour is known there is nothing left to sniff,
+            // the second line of column names is skipped with the header.
+            m_parseState = m_isFlavourKnown ? ParseStateHeader : ParseStateColumnDescription2;
         }
 
         break;
@@ -205,9 +246,13 @@ bool CliPlugin::readListLine(const QString &line)
         //          be).
         if (line.startsWith(columnDescription2String)) {
             m_parseState = ParseStateHeader;
+            m_isFlavourKnown = true;
+            setProgramCapability(ListProgram, QLatin1String("Flavour"), QLatin1String("unrar"));
         } else if (line.startsWith(headerString)) {
             m_parseState = ParseStateEntryFileName;
             m_isUnrarFree = true;
+            m_isFlavourKnown = true;
+            setProgramCapability(ListProgram, QLatin1String("Flavour"), QLatin1String("unrar-free"));
         }
 
         break;
@@ -264,6 +309,16 @@ bool CliPlugin::readListLine(const QString &line)
         break;
 
     case ParseStateEntryIgnoredDetails:
+        // The "Host OS/Solid/Old" line: an archive is solid if any of its
+        // entries is.
+        if (!m_isSolid) {
+            const QStringList details = line.split(QLatin1Char(' '), QString::SkipEmptyParts);
+            // The Host OS may be several words long ("MS DOS"), so look
+            // at the Solid column from the end of the line.
+            m_isSolid = (details.size() >= 3) && (details.at(details.size() - 2) == QLatin1String("Yes"));
+            setSolidArchive(m_isSolid);
+        }
+
         if (m_remainingIgnoredDetailsLines > 0) {
             --m_remainingIgnoredDetailsLines;
             return true;
@@ -34,6 +34,8 @@ public:
 
     virtual ~CliPlugin();
 
+    virtual bool list();
+
     virtual QString escapeFileName(const QString &fileName) const;
 
     virtual Kerfuffle::ParameterList parameterList() const;
@@ -60,6 +62,11 @@ private:
 
     bool m_isUnrarFree;
     bool m_isUnrarVersion5;
+    bool m_isSolid;
+
+    // Whether the flavour above was remembered from an earlier listing or
+    // found out by this one, so the output is not sniffed any more.
+    bool m_isFlavourKnown;
 };
 
 #endif // CLIPLUGIN_H
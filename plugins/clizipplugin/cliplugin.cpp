@@ -78,6 +78,8 @@ ParameterList CliPlugin::parameterList() const
         p[DeleteProgram] = p[AddProgram] = QStringList() << QLatin1String( "zip" );
 
         p[ListArgs] = QStringList() << QLatin1String( "-l" ) << QLatin1String( "-T" ) << QLatin1String( "$Archive" );
+        p[ListFilesArgs] = QStringList() << QLatin1String( "-l" ) << QLatin1String( "-T" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[ParallelExtraction] = true;
         p[ExtractArgs] = QStringList() << QLatin1String( "$PreservePathSwitch" ) << QLatin1String( "$PasswordSwitch" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
         p[PreservePathSwitch] = QStringList() << QLatin1String( "" ) << QLatin1String( "-j" );
         p[PasswordSwitch] = QStringList() << QLatin1String( "-P$Password" );
@@ -92,7 +94,8 @@ ParameterList CliPlugin::parameterList() const
                              << QLatin1String( "N" ) //autoskip
                              ;
 
-        p[AddArgs] = QStringList() << QLatin1String( "-r" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[AddArgs] = QStringList() << QLatin1String( "-r" ) << QLatin1String( "$CompressionSwitches" ) << QLatin1String( "$Archive" ) << QLatin1String( "$Files" );
+        p[CompressionLevelSwitch] = QStringList() << QLatin1String( "-$Level" );
 
         p[PasswordPromptPattern] = QLatin1String(" password: ");
         p[WrongPasswordPatterns] = QStringList() << QLatin1String( "incorrect password" );
@@ -108,6 +111,8 @@ bool CliPlugin::readListLine(const QString &line)
 
     switch (m_status) {
     case Header:
+        // Each entry of a zip archive is compressed on its own.
+        setSolidArchive(false);
         m_status = Entry;
         break;
     case Entry:
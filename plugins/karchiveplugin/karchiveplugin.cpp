@@ -26,11 +26,18 @@
 #include <KMimeType>
 #include <KDebug>
 #include <KLocale>
+#include <KTemporaryFile>
+#include <kde_file.h>
 #include <QDir>
 
 #include <QFileInfo>
+#include <QScopedPointer>
 #include <QSet>
 
+// The size of the blocks copyFile() copies between two checks for
+// cancellation, and copyArchiveTo() copies at a time.
+static const qint64 CopyBlockSize = 64 * 1024;
+
 KArchiveInterface::KArchiveInterface(QObject *parent, const QVariantList &args)
         : ReadWriteArchiveInterface(parent, args), m_archive(0)
 {
@@ -46,16 +53,20 @@ KArchiveInterface::~KArchiveInterface()
 KArchive *KArchiveInterface::archive()
 {
     if (m_archive == 0) {
-        KMimeType::Ptr mimeType = KMimeType::findByPath(filename());
+        m_archive = createArchive(filename());
+    }
+    return m_archive;
+}
 
-        if (mimeType->is(QLatin1String("application/zip"))) {
-            m_archive = new KZip(filename());
-        } else {
-            m_archive = new KTar(filename());
-        }
+KArchive *KArchiveInterface::createArchive(const QString &path) const
+{
+    KMimeType::Ptr mimeType = KMimeType::findByPath(filename());
 
+    if (mimeType->is(QLatin1String("application/zip"))) {
+        return new KZip(path);
+    } else {
+        return new KTar(path);
     }
-    return m_archive;
 }
 
 bool KArchiveInterface::list()
@@ -75,6 +86,8 @@ void KArchiveInterface::getAllEntries(const KArchiveDirectory *dir, const QStrin
         const KArchiveEntry *entry = dir->entry(entryName);
         if (entry->isDirectory()) {
             QString newPrefix = (prefix.isEmpty() ? prefix : prefix + QLatin1Char('/')) + entryName;
+            // Listed as well so that empty folders are created too.
+            list.append(newPrefix + QLatin1Char('/'));
             getAllEntries(static_cast<const KArchiveDirectory*>(entry), newPrefix, list);
         }
         else {
@@ -93,15 +106,44 @@ bool KArchiveInterface::copyFiles(const QList<QVariant> &files, const QString &d
         return false;
     }
 
-    QList<QVariant> extrFiles = files;
-    if (extrFiles.isEmpty()) { // All files should be extracted
+    QList<QVariant> extrFiles;
+    if (files.isEmpty()) { // All files should be extracted
         getAllEntries(dir, QString(), extrFiles);
+    } else {
+        // A selected folder stands for everything in it, which might have
+        // been selected as well.
+        QSet<QString> selectedFiles;
+        foreach(const QVariant &file, files) {
+            QList<QVariant> subtree;
+            subtree << file;
+
+            const KArchiveEntry *archiveEntry = dir->entry(file.toString());
+            if (archiveEntry && archiveEntry->isDirectory()) {
+                QString prefix = file.toString();
+                if (prefix.endsWith(QLatin1Char('/'))) {
+                    prefix.chop(1);
+                }
+                getAllEntries(static_cast<const KArchiveDirectory*>(archiveEntry), prefix, subtree);
+            }
+
+            foreach(const QVariant &entry, subtree) {
+                if (!selectedFiles.contains(entry.toString())) {
+                    selectedFiles.insert(entry.toString());
+                    extrFiles << entry;
+                }
+            }
+        }
     }
 
     bool overwriteAllSelected = false;
     bool autoSkipSelected = false;
     QSet<QString> dirCache;
     foreach(const QVariant &file, extrFiles) {
+        if (!checkpoint()) {
+            kDebug() << "Extraction cancelled";
+            return false;
+        }
+
         QString realDestination = destinationDirectory;
         const KArchiveEntry *archiveEntry = dir->entry(file.toString());
         if (!archiveEntry) {
@@ -123,7 +165,6 @@ bool KArchiveInterface::copyFiles(const QList<QVariant> &files, const QString &d
             realDestination = dest.absolutePath() + QLatin1Char('/') + filepath;
         }
 
-        // TODO: handle errors, copyTo fails silently
         if (!archiveEntry->isDirectory()) { // We don't need to do anything about directories
             if (QFile::exists(realDestination + QLatin1Char('/') + archiveEntry->name()) && !overwriteAllSelected) {
                 if (autoSkipSelected) {
@@ -136,7 +177,9 @@ bool KArchiveInterface::copyFiles(const QList<QVariant> &files, const QString &d
                     break;
                 }
                 if (response == OverwriteYes || response == OverwriteAll) {
-                    static_cast<const KArchiveFile*>(archiveEntry)->copyTo(realDestination);
+                    if (!copyFile(static_cast<const KArchiveFile*>(archiveEntry), realDestination)) {
+                        return false;
+                    }
                     if (response == OverwriteAll) {
                         overwriteAllSelected = true;
                     }
@@ -146,7 +189,9 @@ bool KArchiveInterface::copyFiles(const QList<QVariant> &files, const QString &d
                 }
             }
             else {
-                static_cast<const KArchiveFile*>(archiveEntry)->copyTo(realDestination);
+                if (!copyFile(static_cast<const KArchiveFile*>(archiveEntry), realDestination)) {
+                    return false;
+                }
             }
         }
     }
@@ -154,6 +199,55 @@ bool KArchiveInterface::copyFiles(const QList<QVariant> &files, const QString &d
     return true;
 }
 
+bool KArchiveInterface::copyFile(const KArchiveFile *file, const QString &destinationDirectory)
+{
+    // Like KArchiveFile::copyTo(), but in blocks so that a kill is
+    // noticed in the middle of a big file.
+    const QString destinationPath(destinationDirectory + QLatin1Char('/') + file->name());
+
+    QScopedPointer<QIODevice> source(file->createDevice());
+    if (!source || !source->isOpen()) {
+        emit error(i18nc("@info", "Could not read the file <filename>%1</filename> from the archive.", file->name()));
+        return false;
+    }
+
+    QFile destination(destinationPath);
+    if (!destination.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        emit error(i18nc("@info", "Could not write the file <filename>%1</filename>.", destinationPath));
+        return false;
+    }
+
+    qint64 remaining = file->size();
+    QByteArray buffer;
+
+    while (remaining > 0) {
+        if (!checkpoint(buffer.size())) {
+            kDebug() << "Extraction cancelled, removing" << destinationPath;
+            destination.close();
+            destination.remove();
+            return false;
+        }
+
+        buffer = source->read(qMin(remaining, CopyBlockSize));
+        if (buffer.isEmpty()) {
+            emit error(i18nc("@info", "Could not read the file <filename>%1</filename> from the archive.", file->name()));
+            destination.close();
+            destination.remove();
+            return false;
+        }
+
+        if (destination.write(buffer) != buffer.size()) {
+            emit error(i18nc("@info", "Could not write the file <filename>%1</filename>.", destinationPath));
+            destination.close();
+            destination.remove();
+            return false;
+        }
+        remaining -= buffer.size();
+    }
+
+    return true;
+}
+
 int KArchiveInterface::handleFileExistsMessage(const QString &dir, const QString &fileName)
 {
     Kerfuffle::OverwriteQuery query(dir + QLatin1Char('/') + fileName);
@@ -179,20 +273,26 @@ bool KArchiveInterface::browseArchive(KArchive *archive)
     return processDir(archive->directory());
 }
 
-bool KArchiveInterface::processDir(const KArchiveDirectory *dir, const QString & prefix)
+bool KArchiveInterface::processDir(const KArchiveDirectory *dir, const QString & prefix, QList<ArchiveEntry> *entries)
 {
     foreach(const QString& entryName, dir->entries()) {
+        if (!checkpoint()) {
+            return false;
+        }
+
         const KArchiveEntry *entry = dir->entry(entryName);
-        createEntryFor(entry, prefix);
+        createEntryFor(entry, prefix, entries);
         if (entry->isDirectory()) {
             QString newPrefix = (prefix.isEmpty() ? prefix : prefix + QLatin1Char('/')) + entryName;
-            processDir(static_cast<const KArchiveDirectory*>(entry), newPrefix);
+            if (!processDir(static_cast<const KArchiveDirectory*>(entry), newPrefix, entries)) {
+                return false;
+            }
         }
     }
     return true;
 }
 
-void KArchiveInterface::createEntryFor(const KArchiveEntry *aentry, const QString& prefix)
+void KArchiveInterface::createEntryFor(const KArchiveEntry *aentry, const QString& prefix, QList<ArchiveEntry> *entries)
 {
     ArchiveEntry e;
     QString fileName = prefix.isEmpty() ? aentry->name() : prefix + QLatin1Char('/') + aentry->name();
@@ -216,55 +316,174 @@ void KArchiveInterface::createEntryFor(const KArchiveEntry *aentry, const QStrin
     else {
         e[ Size ] = 0;
     }
-    emit entry(e);
+
+    if (entries) {
+        entries->append(e);
+    } else {
+        emit entry(e);
+    }
 }
 
 bool KArchiveInterface::addFiles(const QStringList &files, const Kerfuffle::CompressionOptions &options)
 {
     Q_UNUSED(options)
     kDebug() << "Starting...";
-//  delete m_archive;
-//  m_archive = 0;
-    if (archive()->isOpen()) {
-        archive()->close();
+
+    // KArchive writes what was added so far when it is closed, so the
+    // files are added to a copy of the archive next to it, which only
+    // replaces it once all of them have been added. The copy keeps the
+    // name of the archive at its end, which tells KTar the compression.
+    const QFileInfo archiveInfo(filename());
+
+    KTemporaryFile tempFile;
+    tempFile.setPrefix(archiveInfo.absolutePath() + QLatin1String("/.ark-"));
+    tempFile.setSuffix(QLatin1Char('-') + archiveInfo.fileName());
+
+    if (!tempFile.open() || !copyArchiveTo(&tempFile)) {
+        emit error(i18nc("@info", "Could not open the archive <filename>%1</filename> for writing.", filename()));
+        return false;
     }
-    if (!archive()->open(QIODevice::ReadWrite)) {
+    tempFile.close();
+
+    // A new archive is created by KArchive, like it would be in place.
+    if (!archiveInfo.exists()) {
+        QFile::remove(tempFile.fileName());
+    }
+
+    QScopedPointer<KArchive> newArchive(createArchive(tempFile.fileName()));
+    if (!newArchive->open(QIODevice::ReadWrite)) {
         emit error(i18nc("@info", "Could not open the archive <filename>%1</filename> for writing.", filename()));
         return false;
     }
 
+    // The entries are only reported once the archive has been replaced.
+    QList<ArchiveEntry> addedEntries;
+
     kDebug() << "Archive opened for writing...";
     kDebug() << "Will add " << files.count() << " files";
     foreach(const QString &path, files) {
-        kDebug() << "Adding " << path;
         QFileInfo fi(path);
         Q_ASSERT(fi.exists());
 
+        kDebug() << "Adding " << path;
+
         if (fi.isDir()) {
-            if (archive()->addLocalDirectory(path, fi.fileName())) {
-                const KArchiveEntry *entry = archive()->directory()->entry(fi.fileName());
-                createEntryFor(entry, QString());
-                processDir((KArchiveDirectory*) archive()->directory()->entry(fi.fileName()), fi.fileName());
-            } else {
-                emit error(i18nc("@info", "Could not add the directory <filename>%1</filename> to the archive", path));
+            if (!addLocalDirectory(newArchive.data(), path, fi.fileName())) {
                 return false;
             }
+
+            const KArchiveEntry *entry = newArchive->directory()->entry(fi.fileName());
+            if (entry && entry->isDirectory()) {
+                createEntryFor(entry, QString(), &addedEntries);
+                processDir(static_cast<const KArchiveDirectory*>(entry), fi.fileName(), &addedEntries);
+            }
         } else {
-            if (archive()->addLocalFile(path, fi.fileName())) {
-                const KArchiveEntry *entry = archive()->directory()->entry(fi.fileName());
-                createEntryFor(entry, QString());
-            } else {
-                emit error(i18nc("@info", "Could not add the file <filename>%1</filename> to the archive.", path));
+            if (!addLocalFile(newArchive.data(), path, fi.fileName())) {
                 return false;
             }
+
+            const KArchiveEntry *entry = newArchive->directory()->entry(fi.fileName());
+            createEntryFor(entry, QString(), &addedEntries);
         }
     }
+
     kDebug() << "Closing the archive";
-    archive()->close();
+    if (!newArchive->close()) {
+        emit error(i18nc("@info", "Could not write the archive <filename>%1</filename>.", filename()));
+        return false;
+    }
+
+    if (archiveInfo.exists()) {
+        QFile::setPermissions(tempFile.fileName(), archiveInfo.permissions());
+    }
+
+    if (KDE::rename(tempFile.fileName(), filename()) != 0) {
+        emit error(i18nc("@info", "Could not write the archive <filename>%1</filename>.", filename()));
+        return false;
+    }
+
+    // What was read from the archive so far is out of date.
+    delete m_archive;
+    m_archive = 0;
+
+    foreach(const ArchiveEntry &e, addedEntries) {
+        emit entry(e);
+    }
+
     kDebug() << "Done";
     return true;
 }
 
+bool KArchiveInterface::addLocalFile(KArchive *archive, const QString &path, const QString &destinationName)
+{
+    // KArchive cannot stop in the middle of a file, so the check is done
+    // between them.
+    if (!checkpoint(QFileInfo(path).size())) {
+        kDebug() << "Adding files cancelled";
+        return false;
+    }
+
+    if (!archive->addLocalFile(path, destinationName)) {
+        emit error(i18nc("@info", "Could not add the file <filename>%1</filename> to the archive.", path));
+        return false;
+    }
+
+    return true;
+}
+
+bool KArchiveInterface::addLocalDirectory(KArchive *archive, const QString &path, const QString &destinationName)
+{
+    // Like KArchive::addLocalDirectory(), but a file at a time so that a
+    // kill is noticed in the middle of a big directory.
+    QDir dir(path);
+    if (!dir.exists()) {
+        emit error(i18nc("@info", "Could not add the directory <filename>%1</filename> to the archive", path));
+        return false;
+    }
+
+    dir.setFilter(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+
+    foreach(const QString &name, dir.entryList()) {
+        const QString fileName = path + QLatin1Char('/') + name;
+        const QString destination = destinationName + QLatin1Char('/') + name;
+        const QFileInfo fileInfo(fileName);
+
+        if (fileInfo.isFile() || fileInfo.isSymLink()) {
+            if (!addLocalFile(archive, fileName, destination)) {
+                return false;
+            }
+        } else if (fileInfo.isDir()) {
+            if (!addLocalDirectory(archive, fileName, destination)) {
+                return false;
+            }
+        }
+        // Sockets and the like are left out, as KArchive does.
+    }
+
+    return true;
+}
+
+bool KArchiveInterface::copyArchiveTo(QFile *destination)
+{
+    QFile source(filename());
+    if (!source.exists()) {
+        return true;
+    }
+
+    if (!source.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    while (!source.atEnd()) {
+        const QByteArray buffer = source.read(CopyBlockSize);
+        if (buffer.isEmpty() || (destination->write(buffer) != buffer.size())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 bool KArchiveInterface::deleteFiles(const QList<QVariant> & files)
 {
     Q_UNUSED(files)
@@ -27,6 +27,8 @@ using namespace Kerfuffle;
 class KArchive;
 class KArchiveEntry;
 class KArchiveDirectory;
+class KArchiveFile;
+class QFile;
 
 class KArchiveInterface: public ReadWriteArchiveInterface
 {
@@ -52,14 +54,46 @@ private:
 
     bool browseArchive(KArchive *archive);
 
-    bool processDir(const KArchiveDirectory *dir, const QString & prefix = QString());
+    /**
+     * Creates a KZip or a KTar for @p path, depending on the type of the
+     * archive.
+     */
+    KArchive *createArchive(const QString &path) const;
 
-    void createEntryFor(const KArchiveEntry *aentry, const QString& prefix);
+    /**
+     * Reports the entries in @p dir, or appends them to @p entries if it
+     * is given.
+     */
+    bool processDir(const KArchiveDirectory *dir, const QString & prefix = QString(), QList<ArchiveEntry> *entries = 0);
+
+    void createEntryFor(const KArchiveEntry *aentry, const QString& prefix, QList<ArchiveEntry> *entries = 0);
+
+    /**
+     * Adds the file or directory at @p path to @p archive as
+     * @p destinationName, checking for cancellation before each file.
+     *
+     * @return @c false if adding failed or was cancelled.
+     */
+    bool addLocalFile(KArchive *archive, const QString &path, const QString &destinationName);
+    bool addLocalDirectory(KArchive *archive, const QString &path, const QString &destinationName);
+
+    /**
+     * Copies the archive, if it exists, to @p destination.
+     */
+    bool copyArchiveTo(QFile *destination);
 
     QString permissionsString(mode_t perm);
 
     void getAllEntries(const KArchiveDirectory *dir, const QString &prefix, QList< QVariant > &list);
 
+    /**
+     * Copies @p file into @p destinationDirectory.
+     *
+     * @return @c false if the copy was cancelled, in which case the
+     *         partially written file has been removed.
+     */
+    bool copyFile(const KArchiveFile *file, const QString &destinationDirectory);
+
     int handleFileExistsMessage(const QString &dir, const QString &fileName);
 
     KArchive *archive();
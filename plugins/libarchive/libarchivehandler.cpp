@@ -44,6 +44,7 @@
 #include <QDirIterator>
 #include <QFile>
 #include <QList>
+#include <QSet>
 #include <QStringList>
 
 /**
@@ -87,7 +88,6 @@ LibArchiveInterface::LibArchiveInterface(QObject *parent, const QVariantList & a
     , m_extractedFilesSize(0)
     , m_workDir(QDir::current())
     , m_archiveReadDisk(archive_read_disk_new())
-    , m_abortOperation(false)
 {
     archive_read_disk_set_standard_lookup(m_archiveReadDisk.data());
 }
@@ -96,6 +96,11 @@ LibArchiveInterface::~LibArchiveInterface()
 {
 }
 
+ReadOnlyArchiveInterface *LibArchiveInterface::createConcurrentReader()
+{
+    return new LibArchiveInterface(0, QVariantList() << filename());
+}
+
 bool LibArchiveInterface::list()
 {
     kDebug();
@@ -126,7 +131,7 @@ bool LibArchiveInterface::list()
     struct archive_entry *aentry;
     int result;
 
-    while (!m_abortOperation && (result = archive_read_next_header(arch_reader.data(), &aentry)) == ARCHIVE_OK) {
+    while (checkpoint() && (result = archive_read_next_header(arch_reader.data(), &aentry)) == ARCHIVE_OK) {
         if (!m_emitNoEntries) {
             emitEntryFromArchiveEntry(aentry);
         }
@@ -136,7 +141,11 @@ bool LibArchiveInterface::list()
         m_cachedArchiveEntryCount++;
         archive_read_data_skip(arch_reader.data());
     }
-    m_abortOperation = false;
+
+    if (cancellationToken()->isCancelled()) {
+        kDebug() << "Listing cancelled";
+        return false;
+    }
 
     if (result != ARCHIVE_EOF) {
         emit error(i18nc("@info", "The archive reading failed with the following error: <message>%1</message>",
@@ -147,20 +156,118 @@ bool LibArchiveInterface::list()
     return archive_read_close(arch_reader.data()) == ARCHIVE_OK;
 }
 
-bool LibArchiveInterface::doKill()
+bool LibArchiveInterface::visitEntries(EntryVisitor *visitor)
 {
-    m_abortOperation = true;
-    return true;
+    ArchiveRead arch_reader(archive_read_new());
+
+    if (!(arch_reader.data())) {
+        return false;
+    }
+
+    if (archive_read_support_filter_all(arch_reader.data()) != ARCHIVE_OK) {
+        return false;
+    }
+
+    if (archive_read_support_format_all(arch_reader.data()) != ARCHIVE_OK) {
+        return false;
+    }
+
+    if (archive_read_open_filename(arch_reader.data(), QFile::encodeName(filename()), 10240) != ARCHIVE_OK) {
+        emit error(i18nc("@info", "Could not open the archive <filename>%1</filename>, libarchive cannot handle it.",
+                   filename()));
+        return false;
+    }
+
+    struct archive_entry *aentry;
+    int result;
+
+    while (checkpoint() && (result = archive_read_next_header(arch_reader.data(), &aentry)) == ARCHIVE_OK) {
+        if (!visitor->visit(convertArchiveEntry(aentry))) {
+            kDebug() << "Stopped by the visitor";
+            result = ARCHIVE_EOF;
+            break;
+        }
+
+        archive_read_data_skip(arch_reader.data());
+    }
+
+    if (cancellationToken()->isCancelled()) {
+        kDebug() << "Reading cancelled";
+        return false;
+    }
+
+    if (result != ARCHIVE_EOF) {
+        emit error(i18nc("@info", "The archive reading failed with the following error: <message>%1</message>",
+                   QLatin1String( archive_error_string(arch_reader.data()))));
+        return false;
+    }
+
+    return archive_read_close(arch_reader.data()) == ARCHIVE_OK;
+}
+
+/**
+ * Whether @p entryName is in @p selection or inside one of the folders in
+ * it. The selected paths are given without trailing slashes.
+ */
+static bool isSelected(const QString& entryName, const QSet<QString>& selection)
+{
+    QString path = entryName;
+    if (path.endsWith(QLatin1Char('/'))) {
+        path.chop(1);
+    }
+
+    forever {
+        if (selection.contains(path)) {
+            return true;
+        }
+
+        const int slash = path.lastIndexOf(QLatin1Char('/'));
+        if (slash == -1) {
+            return false;
+        }
+        path.truncate(slash);
+    }
+}
+
+/**
+ * Where the archive entry @p entryName is written in @p destination: only
+ * its file name if @p preservePaths is not set, and otherwise its path
+ * without the leading @p rootNode.
+ */
+static QString extractedFilePath(const QDir& destination, const QString& entryName,
+                                 bool preservePaths, const QString& rootNode)
+{
+    if (!preservePaths) {
+        return destination.absoluteFilePath(QFileInfo(entryName).fileName());
+    }
+
+    if (!rootNode.isEmpty() && entryName.startsWith(rootNode)) {
+        return destination.absoluteFilePath(entryName.mid(rootNode.size()));
+    }
+
+    return destination.absoluteFilePath(entryName);
 }
 
 bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& destinationDirectory, ExtractionOptions options)
 {
-    kDebug() << "Changing current directory to " << destinationDirectory;
-    QDir::setCurrent(destinationDirectory);
+    // The entries are written with absolute paths inside the destination
+    // directory instead of changing the current directory, which would
+    // affect every other job running in Ark at the same time.
+    const QDir destination(destinationDirectory);
 
     const bool extractAll = files.isEmpty();
     const bool preservePaths = options.value(QLatin1String( "PreservePaths" )).toBool();
 
+    // A selected folder stands for everything in it.
+    QSet<QString> selection;
+    foreach(const QVariant& file, files) {
+        QString path = file.toString();
+        if (path.endsWith(QLatin1Char('/'))) {
+            path.chop(1);
+        }
+        selection.insert(path);
+    }
+
     QString rootNode = options.value(QLatin1String("RootNode"), QVariant()).toString();
     if ((!rootNode.isEmpty()) && (!rootNode.endsWith(QLatin1Char('/')))) {
         rootNode.append(QLatin1Char('/'));
@@ -205,10 +312,14 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
             m_emitNoEntries = true;
             list();
             m_emitNoEntries = false;
+
+            if (cancellationToken()->isCancelled()) {
+                return false;
+            }
         }
         totalCount = m_cachedArchiveEntryCount;
     } else {
-        totalCount = files.size();
+        totalCount = m_cachedArchiveEntryCount;
     }
 
     m_currentExtractedFilesSize = 0;
@@ -219,9 +330,18 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
 
     QString fileBeingRenamed;
 
-    while (archive_read_next_header(arch.data(), &entry) == ARCHIVE_OK) {
+    while (checkpoint() && archive_read_next_header(arch.data(), &entry) == ARCHIVE_OK) {
         fileBeingRenamed.clear();
 
+        //if we only partially extract the archive and the number of
+        //archive entries is available, we use a simple progress based on
+        //the number of entries read, as the selected folders may contain
+        //any number of them
+        if (!extractAll && m_cachedArchiveEntryCount) {
+            ++entryNr;
+            emit progress(float(entryNr) / totalCount);
+        }
+
         // retry with renamed entry, fire an overwrite query again
         // if the new entry also exists
     retry:
@@ -236,7 +356,10 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
         //entryName is the name inside the archive, full path
         QString entryName = QDir::fromNativeSeparators(QFile::decodeName(archive_entry_pathname(entry)));
 
-        if (entryName.startsWith(QLatin1Char( '/' ))) {
+        // A renamed entry already carries the absolute path the user chose.
+        const bool entryIsRenamed = !fileBeingRenamed.isEmpty() && (entryName == fileBeingRenamed);
+
+        if (!entryIsRenamed && entryName.startsWith(QLatin1Char( '/' ))) {
             //for now we just can't handle absolute filenames in a tar archive.
             //TODO: find out what to do here!!
             emit error(i18n("This archive contains archive entries with absolute paths, which are not yet supported by ark."));
@@ -244,7 +367,7 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
             return false;
         }
 
-        if (files.contains(entryName) || entryName == fileBeingRenamed || extractAll) {
+        if (extractAll || entryIsRenamed || isSelected(entryName, selection)) {
             // entryFI is the fileinfo pointing to where the file will be
             // written from the archive
             QFileInfo entryFI(entryName);
@@ -252,27 +375,26 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
 
             const QString fileWithoutPath(entryFI.fileName());
 
-            //if we DON'T preserve paths, we cut the path and set the entryFI
-            //fileinfo to the one without the path
-            if (!preservePaths) {
-                //empty filenames (ie dirs) should have been skipped already,
-                //so asserting
-                Q_ASSERT(!fileWithoutPath.isEmpty());
-
-                archive_entry_copy_pathname(entry, QFile::encodeName(fileWithoutPath).constData());
-                entryFI = QFileInfo(fileWithoutPath);
-
-                //OR, if the commonBase has been set, then we remove this
-                //common base from the filename
-            } else if (!rootNode.isEmpty()) {
-                kDebug() << "Removing" << rootNode << "from" << entryName;
-
-                const QString truncatedFilename(entryName.remove(0, rootNode.size()));
-                archive_entry_copy_pathname(entry, QFile::encodeName(truncatedFilename).constData());
-
-                entryFI = QFileInfo(truncatedFilename);
+            if (!entryIsRenamed) {
+                //if we DON'T preserve paths, we cut the path; empty filenames
+                //(ie dirs) should have been skipped already, so asserting
+                Q_ASSERT(preservePaths || !fileWithoutPath.isEmpty());
+
+                entryFI = QFileInfo(extractedFilePath(destination, entryName, preservePaths, rootNode));
+
+                // Hard links name another entry of the archive, which is
+                // moved to the destination the same way. A renamed entry
+                // had its link moved before it was renamed.
+                const char *hardlink = archive_entry_hardlink(entry);
+                if (hardlink) {
+                    const QString target = QDir::fromNativeSeparators(QFile::decodeName(hardlink));
+                    const QString targetPath = extractedFilePath(destination, target, preservePaths, rootNode);
+                    archive_entry_copy_hardlink(entry, QFile::encodeName(targetPath).constData());
+                }
             }
 
+            archive_entry_copy_pathname(entry, QFile::encodeName(entryFI.filePath()).constData());
+
             //now check if the file about to be written already exists
             if (!entryIsDir && entryFI.exists()) {
                 if (skipAll) {
@@ -280,7 +402,7 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
                     archive_entry_clear(entry);
                     continue;
                 } else if (!overwriteAll && !skipAll) {
-                    Kerfuffle::OverwriteQuery query(entryName);
+                    Kerfuffle::OverwriteQuery query(entryFI.filePath());
                     emit userQuery(&query);
                     query.waitForResponse();
 
@@ -325,7 +447,13 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
             if ((header_response = archive_write_header(writer.data(), entry)) == ARCHIVE_OK) {
                 //if the whole archive is extracted and the total filesize is
                 //available, we use partial progress
-                copyData(arch.data(), writer.data(), (extractAll && m_extractedFilesSize));
+                if (!copyData(arch.data(), writer.data(), (extractAll && m_extractedFilesSize)) &&
+                    cancellationToken()->isCancelled()) {
+                    // Do not leave a truncated file behind.
+                    archive_write_finish_entry(writer.data());
+                    QFile::remove(QFile::decodeName(archive_entry_pathname(entry)));
+                    break;
+                }
             } else if (header_response == ARCHIVE_WARN) {
                 kDebug() << "Warning while writing " << entryName;
             } else {
@@ -333,19 +461,17 @@ bool LibArchiveInterface::copyFiles(const QVariantList& files, const QString& de
                 << "While attempting to write " << entryName;
             }
 
-            //if we only partially extract the archive and the number of
-            //archive entries is available we use a simple progress based on
-            //number of items extracted
-            if (!extractAll && m_cachedArchiveEntryCount) {
-                ++entryNr;
-                emit progress(float(entryNr) / totalCount);
-            }
             archive_entry_clear(entry);
         } else {
             archive_read_data_skip(arch.data());
         }
     }
 
+    if (cancellationToken()->isCancelled()) {
+        kDebug() << "Extraction cancelled";
+        return false;
+    }
+
     return archive_read_close(arch.data()) == ARCHIVE_OK;
 }
 
@@ -354,11 +480,10 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
     const bool creatingNewFile = !QFileInfo(filename()).exists();
     const QString globalWorkDir = options.value(QLatin1String( "GlobalWorkDir" )).toString();
 
-    if (!globalWorkDir.isEmpty()) {
-        kDebug() << "GlobalWorkDir is set, changing dir to " << globalWorkDir;
-        m_workDir.setPath(globalWorkDir);
-        QDir::setCurrent(globalWorkDir);
-    }
+    // Relative paths are resolved against the work dir here instead of
+    // changing the current directory of the whole process.
+    m_workDir = globalWorkDir.isEmpty() ? QDir::current() : QDir(globalWorkDir);
+    kDebug() << "Adding files relative to" << m_workDir.path();
 
     m_writtenFiles.clear();
 
@@ -466,6 +591,22 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
         }
     }
 
+    // Not every filter knows about these options (and bzip2 has no level
+    // 0), so failing to set them is not fatal.
+    if (options.contains(QLatin1String("GlobalCompressionLevel"))) {
+        const QByteArray level = QByteArray::number(options.value(QLatin1String("GlobalCompressionLevel")).toInt());
+        if (archive_write_set_filter_option(arch_writer.data(), NULL, "compression-level", level.constData()) != ARCHIVE_OK) {
+            kDebug() << "Could not set the compression level:" << archive_error_string(arch_writer.data());
+        }
+    }
+
+    if (options.value(QLatin1String("GlobalCompressionThreads")).toInt() > 0) {
+        const QByteArray threads = QByteArray::number(options.value(QLatin1String("GlobalCompressionThreads")).toInt());
+        if (archive_write_set_filter_option(arch_writer.data(), NULL, "threads", threads.constData()) != ARCHIVE_OK) {
+            kDebug() << "Could not set the number of compression threads:" << archive_error_string(arch_writer.data());
+        }
+    }
+
     ret = archive_write_open_fd(arch_writer.data(), tempFile->handle());
     if (ret != ARCHIVE_OK) {
         emit error(i18nc("@info", "Opening the archive for writing failed with the following error: <message>%1</message>", QLatin1String(archive_error_string(arch_writer.data()))));
@@ -473,7 +614,12 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
     }
 
     //**************** first write the new files
-    foreach(const QString& selectedFile, files) {
+    foreach(const QString& file, files) {
+        if (!checkpoint()) {
+            break;
+        }
+
+        const QString selectedFile = m_workDir.absoluteFilePath(file);
         bool success;
 
         success = writeFile(selectedFile, arch_writer.data());
@@ -488,7 +634,7 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
                             QDir::Hidden | QDir::NoDotAndDotDot,
                             QDirIterator::Subdirectories);
 
-            while (it.hasNext()) {
+            while (checkpoint() && it.hasNext()) {
                 const QString path = it.next();
 
                 if ((it.fileName() == QLatin1String("..")) ||
@@ -514,7 +660,7 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
     //and if we have old elements...
     if (!creatingNewFile) {
         //********** copy old elements from previous archive to new archive
-        while (archive_read_next_header(arch_reader.data(), &entry) == ARCHIVE_OK) {
+        while (checkpoint() && archive_read_next_header(arch_reader.data(), &entry) == ARCHIVE_OK) {
             if (m_writtenFiles.contains(QFile::decodeName(archive_entry_pathname(entry)))) {
                 archive_read_data_skip(arch_reader.data());
                 kDebug() << "Entry already existing, will be refresh: ===> " << archive_entry_pathname(entry);
@@ -536,6 +682,13 @@ bool LibArchiveInterface::addFiles(const QStringList& files, const CompressionOp
         }
     }
 
+    // Returning without finalize() makes tempFile discard everything
+    // written so far and leaves the archive as it was.
+    if (cancellationToken()->isCancelled()) {
+        kDebug() << "Adding files cancelled";
+        return false;
+    }
+
     // In the success case, we need to manually close the archive_writer before
     // calling KSaveFile::finalize(), otherwise the latter will close() the
     // file descriptor archive_writer is still working on.
@@ -626,7 +779,7 @@ bool LibArchiveInterface::deleteFiles(const QVariantList& files)
     struct archive_entry *entry;
 
     //********** copy old elements from previous archive to new archive
-    while (archive_read_next_header(arch_reader.data(), &entry) == ARCHIVE_OK) {
+    while (checkpoint() && archive_read_next_header(arch_reader.data(), &entry) == ARCHIVE_OK) {
         if (files.contains(QFile::decodeName(archive_entry_pathname(entry)))) {
             archive_read_data_skip(arch_reader.data());
             kDebug() << "Entry to be deleted, skipping"
@@ -647,6 +800,13 @@ bool LibArchiveInterface::deleteFiles(const QVariantList& files)
         }
     }
 
+    // Returning without finalize() makes tempFile discard everything
+    // written so far and leaves the archive as it was.
+    if (cancellationToken()->isCancelled()) {
+        kDebug() << "Deleting files cancelled";
+        return false;
+    }
+
     // In the success case, we need to manually close the archive_writer before
     // calling KSaveFile::finalize(), otherwise the latter will close() the
     // file descriptor archive_writer is still working on.
@@ -659,6 +819,11 @@ bool LibArchiveInterface::deleteFiles(const QVariantList& files)
 }
 
 void LibArchiveInterface::emitEntryFromArchiveEntry(struct archive_entry *aentry)
+{
+    emit entry(convertArchiveEntry(aentry));
+}
+
+ArchiveEntry LibArchiveInterface::convertArchiveEntry(struct archive_entry *aentry) const
 {
     ArchiveEntry e;
 
@@ -688,7 +853,7 @@ void LibArchiveInterface::emitEntryFromArchiveEntry(struct archive_entry *aentry
 
     e[Timestamp] = QDateTime::fromTime_t(archive_entry_mtime(aentry));
 
-    emit entry(e);
+    return e;
 }
 
 int LibArchiveInterface::extractionFlags() const
@@ -710,23 +875,27 @@ int LibArchiveInterface::extractionFlags() const
     return result;
 }
 
-void LibArchiveInterface::copyData(const QString& filename, struct archive *dest, bool partialprogress)
+bool LibArchiveInterface::copyData(const QString& filename, struct archive *dest, bool partialprogress)
 {
     char buff[10240];
     ssize_t readBytes;
     QFile file(filename);
 
     if (!file.open(QIODevice::ReadOnly)) {
-        return;
+        return false;
     }
 
     readBytes = file.read(buff, sizeof(buff));
     while (readBytes > 0) {
+        if (!checkpoint(readBytes)) {
+            return false;
+        }
+
         /* int writeBytes = */
         archive_write_data(dest, buff, readBytes);
         if (archive_errno(dest) != ARCHIVE_OK) {
             kDebug() << "Error while writing..." << archive_error_string(dest) << "(error nb =" << archive_errno(dest) << ')';
-            return;
+            return false;
         }
 
         if (partialprogress) {
@@ -738,20 +907,26 @@ void LibArchiveInterface::copyData(const QString& filename, struct archive *dest
     }
 
     file.close();
+
+    return true;
 }
 
-void LibArchiveInterface::copyData(struct archive *source, struct archive *dest, bool partialprogress)
+bool LibArchiveInterface::copyData(struct archive *source, struct archive *dest, bool partialprogress)
 {
     char buff[10240];
     ssize_t readBytes;
 
     readBytes = archive_read_data(source, buff, sizeof(buff));
     while (readBytes > 0) {
+        if (!checkpoint(readBytes)) {
+            return false;
+        }
+
         /* int writeBytes = */
         archive_write_data(dest, buff, readBytes);
         if (archive_errno(dest) != ARCHIVE_OK) {
             kDebug() << "Error while extracting..." << archive_error_string(dest) << "(error nb =" << archive_errno(dest) << ')';
-            return;
+            return false;
         }
 
         if (partialprogress) {
@@ -761,6 +936,8 @@ void LibArchiveInterface::copyData(struct archive *source, struct archive *dest,
 
         readBytes = archive_read_data(source, buff, sizeof(buff));
     }
+
+    return true;
 }
 
 // TODO: if we merge this with copyData(), we can pass more data
@@ -794,7 +971,10 @@ bool LibArchiveInterface::writeFile(const QString& fileName, struct archive* arc
     if ((header_response = archive_write_header(arch_writer, entry)) == ARCHIVE_OK) {
         //if the whole archive is extracted and the total filesize is
         //available, we use partial progress
-        copyData(fileName, arch_writer, false);
+        if (!copyData(fileName, arch_writer, false) && cancellationToken()->isCancelled()) {
+            archive_entry_free(entry);
+            return false;
+        }
     } else {
         kDebug() << "Writing header failed with error code " << header_response;
         kDebug() << "Error while writing..." << archive_error_string(arch_writer) << "(error nb =" << archive_errno(arch_writer) << ')';
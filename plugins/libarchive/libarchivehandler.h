@@ -45,16 +45,30 @@ public:
     ~LibArchiveInterface();
 
     bool list();
-    bool doKill();
+    bool visitEntries(EntryVisitor *visitor);
     bool copyFiles(const QVariantList& files, const QString& destinationDirectory, ExtractionOptions options);
     bool addFiles(const QStringList& files, const CompressionOptions& options);
     bool deleteFiles(const QVariantList& files);
 
+protected:
+    /**
+     * Each interface has its own libarchive handles, so a second one can
+     * read the archive while this one does.
+     */
+    virtual ReadOnlyArchiveInterface *createConcurrentReader();
+
 private:
+    ArchiveEntry convertArchiveEntry(struct archive_entry *entry) const;
     void emitEntryFromArchiveEntry(struct archive_entry *entry);
     int extractionFlags() const;
-    void copyData(const QString& filename, struct archive *dest, bool partialprogress = true);
-    void copyData(struct archive *source, struct archive *dest, bool partialprogress = true);
+    /**
+     * Copies the data of the current entry in blocks, calling
+     * checkpoint() before writing each one.
+     *
+     * @return @c false if the copy failed or was cancelled.
+     */
+    bool copyData(const QString& filename, struct archive *dest, bool partialprogress = true);
+    bool copyData(struct archive *source, struct archive *dest, bool partialprogress = true);
     bool writeFile(const QString& fileName, struct archive* arch);
 
     struct ArchiveReadCustomDeleter;
@@ -69,7 +83,6 @@ private:
     QDir m_workDir;
     QStringList m_writtenFiles;
     ArchiveRead m_archiveReadDisk;
-    bool m_abortOperation;
 };
 
 #endif // LIBARCHIVEHANDLER_H
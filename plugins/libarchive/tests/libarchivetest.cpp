@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "libarchivetest.h"
+#include "../libarchivehandler.h"
+#include "kerfuffle/jobs.h"
+#include "kerfuffle/jobscheduler.h"
+
+#include <qtest_kde.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <KDebug>
+#include <KGlobal>
+#include <KTempDir>
+
+#include <QDir>
+#include <QFile>
+#include <QTime>
+
+QTEST_KDEMAIN_CORE(LibArchiveTest)
+
+using namespace Kerfuffle;
+
+static const int ArchiveCount = 12;
+static const int Rounds = 3;
+
+// Big enough for the extraction to still be running when it is killed.
+static const int BigFileSize = 128 * 1024 * 1024;
+static const int MaximumCancelLatency = 500;
+
+// Extracting ThrottledFileSize bytes at ThrottledBandwidth bytes per second
+// takes half a second.
+static const int ThrottledFileSize = 4 * 1024 * 1024;
+static const int ThrottledBandwidth = 8 * 1024 * 1024;
+
+static bool writeFile(const QString& fileName, const QByteArray& contents)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    return file.write(contents) == contents.size();
+}
+
+static QByteArray readFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+
+    return file.readAll();
+}
+
+/**
+ * Writes a tar archive with the directory "dir", the file "dir/file.txt"
+ * containing @p contents and the hard link "dir/link.txt" to it, which
+ * addFiles() cannot create.
+ */
+static bool writeArchiveWithHardlink(const QString& fileName, const QByteArray& contents)
+{
+    struct archive *arch = archive_write_new();
+    archive_write_set_format_pax_restricted(arch);
+    if (archive_write_open_filename(arch, QFile::encodeName(fileName).constData()) != ARCHIVE_OK) {
+        archive_write_free(arch);
+        return false;
+    }
+
+    struct archive_entry *entry = archive_entry_new();
+    bool ok = true;
+
+    archive_entry_set_pathname(entry, "dir/");
+    archive_entry_set_filetype(entry, AE_IFDIR);
+    archive_entry_set_perm(entry, 0755);
+    ok = ok && (archive_write_header(arch, entry) == ARCHIVE_OK);
+
+    archive_entry_clear(entry);
+    archive_entry_set_pathname(entry, "dir/file.txt");
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_size(entry, contents.size());
+    ok = ok && (archive_write_header(arch, entry) == ARCHIVE_OK);
+    ok = ok && (archive_write_data(arch, contents.constData(), contents.size()) == contents.size());
+
+    archive_entry_clear(entry);
+    archive_entry_set_pathname(entry, "dir/link.txt");
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+    archive_entry_set_hardlink(entry, "dir/file.txt");
+    archive_entry_set_size(entry, 0);
+    ok = ok && (archive_write_header(arch, entry) == ARCHIVE_OK);
+
+    archive_entry_free(entry);
+    ok = (archive_write_close(arch) == ARCHIVE_OK) && ok;
+    archive_write_free(arch);
+
+    return ok;
+}
+
+void LibArchiveTest::init()
+{
+    // Hackish way to make sure the i18n stuff
+    // is called from the main thread
+    KGlobal::locale();
+
+    m_tempDir = new KTempDir;
+    m_root = QDir(m_tempDir->name());
+}
+
+void LibArchiveTest::cleanup()
+{
+    delete m_tempDir;
+    m_tempDir = 0;
+}
+
+void LibArchiveTest::slotJobResult(KJob *job)
+{
+    if (job->error()) {
+        kDebug() << "Job failed:" << job->errorText();
+        ++m_failedJobs;
+    }
+
+    if (--m_runningJobs == 0) {
+        m_eventLoop.quit();
+    }
+}
+
+AddJob *LibArchiveTest::addJob(LibArchiveInterface *interface, const QString& sourceDir,
+                               const QStringList& fileNames)
+{
+    const QDir source(m_root.filePath(sourceDir));
+
+    CompressionOptions options;
+    options[QLatin1String("GlobalWorkDir")] = source.path();
+
+    QStringList files;
+    foreach(const QString& fileName, fileNames) {
+        files << source.filePath(fileName);
+    }
+
+    return new AddJob(files, options, interface, this);
+}
+
+void LibArchiveTest::runJobs(const QList<KJob*>& jobs)
+{
+    m_runningJobs = jobs.count();
+    m_failedJobs = 0;
+
+    foreach(KJob *job, jobs) {
+        connect(job, SIGNAL(result(KJob*)), SLOT(slotJobResult(KJob*)));
+    }
+
+    foreach(KJob *job, jobs) {
+        job->start();
+    }
+
+    m_eventLoop.exec();
+}
+
+/*
+ * Add to and extract from several archives at the same time: no job may
+ * change the current directory, and each must only see its own files.
+ */
+void LibArchiveTest::testConcurrentAddAndExtract()
+{
+    JobScheduler *scheduler = JobScheduler::self();
+    const int maximumConcurrentJobs = scheduler->maximumConcurrentJobs();
+    scheduler->setMaximumConcurrentJobs(ArchiveCount);
+
+    const QString currentPath = QDir::currentPath();
+
+    QList<LibArchiveInterface*> interfaces;
+
+    for (int i = 0; i < ArchiveCount; ++i) {
+        const QString sourceDir = QString(QLatin1String("source%1")).arg(i);
+        QVERIFY(m_root.mkpath(sourceDir + QLatin1String("/dir")));
+
+        const QByteArray contents = QByteArray("archive ") + QByteArray::number(i);
+        QVERIFY(writeFile(m_root.filePath(sourceDir + QLatin1String("/a.txt")), contents));
+        QVERIFY(writeFile(m_root.filePath(sourceDir + QLatin1String("/dir/b.txt")), contents + QByteArray(4096, 'x')));
+
+        QVariantList args;
+        args.append(m_root.filePath(QString(QLatin1String("archive%1.tar")).arg(i)));
+        interfaces.append(new LibArchiveInterface(this, args));
+    }
+
+    for (int round = 0; round < Rounds; ++round) {
+        QList<KJob*> jobs;
+
+        for (int i = 0; i < ArchiveCount; ++i) {
+            jobs.append(addJob(interfaces.at(i), QString(QLatin1String("source%1")).arg(i),
+                               QStringList() << QLatin1String("a.txt") << QLatin1String("dir")));
+        }
+
+        runJobs(jobs);
+        QCOMPARE(m_failedJobs, 0);
+        QCOMPARE(QDir::currentPath(), currentPath);
+
+        jobs.clear();
+
+        for (int i = 0; i < ArchiveCount; ++i) {
+            const QString destination = m_root.filePath(QString(QLatin1String("round%1/destination%2")).arg(round).arg(i));
+            QVERIFY(m_root.mkpath(destination));
+
+            ExtractionOptions options;
+            options[QLatin1String("PreservePaths")] = true;
+
+            jobs.append(new ExtractJob(QVariantList(), destination, options, interfaces.at(i), this));
+        }
+
+        runJobs(jobs);
+        QCOMPARE(m_failedJobs, 0);
+        QCOMPARE(QDir::currentPath(), currentPath);
+
+        for (int i = 0; i < ArchiveCount; ++i) {
+            const QString destination = m_root.filePath(QString(QLatin1String("round%1/destination%2")).arg(round).arg(i));
+            const QByteArray contents = QByteArray("archive ") + QByteArray::number(i);
+
+            QCOMPARE(readFile(destination + QLatin1String("/a.txt")), contents);
+            QCOMPARE(readFile(destination + QLatin1String("/dir/b.txt")), contents + QByteArray(4096, 'x'));
+            QVERIFY(!QFile::exists(currentPath + QLatin1String("/a.txt")));
+        }
+    }
+
+    qDeleteAll(interfaces);
+    scheduler->setMaximumConcurrentJobs(maximumConcurrentJobs);
+}
+
+/*
+ * Killing an extraction must stop it within a bounded time, and must not
+ * leave the file it was writing behind.
+ */
+void LibArchiveTest::testCancelLatency()
+{
+    QVERIFY(m_root.mkpath(QLatin1String("source")));
+    QVERIFY(m_root.mkpath(QLatin1String("destination")));
+
+    {
+        QFile file(m_root.filePath(QLatin1String("source/big.bin")));
+        QVERIFY(file.open(QIODevice::WriteOnly));
+
+        QByteArray block(1024 * 1024, '\0');
+        for (int i = 0; i < BigFileSize / block.size(); ++i) {
+            block.fill(char(i));
+            QCOMPARE(file.write(block), qint64(block.size()));
+        }
+    }
+
+    QVariantList args;
+    args.append(m_root.filePath(QLatin1String("archive.tar")));
+    LibArchiveInterface interface(this, args);
+
+    runJobs(QList<KJob*>() << addJob(&interface, QLatin1String("source"), QStringList() << QLatin1String("big.bin")));
+    QCOMPARE(m_failedJobs, 0);
+
+    ExtractionOptions options;
+    options[QLatin1String("PreservePaths")] = true;
+
+    ExtractJob *job = new ExtractJob(QVariantList(), m_root.filePath(QLatin1String("destination")),
+                                     options, &interface, this);
+    job->setAutoDelete(false);
+
+    // Wait until the extraction has written something.
+    QEventLoop eventLoop;
+    connect(job, SIGNAL(percent(KJob*,ulong)), &eventLoop, SLOT(quit()));
+    job->start();
+    eventLoop.exec();
+
+    QTime latency;
+    latency.start();
+
+    QVERIFY(job->kill());
+
+    // The destructor waits for the job to stop running.
+    delete job;
+
+    kDebug() << "Cancelling took" << latency.elapsed() << "ms";
+    QVERIFY(latency.elapsed() < MaximumCancelLatency);
+
+    QVERIFY(!QFile::exists(m_root.filePath(QLatin1String("destination/big.bin"))));
+}
+
+void LibArchiveTest::testBandwidthLimit()
+{
+    QVERIFY(m_root.mkpath(QLatin1String("source")));
+    QVERIFY(m_root.mkpath(QLatin1String("destination")));
+
+    const QByteArray contents(ThrottledFileSize, 'x');
+    QVERIFY(writeFile(m_root.filePath(QLatin1String("source/file.bin")), contents));
+
+    QVariantList args;
+    args.append(m_root.filePath(QLatin1String("archive.tar")));
+    LibArchiveInterface interface(this, args);
+
+    runJobs(QList<KJob*>() << addJob(&interface, QLatin1String("source"), QStringList() << QLatin1String("file.bin")));
+    QCOMPARE(m_failedJobs, 0);
+
+    ExtractionOptions options;
+    options[QLatin1String("PreservePaths")] = true;
+    options[QLatin1String("BandwidthLimit")] = ThrottledBandwidth;
+    options[QLatin1String("IOPriorityClass")] = QLatin1String("idle");
+
+    QTime elapsed;
+    elapsed.start();
+
+    runJobs(QList<KJob*>() << new ExtractJob(QVariantList(), m_root.filePath(QLatin1String("destination")),
+                                             options, &interface, this));
+    QCOMPARE(m_failedJobs, 0);
+
+    kDebug() << "Throttled extraction took" << elapsed.elapsed() << "ms";
+    QVERIFY(elapsed.elapsed() >= 1000 * qint64(ThrottledFileSize) / ThrottledBandwidth);
+
+    QCOMPARE(readFile(m_root.filePath(QLatin1String("destination/file.bin"))), contents);
+}
+
+void LibArchiveTest::testHardlinks_data()
+{
+    QTest::addColumn<bool>("preservePaths");
+    QTest::addColumn<QString>("rootNode");
+    QTest::addColumn<QString>("expectedDirectory");
+
+    QTest::newRow("preserving paths")
+        << true << QString() << QString(QLatin1String("dir/"));
+    QTest::newRow("below a root node")
+        << true << QString(QLatin1String("dir")) << QString();
+    QTest::newRow("without paths")
+        << false << QString() << QString();
+}
+
+/*
+ * Hard links must point to the files extracted to the destination, not
+ * to paths relative to the current directory.
+ */
+void LibArchiveTest::testHardlinks()
+{
+    QFETCH(bool, preservePaths);
+    QFETCH(QString, rootNode);
+    QFETCH(QString, expectedDirectory);
+
+    const QString currentPath = QDir::currentPath();
+    const QByteArray contents("hard linked");
+
+    QVERIFY(writeArchiveWithHardlink(m_root.filePath(QLatin1String("archive.tar")), contents));
+    QVERIFY(m_root.mkpath(QLatin1String("destination")));
+
+    QVariantList args;
+    args.append(m_root.filePath(QLatin1String("archive.tar")));
+    LibArchiveInterface interface(this, args);
+
+    ExtractionOptions options;
+    options[QLatin1String("PreservePaths")] = preservePaths;
+    if (!rootNode.isEmpty()) {
+        options[QLatin1String("RootNode")] = rootNode;
+    }
+
+    runJobs(QList<KJob*>() << new ExtractJob(QVariantList(), m_root.filePath(QLatin1String("destination")),
+                                             options, &interface, this));
+    QCOMPARE(m_failedJobs, 0);
+
+    const QDir destination(m_root.filePath(QLatin1String("destination")));
+    QCOMPARE(readFile(destination.filePath(expectedDirectory + QLatin1String("file.txt"))), contents);
+    QCOMPARE(readFile(destination.filePath(expectedDirectory + QLatin1String("link.txt"))), contents);
+    QVERIFY(!QFile::exists(currentPath + QLatin1String("/dir/link.txt")));
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES ( INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION ) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * ( INCLUDING NEGLIGENCE OR OTHERWISE ) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBARCHIVETEST_H
+#define LIBARCHIVETEST_H
+
+#include <QDir>
+#include <QEventLoop>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+
+class KJob;
+class KTempDir;
+class LibArchiveInterface;
+
+namespace Kerfuffle
+{
+class AddJob;
+}
+
+class LibArchiveTest : public QObject
+{
+    Q_OBJECT
+
+protected Q_SLOTS:
+    void slotJobResult(KJob *job);
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+
+    void testConcurrentAddAndExtract();
+    void testCancelLatency();
+    void testBandwidthLimit();
+    void testHardlinks_data();
+    void testHardlinks();
+
+private:
+    /**
+     * Creates a job adding @p fileNames, relative to @p sourceDir in the
+     * temporary directory, to the archive of @p interface.
+     */
+    Kerfuffle::AddJob *addJob(LibArchiveInterface *interface, const QString& sourceDir,
+                              const QStringList& fileNames);
+    void runJobs(const QList<KJob*>& jobs);
+
+    KTempDir *m_tempDir;
+    QDir m_root;
+
+    QEventLoop m_eventLoop;
+    int m_runningJobs;
+    int m_failedJobs;
+};
+
+#endif
@@ -81,10 +81,19 @@ bool LibSingleFileInterface::copyFiles(const QList<QVariant> & files, const QStr
 
     device->open(QIODevice::ReadOnly);
 
-    qint64 bytesRead;
+    qint64 bytesRead = 0;
     QByteArray dataChunk(1024*16, '\0');   // 16Kb
 
     while (true) {
+        if (!checkpoint(bytesRead)) {
+            kDebug() << "Extraction cancelled, removing" << outputFileName;
+            delete device;
+            outputFile.close();
+            outputFile.remove();
+
+            return false;
+        }
+
         bytesRead = device->read(dataChunk.data(), dataChunk.size());
 
         if (bytesRead == -1) {